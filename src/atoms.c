@@ -0,0 +1,380 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#include<ctype.h>
+#include<math.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include"atoms.h"
+#include"distance.h"
+#include"pdb.h"
+
+static int g_all_atoms = 0;
+
+/**
+ * use_all_atoms: turn all-atom distances on or off
+ *
+ * While it is on, getchains() and getcoords() read the heavy atoms of
+ * every residue as well as its alpha carbon, and distances between
+ * residues are the shortest distances between their heavy atoms.
+ */
+void
+use_all_atoms(int on)
+{
+        g_all_atoms = on;
+}
+
+/**
+ * all_atoms_in_use: whether use_all_atoms() has turned all-atom mode on
+ */
+int
+all_atoms_in_use(void)
+{
+        return g_all_atoms;
+}
+
+/**
+ * heavy_atom: whether an atom is anything but hydrogen
+ *
+ * @element: element symbol, possibly padded with spaces, or NULL
+ * @elen:    length of @element
+ * @name:    atom name, possibly padded with spaces
+ * @nlen:    length of @name
+ *
+ * The element symbol decides if there is one; otherwise the atom is taken
+ * to be hydrogen (or deuterium) if its name starts with H or D, after any
+ * leading digits.
+ */
+int
+heavy_atom(const char *element, size_t elen, const char *name, size_t nlen)
+{
+        size_t k;
+
+        if(element == NULL) elen = 0;
+        for(; elen > 0 && *element == ' '; element++, elen--)
+                ;
+        for(; elen > 0 && element[elen - 1] == ' '; elen--)
+                ;
+        if(elen > 0)
+                return elen != 1 || (toupper((unsigned char) *element) != 'H'
+                                && toupper((unsigned char) *element) != 'D');
+        for(k = 0; k < nlen && (name[k] == ' '
+                                || isdigit((unsigned char) name[k])); k++)
+                ;
+        return k == nlen || (name[k] != 'H' && name[k] != 'D');
+}
+
+/**
+ * add_atom: append an atom to a list
+ *
+ * Returns 0 on success, -1 if memory can't be allocated.
+ */
+int
+add_atom(struct atom_list *l, int res, double x, double y, double z)
+{
+        struct atom_rec *tmp;
+        int cap;
+
+        if(l->n == l->cap){
+                cap = l->cap > 0 ? 2 * l->cap : 64;
+                tmp = realloc(l->recs, cap * sizeof(*tmp));
+                if(tmp == NULL) return -1;
+                l->recs = tmp;
+                l->cap = cap;
+        }
+        l->recs[l->n].res = res;
+        l->recs[l->n].x = x;
+        l->recs[l->n].y = y;
+        l->recs[l->n].z = z;
+        l->n++;
+        return 0;
+}
+
+/**
+ * alloc_atoms: allocate a struct atoms for @nres residues and @natoms atoms
+ *
+ * Coordinates and spheres are aligned and padded as in struct coords, and
+ * start out as zero. The cutoff starts out infinite, so every pair is
+ * measured until set_atom_cutoff() says otherwise.
+ *
+ * Returns NULL if memory can't be allocated.
+ */
+static struct atoms *
+alloc_atoms(int nres, int natoms)
+{
+        struct atoms *at;
+        size_t astride = COORDS_STRIDE(natoms), rstride = COORDS_STRIDE(nres);
+        void *ablock = NULL, *rblock = NULL;
+
+        at = calloc(1, sizeof(*at));
+        if(at == NULL) return NULL;
+        at->first = calloc(nres + 1, sizeof(*at->first));
+        if(at->first == NULL
+                        || posix_memalign(&ablock, COORDS_ALIGN,
+                                3 * astride * sizeof(double) + 1)
+                        || posix_memalign(&rblock, COORDS_ALIGN,
+                                4 * rstride * sizeof(double) + 1)){
+                free(ablock);
+                free(at->first);
+                free(at);
+                return NULL;
+        }
+        memset(ablock, 0, 3 * astride * sizeof(double));
+        memset(rblock, 0, 4 * rstride * sizeof(double));
+        at->x = ablock;
+        at->y = at->x + astride;
+        at->z = at->y + astride;
+        at->cx = rblock;
+        at->cy = at->cx + rstride;
+        at->cz = at->cy + rstride;
+        at->radius = at->cz + rstride;
+        at->nres = nres;
+        at->natoms = natoms;
+        at->cutoff = INFINITY;
+        return at;
+}
+
+/**
+ * bound_residues: compute the bounding sphere of every residue
+ *
+ * The centre is the centroid of the residue's atoms and the radius the
+ * distance to the farthest of them, padded by a hair so that rounding
+ * can't leave an atom outside.
+ */
+static void
+bound_residues(struct atoms *at)
+{
+        double cx, cy, cz, dx, dy, dz, d2, r2;
+        int i, k, n;
+
+        for(i = 0; i < at->nres; i++){
+                n = at->first[i + 1] - at->first[i];
+                if(n == 0) continue;
+                cx = cy = cz = 0;
+                for(k = at->first[i]; k < at->first[i + 1]; k++){
+                        cx += at->x[k];
+                        cy += at->y[k];
+                        cz += at->z[k];
+                }
+                cx /= n;
+                cy /= n;
+                cz /= n;
+                r2 = 0;
+                for(k = at->first[i]; k < at->first[i + 1]; k++){
+                        dx = at->x[k] - cx;
+                        dy = at->y[k] - cy;
+                        dz = at->z[k] - cz;
+                        d2 = dx * dx + dy * dy + dz * dz;
+                        if(d2 > r2) r2 = d2;
+                }
+                at->cx[i] = cx;
+                at->cy[i] = cy;
+                at->cz[i] = cz;
+                at->radius[i] = sqrt(r2) * (1 + 1e-12) + 1e-9;
+        }
+}
+
+/**
+ * group_atoms: lay out a list of atoms residue by residue
+ *
+ * @l:    atoms, in any order
+ * @nres: length of the chain
+ *
+ * Atoms keep their order within each residue. Atoms numbered outside
+ * 1 .. @nres are dropped.
+ *
+ * Returns a new struct atoms, to be freed with freeatoms(), or NULL if
+ * memory can't be allocated.
+ */
+struct atoms *
+group_atoms(const struct atom_list *l, int nres)
+{
+        struct atoms *at;
+        int *next;
+        int k, r, n = 0;
+
+        for(k = 0; k < l->n; k++)
+                if(l->recs[k].res >= 1 && l->recs[k].res <= nres) n++;
+        at = alloc_atoms(nres, n);
+        if(at == NULL) return NULL;
+        next = malloc((nres + 1) * sizeof(*next));
+        if(next == NULL){
+                freeatoms(at);
+                return NULL;
+        }
+
+        /* Count atoms per residue, then place each after those before it */
+        for(k = 0; k < l->n; k++){
+                r = l->recs[k].res;
+                if(r >= 1 && r <= nres) at->first[r]++;
+        }
+        for(r = 0; r < nres; r++)
+                at->first[r + 1] += at->first[r];
+        memcpy(next, at->first, (nres + 1) * sizeof(*next));
+        for(k = 0; k < l->n; k++){
+                r = l->recs[k].res;
+                if(r < 1 || r > nres) continue;
+                n = next[r - 1]++;
+                at->x[n] = l->recs[k].x;
+                at->y[n] = l->recs[k].y;
+                at->z[n] = l->recs[k].z;
+        }
+        free(next);
+        bound_residues(at);
+        return at;
+}
+
+/**
+ * join_atoms: combine the atoms of every chain of a chain table
+ *
+ * Chains are placed one after another in table order, as by join_chains().
+ * Every chain must have atoms.
+ *
+ * Returns a new struct atoms, or NULL if memory can't be allocated.
+ */
+struct atoms *
+join_atoms(const struct chain_table *tab)
+{
+        const struct atoms *a;
+        struct atoms *at;
+        int k, i, r = 0, n = 0;
+
+        for(k = 0; k < tab->nchains; k++){
+                r += tab->chains[k]->atoms->nres;
+                n += tab->chains[k]->atoms->natoms;
+        }
+        at = alloc_atoms(r, n);
+        if(at == NULL) return NULL;
+        for(k = 0, r = 0, n = 0; k < tab->nchains; k++){
+                a = tab->chains[k]->atoms;
+                memcpy(at->x + n, a->x, a->natoms * sizeof(*at->x));
+                memcpy(at->y + n, a->y, a->natoms * sizeof(*at->y));
+                memcpy(at->z + n, a->z, a->natoms * sizeof(*at->z));
+                memcpy(at->cx + r, a->cx, a->nres * sizeof(*at->cx));
+                memcpy(at->cy + r, a->cy, a->nres * sizeof(*at->cy));
+                memcpy(at->cz + r, a->cz, a->nres * sizeof(*at->cz));
+                memcpy(at->radius + r, a->radius,
+                                a->nres * sizeof(*at->radius));
+                for(i = 0; i < a->nres; i++)
+                        at->first[r + i] = n + a->first[i];
+                r += a->nres;
+                n += a->natoms;
+                if(a->cutoff < at->cutoff) at->cutoff = a->cutoff;
+        }
+        at->first[r] = n;
+        return at;
+}
+
+/**
+ * set_atom_cutoff: set the distance up to which pairs are measured exactly
+ *
+ * @cs:     coordinates; nothing is done if they have no atoms
+ * @cutoff: see struct atoms
+ */
+void
+set_atom_cutoff(struct coords *cs, double cutoff)
+{
+        if(cs->atoms != NULL) cs->atoms->cutoff = cutoff;
+}
+
+/**
+ * min_dist2: shortest squared distance between the atoms of two residues
+ *
+ * The residue with more atoms goes through the vector registers.
+ */
+static double
+min_dist2(const struct atoms *at, int i, int j)
+{
+        int t;
+
+        if(at->first[i + 1] - at->first[i] > at->first[j + 1] - at->first[j]){
+                t = i;
+                i = j;
+                j = t;
+        }
+        return dist_min2(at->x + at->first[i], at->y + at->first[i],
+                        at->z + at->first[i], at->first[i + 1] - at->first[i],
+                        at->x + at->first[j], at->y + at->first[j],
+                        at->z + at->first[j], at->first[j + 1] - at->first[j]);
+}
+
+/**
+ * atom_dist_row: compute a run of all-atom distances from one residue to
+ *                many
+ *
+ * @at:      atoms
+ * @i:       index of the reference residue
+ * @start:   index of the first residue to measure to
+ * @n:       number of residues to measure to
+ * @out:     array of at least @n doubles to receive the distances
+ * @squared: if non-zero, store squared distances
+ *
+ * The distances between sphere centres are computed for the whole run by
+ * the vector kernel first. Pairs whose spheres are more than at->cutoff
+ * apart get the gap between them; the rest get the shortest distance
+ * between their atoms. Pairs where either residue has no atoms get
+ * DIST_MISSING, as in dist_row(). The result is the same for (i, j) as
+ * for (j, i).
+ */
+void
+atom_dist_row(const struct atoms *at, int i, int start, int n, double *out,
+                int squared)
+{
+        double missing = squared ? DIST_MISSING * DIST_MISSING : DIST_MISSING;
+        double gap, d2;
+        int j, k;
+
+        if(n <= 0) return;
+        if(at->first[i] == at->first[i + 1]){
+                for(k = 0; k < n; k++)
+                        out[k] = missing;
+                return;
+        }
+        dist_points(at->cx[i], at->cy[i], at->cz[i], at->cx + start,
+                        at->cy + start, at->cz + start, n, out, 0);
+        for(k = 0, j = start; k < n; k++, j++){
+                if(at->first[j] == at->first[j + 1]){
+                        out[k] = missing;
+                        continue;
+                }
+                gap = out[k] - (at->radius[i] + at->radius[j]);
+                if(gap > at->cutoff){
+                        out[k] = squared ? gap * gap : gap;
+                        continue;
+                }
+                d2 = min_dist2(at, i, j);
+                out[k] = squared ? d2 : sqrt(d2);
+        }
+}
+
+/**
+ * freeatoms: free a struct atoms
+ */
+void
+freeatoms(struct atoms *at)
+{
+        if(at == NULL) return;
+        /* x, y and z share one allocation, as do the spheres */
+        free(at->x);
+        free(at->cx);
+        free(at->first);
+        free(at);
+}
@@ -0,0 +1,83 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#ifndef CMAP_ATOMS_H_
+#define CMAP_ATOMS_H_
+
+#include "pdb.h"
+
+/*
+ * When the viewer's threshold passes the cutoff of an all-atom chain, the
+ * cutoff is raised to this far beyond the threshold, so that the next few
+ * steps don't each need the distance matrix recomputed.
+ */
+#define ATOM_CUTOFF_SLACK 4.
+
+/*
+ * Heavy atoms of one chain, grouped by residue: the atoms of residue i are
+ * x[k], y[k], z[k] for first[i] <= k < first[i+1], in file order. Each
+ * residue also has a bounding sphere, centred on its atoms' centroid.
+ *
+ * Pairs of residues whose spheres are more than @cutoff apart aren't
+ * measured atom by atom; the gap between their spheres stands in for their
+ * distance. It is a lower bound, and itself more than @cutoff, so any
+ * comparison d <= t or d < t with t no more than @cutoff comes out as it
+ * would with the exact distance.
+ */
+struct atoms{
+        double *x;
+        double *y;
+        double *z;
+        int *first;
+        double *cx;
+        double *cy;
+        double *cz;
+        double *radius;
+        int nres;
+        int natoms;
+        double cutoff;
+};
+
+/* One atom as read from a file, by residue number from 1 */
+struct atom_rec{
+        int res;
+        double x, y, z;
+};
+
+/* Atoms of one chain collected while parsing, before being grouped */
+struct atom_list{
+        struct atom_rec *recs;
+        int n;
+        int cap;
+};
+
+int add_atom(struct atom_list *l, int res, double x, double y, double z);
+int all_atoms_in_use(void);
+void atom_dist_row(const struct atoms *at, int i, int start, int n,
+                double *out, int squared);
+void freeatoms(struct atoms *at);
+struct atoms * group_atoms(const struct atom_list *l, int nres);
+int heavy_atom(const char *element, size_t elen, const char *name,
+                size_t nlen);
+struct atoms * join_atoms(const struct chain_table *tab);
+void set_atom_cutoff(struct coords *cs, double cutoff);
+void use_all_atoms(int on);
+
+#endif // CMAP_ATOMS_H_
@@ -0,0 +1,434 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#include<ctype.h>
+#include<dirent.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sys/stat.h>
+
+#include"atoms.h"
+#include"batch.h"
+#include"contacts.h"
+#include"distance.h"
+#include"output.h"
+#include"pdb.h"
+#include"threads.h"
+
+/* A growable list of input file names */
+struct file_list{
+        char **names;
+        size_t n;
+        size_t cap;
+};
+
+/* The output name stem of one input, for finding clashes */
+struct stem{
+        const char *base;
+        size_t len;
+        size_t index;
+};
+
+/* Work shared by the threads of one batch run */
+struct batch_job{
+        const struct batch_options *opts;
+        char **files;
+        int *failed;
+};
+
+/**
+ * add_file: append a copy of a file name to a list
+ *
+ * Returns 0 on success, -1 if memory can't be allocated.
+ */
+static int
+add_file(struct file_list *fl, const char *name)
+{
+        char **tmp;
+
+        if(fl->n == fl->cap){
+                tmp = realloc(fl->names, (2 * fl->cap + 16) * sizeof(*tmp));
+                if(tmp == NULL) return -1;
+                fl->names = tmp;
+                fl->cap = 2 * fl->cap + 16;
+        }
+        fl->names[fl->n] = strdup(name);
+        if(fl->names[fl->n] == NULL) return -1;
+        fl->n++;
+        return 0;
+}
+
+/**
+ * collect_files: add a file, or every file below a directory, to a list
+ *
+ * @fl:   list to add to
+ * @path: file or directory name
+ *
+ * Directories are searched recursively, skipping hidden entries. Paths
+ * that can't be examined are added anyway, so that they are reported as
+ * failures along with the files that can't be read.
+ *
+ * Returns 0 on success, -1 if memory can't be allocated.
+ */
+static int
+collect_files(struct file_list *fl, const char *path)
+{
+        struct stat st;
+        struct dirent *de;
+        DIR *dir;
+        char *sub;
+        size_t len;
+        int ret = 0;
+
+        if(stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+                return add_file(fl, path);
+        dir = opendir(path);
+        if(dir == NULL)
+                return add_file(fl, path);
+        while(ret == 0 && (de = readdir(dir)) != NULL){
+                if(de->d_name[0] == '.') continue;
+                len = strlen(path) + strlen(de->d_name) + 2;
+                sub = malloc(len);
+                if(sub == NULL){
+                        ret = -1;
+                        break;
+                }
+                snprintf(sub, len, "%s/%s", path, de->d_name);
+                ret = collect_files(fl, sub);
+                free(sub);
+        }
+        closedir(dir);
+        return ret;
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+        return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/**
+ * output_stem: the part of an input file name its outputs are named after
+ *
+ * @input: input file name
+ * @len:   set to the length of the stem
+ *
+ * That is the last component of @input, up to its first dot.
+ *
+ * Returns a pointer to the start of the stem within @input.
+ */
+static const char *
+output_stem(const char *input, size_t *len)
+{
+        const char *base, *dot;
+
+        base = strrchr(input, '/');
+        base = base == NULL ? input : base + 1;
+        dot = strchr(base, '.');
+        *len = dot == NULL || dot == base ? strlen(base) : (size_t) (dot - base);
+        return base;
+}
+
+static int
+compare_stems(const void *a, const void *b)
+{
+        const struct stem *x = a, *y = b;
+        size_t n = x->len < y->len ? x->len : y->len;
+        int c = memcmp(x->base, y->base, n);
+
+        if(c != 0) return c;
+        if(x->len != y->len) return x->len < y->len ? -1 : 1;
+        return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/**
+ * find_clashes: fail inputs whose outputs would overwrite another's
+ *
+ * @files:  input file names, in name order
+ * @n:      number of files
+ * @failed: set to 1 for each input that clashes
+ *
+ * Outputs are named after the input's stem alone (see output_stem()), so
+ * "a/x.pdb" and "b/x.cif" would both write "x.txt". Of the inputs sharing
+ * a stem, the first in name order keeps it and the rest are reported as
+ * failures, rather than being written over each other by two threads.
+ *
+ * Returns 0 on success, -1 if memory can't be allocated.
+ */
+static int
+find_clashes(char **files, size_t n, int *failed)
+{
+        struct stem *st;
+        size_t k, first = 0;
+
+        st = malloc((n + 1) * sizeof(*st));
+        if(st == NULL) return -1;
+        for(k = 0; k < n; k++){
+                st[k].base = output_stem(files[k], &st[k].len);
+                st[k].index = k;
+        }
+        qsort(st, n, sizeof(*st), compare_stems);
+        for(k = 1; k < n; k++){
+                if(st[k].len != st[first].len || memcmp(st[k].base,
+                                        st[first].base, st[k].len) != 0){
+                        first = k;
+                        continue;
+                }
+                failed[st[k].index] = 1;
+                fprintf(stderr, "FAILED: %s: output names clash with [%s]\n",
+                                files[st[k].index], files[st[first].index]);
+        }
+        free(st);
+        return 0;
+}
+
+/**
+ * open_batch_output: open the output file for one input in a directory
+ *
+ * @dir:   output directory
+ * @input: input file name
+ * @chain: chain identifier to add to the name, or NULL for none
+ * @ext:   extension of the output file, with the dot
+ * @path:  set to the output file name, to be freed by the caller
+ *
+ * The output is named after the last component of @input, with anything
+ * from its first dot onwards (e.g. ".pdb" or ".ent.gz") replaced by @ext;
+ * see output_stem().
+ * Characters of the chain identifier that aren't letters or digits are
+ * written as "_".
+ *
+ * Returns the open file, or NULL on error.
+ */
+static FILE *
+open_batch_output(const char *dir, const char *input, const char *chain,
+                const char *ext, char **path)
+{
+        const char *base;
+        size_t len, baselen, k, n = 0;
+
+        base = output_stem(input, &baselen);
+        if(chain != NULL)
+                n = strlen(chain) + 1;
+        len = strlen(dir) + baselen + n + strlen(ext) + 2;
+        *path = malloc(len);
+        if(*path == NULL) return NULL;
+        snprintf(*path, len, "%s/%.*s%s%s%s", dir, (int) baselen, base,
+                        chain != NULL ? "_" : "", chain != NULL ? chain : "",
+                        ext);
+        for(k = strlen(dir) + baselen + 2; k < strlen(dir) + baselen + 1 + n; k++)
+                if(!isalnum((unsigned char) (*path)[k])) (*path)[k] = '_';
+        return fopen(*path, "wb");
+}
+
+/**
+ * batch_chain: write every requested output for one chain of an input
+ *
+ * @o:     batch settings
+ * @input: input file name
+ * @cs:    coordinates of the chain
+ * @chain: chain identifier to add to output names, or NULL for none
+ * @path:  set to the name of the output file that failed, if any
+ *
+ * Returns NULL on success, otherwise a description of what went wrong.
+ */
+static const char *
+batch_chain(const struct batch_options *o, const char *input,
+                struct coords *cs, const char *chain, char **path)
+{
+        struct distmat *dm = NULL;
+        struct contacts *ct = NULL;
+        enum dm_precision precision = o->precision;
+        FILE *fp = NULL;
+        const char *err = NULL;
+
+        /* The distance matrix is only needed for EPS output, for
+         * thresholds too long for find_contacts(), or for all-atom
+         * contacts, which find_contacts() doesn't measure */
+        set_atom_cutoff(cs, o->threshold);
+        if(o->eps_dir != NULL || o->threshold > DIST_MISSING
+                        || cs->atoms != NULL){
+                precision = dm_auto_precision(precision, o->auto_precision,
+                                cs->nres, o->threshold);
+                dm = calculate_distmat(*cs, precision, 1);
+                if(dm == NULL) goto bc_nomem;
+        }
+        if(o->contacts_dir != NULL || o->binary_dir != NULL){
+                if(o->threshold > DIST_MISSING || cs->atoms != NULL)
+                        ct = distmat_contacts(*dm, o->threshold);
+                else
+                        ct = find_contacts(*cs, o->threshold);
+                if(ct == NULL) goto bc_nomem;
+        }
+
+        if(o->contacts_dir != NULL){
+                fp = open_batch_output(o->contacts_dir, input, chain, ".txt", path);
+                if(fp == NULL) goto bc_noopen;
+                if(write_contact_list(fp, *ct, 1) != 0) goto bc_nomem;
+                fclose(fp);
+                fp = NULL;
+                free(*path);
+                *path = NULL;
+        }
+        if(o->binary_dir != NULL){
+                fp = open_batch_output(o->binary_dir, input, chain, ".bin", path);
+                if(fp == NULL) goto bc_noopen;
+                if(write_contacts_binary(fp, *ct) != 0) goto bc_nomem;
+                fclose(fp);
+                fp = NULL;
+                free(*path);
+                *path = NULL;
+        }
+        if(o->raster_dir != NULL){
+                fp = open_batch_output(o->raster_dir, input, chain, ".pgm", path);
+                if(fp == NULL) goto bc_noopen;
+                if(write_pgm(fp, *cs, o->threshold, o->raster_scale,
+                                        o->raster_distances, 1) != 0)
+                        goto bc_nomem;
+                fclose(fp);
+                fp = NULL;
+                free(*path);
+                *path = NULL;
+        }
+        if(o->eps_dir != NULL){
+                fp = open_batch_output(o->eps_dir, input, chain, ".eps", path);
+                if(fp == NULL) goto bc_noopen;
+                if(write_eps(fp, *dm, o->threshold) != 0) goto bc_nomem;
+                fclose(fp);
+                fp = NULL;
+                free(*path);
+                *path = NULL;
+        }
+        goto bc_cleanup;
+
+        bc_noopen:
+        err = "couldn't open output file";
+        goto bc_cleanup;
+        bc_nomem:
+        err = "couldn't allocate memory";
+        bc_cleanup:
+        if(fp != NULL) fclose(fp);
+        if(ct != NULL) freecontacts(ct);
+        if(dm != NULL) freedm(dm);
+        return err;
+}
+
+/**
+ * batch_file: write every requested output for one input file
+ *
+ * Runs single-threaded, since the batch itself is spread over the threads.
+ * A failure is reported on stderr as one line, and marked in job->failed.
+ */
+static void
+batch_file(void *arg, size_t k)
+{
+        struct batch_job *job = arg;
+        const struct batch_options *o = job->opts;
+        char *input = job->files[k];
+        struct chain_table *tab = NULL;
+        struct coords *cs = NULL;
+        char *path = NULL;
+        const char *err = NULL;
+        int c;
+
+        /* Already reported by find_clashes() */
+        if(job->failed[k]) return;
+        if(o->all_chains){
+                tab = getchains(input);
+                if(tab == NULL)
+                        err = "couldn't read coordinates";
+                for(c = 0; err == NULL && c < tab->nchains; c++)
+                        err = batch_chain(o, input, tab->chains[c],
+                                        tab->chains[c]->chain_name, &path);
+                freechains(tab);
+        }
+        else {
+                cs = getcoords(input, o->chain);
+                if(cs == NULL)
+                        err = "couldn't read coordinates";
+                else
+                        err = batch_chain(o, input, cs, NULL, &path);
+                freecoords(cs);
+        }
+        if(err == NULL) return;
+
+        job->failed[k] = 1;
+        if(path != NULL)
+                fprintf(stderr, "FAILED: %s: %s [%s]\n", input, err, path);
+        else
+                fprintf(stderr, "FAILED: %s: %s\n", input, err);
+        free(path);
+}
+
+/**
+ * run_batch: write outputs for many input files on a pool of threads
+ *
+ * @opts:     what to write, and how
+ * @paths:    input files, or directories to search for input files
+ * @npaths:   number of entries in @paths
+ * @nthreads: number of files to process at once
+ *
+ * Files are processed in name order, one per thread at a time. Files that
+ * can't be read or written, or whose outputs would have the same names as
+ * an earlier file's, are reported on stderr and skipped; the rest of the
+ * batch carries on. A summary is printed when all are done.
+ *
+ * Returns the number of files that failed, or -1 if the batch can't be
+ * set up.
+ */
+int
+run_batch(struct batch_options opts, char **paths, int npaths, int nthreads)
+{
+        struct file_list fl = {NULL, 0, 0};
+        struct batch_job job;
+        size_t k, nfailed = 0;
+        int i, ret = -1;
+
+        job.failed = NULL;
+        for(i = 0; i < npaths; i++)
+                if(collect_files(&fl, paths[i]) != 0)
+                        goto rb_cleanup;
+        qsort(fl.names, fl.n, sizeof(*fl.names), compare_names);
+
+        /* Select the distance kernel once, before the threads need it */
+        dist_kernel_name();
+
+        job.opts = &opts;
+        job.files = fl.names;
+        job.failed = calloc(fl.n + 1, sizeof(*job.failed));
+        if(job.failed == NULL) goto rb_cleanup;
+        if(find_clashes(fl.names, fl.n, job.failed) != 0)
+                goto rb_cleanup;
+        if(run_chunks(nthreads, fl.n, batch_file, &job) != 0)
+                goto rb_cleanup;
+
+        for(k = 0; k < fl.n; k++)
+                nfailed += job.failed[k];
+        printf("Processed %zu files: %zu succeeded, %zu failed.\n", fl.n,
+                        fl.n - nfailed, nfailed);
+        ret = nfailed;
+
+        rb_cleanup:
+        for(k = 0; k < fl.n; k++)
+                free(fl.names[k]);
+        free(fl.names);
+        free(job.failed);
+        return ret;
+}
@@ -0,0 +1,50 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#ifndef CMAP_BATCH_H_
+#define CMAP_BATCH_H_
+
+#include "pdb.h"
+
+/*
+ * Settings shared by every file of a batch run. Each non-NULL directory
+ * receives one output file per input, named after the input file with its
+ * extension replaced: .txt (contact list), .bin (binary contact list),
+ * .eps or .pgm. With @all_chains, every chain of each input is written,
+ * with "_" and the chain identifier added to the name.
+ */
+struct batch_options{
+        char *contacts_dir;
+        char *binary_dir;
+        char *eps_dir;
+        char *raster_dir;
+        double threshold;
+        enum dm_precision precision;
+        int auto_precision;
+        int raster_scale;
+        int raster_distances;
+        int all_chains;
+        const char *chain;
+};
+
+int run_batch(struct batch_options opts, char **paths, int npaths,
+                int nthreads);
+
+#endif // CMAP_BATCH_H_
@@ -0,0 +1,434 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#include<fcntl.h>
+#include<limits.h>
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<time.h>
+#include<unistd.h>
+
+#include"cache.h"
+#include"pdb.h"
+
+/*
+ * A cache file holds the chain table parsed from one input file, laid out
+ * so it can be mapped and copied from directly. Every section starts on an
+ * 8-byte boundary, and numbers are in the byte order of the machine that
+ * wrote it; a cache from a machine of the other order is simply rebuilt.
+ *
+ *   struct cache_header
+ *   real path of the input file           path_len bytes
+ *   for each chain:
+ *     struct cache_chain
+ *     chain identifier                    name_len bytes
+ *     sequence                            nres bytes
+ *     presence bitmask                    (nres + 7) / 8 bytes
+ *     x, y and z coordinates              3 * nres doubles
+ */
+#define CACHE_MAGIC "CMAPCCH\n"
+#define CACHE_VERSION 1
+#define CACHE_ORDER 0x01020304
+#define CACHE_SUFFIX ".cmapcache"
+#define PAD8(n) (((n) + 7) & ~(size_t) 7)
+
+struct cache_header{
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint64_t file_size;
+        uint64_t source_size;
+        int64_t source_mtime;
+        int64_t written;
+        uint64_t source_hash;
+        uint64_t source_bytes;
+        uint32_t nchains;
+        uint32_t path_len;
+};
+
+struct cache_chain{
+        uint32_t nres;
+        uint32_t name_len;
+};
+
+static int g_cache = 0;
+
+/**
+ * use_cache: turn the coordinate cache on or off
+ *
+ * While it is on, getchains() and getcoords() look for a cache file next
+ * to each input (FILE.cmapcache), read from it if it is still valid, and
+ * write a new one if not.
+ */
+void
+use_cache(int on)
+{
+        g_cache = on;
+}
+
+/**
+ * cache_in_use: whether use_cache() has turned the cache on
+ */
+int
+cache_in_use(void)
+{
+        return g_cache;
+}
+
+/**
+ * cache_path: name of the cache file for an input file
+ *
+ * Returns a newly allocated string, or NULL if memory can't be allocated.
+ */
+static char *
+cache_path(const char *filename)
+{
+        size_t len = strlen(filename) + strlen(CACHE_SUFFIX) + 1;
+        char *path = malloc(len);
+
+        if(path != NULL)
+                snprintf(path, len, "%s%s", filename, CACHE_SUFFIX);
+        return path;
+}
+
+#define HASH_MIX(h, w) ((h) = ((h) ^ (w)) * 0xff51afd7ed558ccdULL, \
+                (h) ^= (h) >> 29)
+
+/**
+ * hash_bytes: 64-bit hash of a block of memory
+ *
+ * Mixes in 32 bytes at a time, as four independent lanes so the multiplies
+ * overlap; not cryptographic, just enough to tell whether a file's
+ * contents have changed.
+ */
+static uint64_t
+hash_bytes(const unsigned char *p, size_t n)
+{
+        uint64_t h = 0x9e3779b97f4a7c15ULL ^ n, w[4];
+        uint64_t l[4] = {h, h + 1, h + 2, h + 3};
+        size_t k;
+        int j;
+
+        for(k = 0; k + 32 <= n; k += 32){
+                memcpy(w, p + k, 32);
+                for(j = 0; j < 4; j++)
+                        HASH_MIX(l[j], w[j]);
+        }
+        for(j = 0; j < 4; j++)
+                HASH_MIX(h, l[j]);
+        for(; k + 8 <= n; k += 8){
+                memcpy(w, p + k, 8);
+                HASH_MIX(h, w[0]);
+        }
+        for(; k < n; k++)
+                h = (h ^ p[k]) * 0x100000001b3ULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+}
+
+/**
+ * hash_file: hash the contents of a regular file, as stored on disk
+ *
+ * @filename: path to the file
+ * @size:     size of the file, as found by stat()
+ * @hash:     set to the hash
+ *
+ * Returns 0 on success, or -1 if the file can't be read or has changed
+ * size.
+ */
+static int
+hash_file(const char *filename, size_t size, uint64_t *hash)
+{
+        struct stat st;
+        void *map;
+        int fd;
+
+        fd = open(filename, O_RDONLY);
+        if(fd < 0) return -1;
+        if(fstat(fd, &st) != 0 || (size_t) st.st_size != size){
+                close(fd);
+                return -1;
+        }
+        if(size == 0){
+                close(fd);
+                *hash = hash_bytes(NULL, 0);
+                return 0;
+        }
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(map == MAP_FAILED) return -1;
+#ifdef MADV_SEQUENTIAL
+        madvise(map, size, MADV_SEQUENTIAL);
+#endif
+        *hash = hash_bytes(map, size);
+        munmap(map, size);
+        return 0;
+}
+
+/**
+ * read_chains: rebuild a chain table from the chain records of a cache
+ *
+ * @p:        first chain record
+ * @end:      end of the cache file
+ * @nchains:  number of chain records
+ * @filename: input file name, recorded in each chain
+ * @bytes:    size of the input, recorded in each chain
+ *
+ * Returns the table, or NULL if the records don't exactly fill the space
+ * up to @end or memory can't be allocated.
+ */
+static struct chain_table *
+read_chains(const char *p, const char *end, uint32_t nchains, char *filename,
+                uint64_t bytes)
+{
+        struct chain_table *tab;
+        struct cache_chain cc;
+        struct coords *cs;
+        char *name = NULL;
+        size_t need;
+        uint32_t k;
+
+        tab = calloc(1, sizeof(*tab));
+        if(tab == NULL) return NULL;
+        tab->source_bytes = bytes;
+        for(k = 0; k < nchains; k++){
+                if((size_t) (end - p) < sizeof(cc)) goto rc_error_cleanup;
+                memcpy(&cc, p, sizeof(cc));
+                p += sizeof(cc);
+                if(cc.nres > INT_MAX / 8 || cc.name_len == 0) goto rc_error_cleanup;
+                need = PAD8((size_t) cc.name_len) + PAD8((size_t) cc.nres)
+                        + PAD8(((size_t) cc.nres + 7) / 8)
+                        + 3 * (size_t) cc.nres * sizeof(double);
+                if((size_t) (end - p) < need) goto rc_error_cleanup;
+                name = malloc(cc.name_len + 1);
+                if(name == NULL) goto rc_error_cleanup;
+                memcpy(name, p, cc.name_len);
+                name[cc.name_len] = '\0';
+                p += PAD8((size_t) cc.name_len);
+                cs = new_chain(tab, filename, name, cc.nres, bytes);
+                free(name);
+                name = NULL;
+                if(cs == NULL) goto rc_error_cleanup;
+                if(cc.nres == 0) continue;
+                memcpy(cs->sequence, p, cc.nres);
+                p += PAD8((size_t) cc.nres);
+                memcpy(cs->present, p, ((size_t) cc.nres + 7) / 8);
+                p += PAD8(((size_t) cc.nres + 7) / 8);
+                memcpy(cs->x, p, cc.nres * sizeof(double));
+                p += cc.nres * sizeof(double);
+                memcpy(cs->y, p, cc.nres * sizeof(double));
+                p += cc.nres * sizeof(double);
+                memcpy(cs->z, p, cc.nres * sizeof(double));
+                p += cc.nres * sizeof(double);
+        }
+        if(p != end) goto rc_error_cleanup;
+        return tab;
+
+        rc_error_cleanup:
+        freechains(tab);
+        return NULL;
+}
+
+/**
+ * read_cache: read the chains of a file from its cache
+ *
+ * @filename: path to the input file
+ *
+ * The cache is valid if it was written for the same file (by real path),
+ * and the file still has the same size and contents. When its size and
+ * modification time are unchanged the contents are taken to be too,
+ * unless it was modified around the time the cache was written, so the
+ * file itself usually needn't be read at all. Otherwise it is hashed;
+ * if the contents turn out to be unchanged, the cache is kept and written
+ * again with the new time.
+ *
+ * Returns the chain table, or NULL if the cache is off, missing, stale or
+ * damaged.
+ */
+struct chain_table *
+read_cache(char *filename)
+{
+        struct chain_table *tab = NULL;
+        struct cache_header h;
+        struct stat st, cst;
+        char *path = NULL, *real = NULL;
+        const char *data = MAP_FAILED;
+        uint64_t hash;
+        int fd, rehash;
+
+        if(!g_cache || strcmp(filename, "-") == 0) return NULL;
+        if(stat(filename, &st) != 0 || !S_ISREG(st.st_mode)) return NULL;
+        path = cache_path(filename);
+        real = realpath(filename, NULL);
+        if(path == NULL || real == NULL) goto rd_cleanup;
+
+        fd = open(path, O_RDONLY);
+        if(fd < 0) goto rd_cleanup;
+        if(fstat(fd, &cst) != 0 || (size_t) cst.st_size < sizeof(h)){
+                close(fd);
+                goto rd_cleanup;
+        }
+        data = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(data == MAP_FAILED) goto rd_cleanup;
+
+        memcpy(&h, data, sizeof(h));
+        if(memcmp(h.magic, CACHE_MAGIC, 8) != 0 || h.version != CACHE_VERSION
+                        || h.byte_order != CACHE_ORDER
+                        || h.file_size != (uint64_t) cst.st_size
+                        || PAD8((size_t) h.path_len) > cst.st_size - sizeof(h)
+                        || h.path_len != strlen(real)
+                        || memcmp(data + sizeof(h), real, h.path_len) != 0
+                        || h.source_size != (uint64_t) st.st_size)
+                goto rd_cleanup;
+        rehash = h.source_mtime != (int64_t) st.st_mtime
+                || h.source_mtime + 2 >= h.written;
+        if(rehash && (hash_file(filename, st.st_size, &hash) != 0
+                                || hash != h.source_hash))
+                goto rd_cleanup;
+
+        tab = read_chains(data + sizeof(h) + PAD8((size_t) h.path_len),
+                        data + cst.st_size, h.nchains, filename,
+                        h.source_bytes);
+        if(tab != NULL && tab->nchains == 0){
+                freechains(tab);
+                tab = NULL;
+        }
+        if(tab != NULL && rehash)
+                write_cache(filename, tab);
+
+        rd_cleanup:
+        if(data != MAP_FAILED) munmap((void *) data, cst.st_size);
+        free(real);
+        free(path);
+        return tab;
+}
+
+/**
+ * write_cache: save the chains read from a file to its cache
+ *
+ * @filename: path to the input file
+ * @tab:      chains read from it
+ *
+ * The cache is written to a temporary file and renamed into place, so a
+ * reader never sees half of one. Nothing is written for standard input,
+ * if the cache is off, or if the file was modified in the last few
+ * seconds and so may still be changing under the parser.
+ *
+ * Returns 0 on success, -1 if the cache couldn't be written (e.g. the
+ * input's directory is read-only).
+ */
+int
+write_cache(char *filename, const struct chain_table *tab)
+{
+        struct cache_header h;
+        struct cache_chain cc;
+        struct coords *cs;
+        struct stat st;
+        char *path = NULL, *tmp = NULL, *real = NULL, *buf = NULL, *p;
+        size_t size, len;
+        uint64_t hash;
+        ssize_t got;
+        int k, fd, ret = -1;
+
+        if(!g_cache || strcmp(filename, "-") == 0) return -1;
+        if(stat(filename, &st) != 0 || !S_ISREG(st.st_mode)) return -1;
+        if(st.st_mtime + 2 >= time(NULL)) return -1;
+        if(hash_file(filename, st.st_size, &hash) != 0) return -1;
+        path = cache_path(filename);
+        real = realpath(filename, NULL);
+        if(path == NULL || real == NULL) goto wc_cleanup;
+
+        size = sizeof(h) + PAD8(strlen(real));
+        for(k = 0; k < tab->nchains; k++){
+                cs = tab->chains[k];
+                size += sizeof(cc) + PAD8(strlen(cs->chain_name))
+                        + PAD8((size_t) cs->nres)
+                        + PAD8(((size_t) cs->nres + 7) / 8)
+                        + 3 * (size_t) cs->nres * sizeof(double);
+        }
+        buf = calloc(size, 1);
+        if(buf == NULL) goto wc_cleanup;
+
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, CACHE_MAGIC, 8);
+        h.version = CACHE_VERSION;
+        h.byte_order = CACHE_ORDER;
+        h.file_size = size;
+        h.source_size = st.st_size;
+        h.source_mtime = st.st_mtime;
+        h.written = time(NULL);
+        h.source_hash = hash;
+        h.source_bytes = tab->source_bytes;
+        h.nchains = tab->nchains;
+        h.path_len = strlen(real);
+        memcpy(buf, &h, sizeof(h));
+        memcpy(buf + sizeof(h), real, h.path_len);
+        p = buf + sizeof(h) + PAD8((size_t) h.path_len);
+        for(k = 0; k < tab->nchains; k++){
+                cs = tab->chains[k];
+                cc.nres = cs->nres;
+                cc.name_len = strlen(cs->chain_name);
+                memcpy(p, &cc, sizeof(cc));
+                p += sizeof(cc);
+                memcpy(p, cs->chain_name, cc.name_len);
+                p += PAD8((size_t) cc.name_len);
+                if(cs->nres == 0) continue;
+                memcpy(p, cs->sequence, cs->nres);
+                p += PAD8((size_t) cs->nres);
+                memcpy(p, cs->present, ((size_t) cs->nres + 7) / 8);
+                p += PAD8(((size_t) cs->nres + 7) / 8);
+                memcpy(p, cs->x, cs->nres * sizeof(double));
+                p += cs->nres * sizeof(double);
+                memcpy(p, cs->y, cs->nres * sizeof(double));
+                p += cs->nres * sizeof(double);
+                memcpy(p, cs->z, cs->nres * sizeof(double));
+                p += cs->nres * sizeof(double);
+        }
+
+        len = strlen(path) + 32;
+        tmp = malloc(len);
+        if(tmp == NULL) goto wc_cleanup;
+        snprintf(tmp, len, "%s.%ld.tmp", path, (long) getpid());
+        fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if(fd < 0) goto wc_cleanup;
+        for(p = buf; p < buf + size; p += got){
+                got = write(fd, p, buf + size - p);
+                if(got <= 0) break;
+        }
+        if(close(fd) != 0 || p < buf + size || rename(tmp, path) != 0){
+                unlink(tmp);
+                goto wc_cleanup;
+        }
+        ret = 0;
+
+        wc_cleanup:
+        free(buf);
+        free(tmp);
+        free(real);
+        free(path);
+        return ret;
+}
@@ -0,0 +1,31 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#ifndef CMAP_CACHE_H_
+#define CMAP_CACHE_H_
+
+#include "pdb.h"
+
+int cache_in_use(void);
+struct chain_table * read_cache(char *filename);
+void use_cache(int on);
+int write_cache(char *filename, const struct chain_table *tab);
+
+#endif // CMAP_CACHE_H_
@@ -0,0 +1,290 @@
+/*
+ *  Copyright 2018 Gearoid Fox
+ *
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Checks, for `make check`, that the in-place column decoders give exactly
+ * what the code they replaced did: fixed_atof() and fixed_atoi() against
+ * atof() and atoi() on the field copied out, and the one_letter_code()
+ * table against the old chain of strncmp() calls.
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include"pdb.h"
+
+#define COL 30          /* x coordinate column of an ATOM record */
+#define WIDTH 8
+#define MAX_REPORTS 10
+
+static long g_checked = 0;
+static long g_failed = 0;
+
+/**
+ * report: count a failed check, printing the first few
+ */
+static void
+report(const char *what, const char *field, size_t n, const char *got,
+                const char *want)
+{
+        g_failed++;
+        if(g_failed <= MAX_REPORTS)
+                fprintf(stderr, "%s: [%.*s] gave %s, expected %s\n",
+                                what, (int) n, field, got, want);
+}
+
+/**
+ * check_atof: compare fixed_atof() with atof() on one field
+ *
+ * @field: the field, not null-terminated
+ * @n:     length of @field, at most WIDTH
+ * @len:   length of the record the field is placed in; if less than
+ *         COL + WIDTH, the field is cut short as at the end of a line
+ */
+static void
+check_atof(const char *field, size_t n, size_t len)
+{
+        char line[COL + WIDTH + 1], copy[WIDTH + 1], got[32], want[32];
+        size_t m;
+        double a, b;
+
+        memset(line, ' ', sizeof(line));
+        memcpy(line + COL, field, n);
+        m = len > COL ? len - COL : 0;
+        if(m > WIDTH) m = WIDTH;
+        memcpy(copy, line + COL, m);
+        copy[m] = '\0';
+
+        a = fixed_atof(line, len, COL, WIDTH);
+        b = atof(copy);
+        g_checked++;
+        /* Bitwise, so that -0.0 and 0.0 count as different */
+        if(memcmp(&a, &b, sizeof(a)) != 0){
+                snprintf(got, sizeof(got), "%.17g", a);
+                snprintf(want, sizeof(want), "%.17g", b);
+                report("fixed_atof", line + COL, m, got, want);
+        }
+}
+
+/**
+ * check_atof_padded: check a number justified both ways in a blank field
+ */
+static void
+check_atof_padded(const char *num, size_t n)
+{
+        char field[WIDTH];
+
+        if(n > WIDTH) return;
+        memset(field, ' ', WIDTH);
+        memcpy(field + WIDTH - n, num, n);
+        check_atof(field, WIDTH, COL + WIDTH);
+        memset(field, ' ', WIDTH);
+        memcpy(field, num, n);
+        check_atof(field, WIDTH, COL + WIDTH);
+}
+
+/**
+ * check_coordinates: every value the %8.3f coordinate columns can hold
+ */
+static void
+check_coordinates(void)
+{
+        char field[16];
+        long v;
+
+        for(v = -999999; v <= 9999999; v++){
+                snprintf(field, sizeof(field), "%8.3f", v / 1000.);
+                check_atof(field, WIDTH, COL + WIDTH);
+        }
+}
+
+/**
+ * check_layouts: numbers of up to five digits, with the decimal point in
+ *                every position, every sign, with and without a leading
+ *                zero, justified either way
+ */
+static void
+check_layouts(void)
+{
+        static const char *signs[] = {"", "-", "+"};
+        static const long pow10[] = {1, 10, 100, 1000, 10000, 100000};
+        char num[16];
+        int f, s, n;
+        long m;
+
+        for(f = 0; f <= 5; f++)
+                for(s = 0; s < 3; s++)
+                        for(m = 0; m < 100000; m++){
+                                if(f == 0)
+                                        n = snprintf(num, sizeof(num), "%s%ld",
+                                                        signs[s], m);
+                                else
+                                        n = snprintf(num, sizeof(num),
+                                                        "%s%ld.%0*ld", signs[s],
+                                                        m / pow10[f], f,
+                                                        m % pow10[f]);
+                                check_atof_padded(num, n);
+                                /* ".5" rather than "0.5" */
+                                if(f > 0 && m < pow10[f]){
+                                        n = snprintf(num, sizeof(num),
+                                                        "%s.%0*ld", signs[s],
+                                                        f, m);
+                                        check_atof_padded(num, n);
+                                }
+                                /* "5." */
+                                if(f == 0){
+                                        n = snprintf(num, sizeof(num),
+                                                        "%s%ld.", signs[s], m);
+                                        check_atof_padded(num, n);
+                                }
+                        }
+}
+
+/**
+ * check_odd_fields: fields the fast path must hand over to atof(), and
+ *                   records that end inside the field
+ */
+static void
+check_odd_fields(void)
+{
+        static const char *odd[] = {"", " ", "-", "+", ".", "-.", "+.",
+                "..", "1.2.3", "1e3", "1E-2", "-2.5e1", "12a", "a12", " 1 2",
+                "1 ", "- 1", "--1", "+-1", "0x10", "inf", "-nan", "\t1.5",
+                "1.5\t", "-0", "-0.000", "00000001", "0.000001", "99999999",
+                "-9999999", "1234567.", ".1234567"};
+        char field[16];
+        size_t k, len;
+
+        for(k = 0; k < sizeof(odd) / sizeof(*odd); k++)
+                check_atof_padded(odd[k], strlen(odd[k]));
+        snprintf(field, sizeof(field), "%8.3f", -123.456);
+        for(len = 0; len <= COL + WIDTH; len++)
+                check_atof(field, WIDTH, len);
+        snprintf(field, sizeof(field), "%-8.3f", 12.5);
+        for(len = COL; len <= COL + WIDTH; len++)
+                check_atof(field, WIDTH, len);
+}
+
+/**
+ * check_atoi: compare fixed_atoi() with atoi() on the serial and residue
+ *             number columns, for every value they can hold
+ */
+static void
+check_atoi(void)
+{
+        static const size_t widths[] = {4, 5};
+        char line[16], copy[16], num[16], got[16], want[16];
+        size_t k, w, n;
+        long v;
+        int a, b, right;
+
+        for(k = 0; k < sizeof(widths) / sizeof(*widths); k++){
+                w = widths[k];
+                for(v = -9999; v <= 99999; v++){
+                        n = snprintf(num, sizeof(num), "%ld", v);
+                        if(n > w) continue;
+                        for(right = 0; right <= 1; right++){
+                                memset(line, ' ', w);
+                                memcpy(line + (right ? w - n : 0), num, n);
+                                memcpy(copy, line, w);
+                                copy[w] = '\0';
+                                a = fixed_atoi(line, w, 0, w);
+                                b = atoi(copy);
+                                g_checked++;
+                                if(a != b){
+                                        snprintf(got, sizeof(got), "%d", a);
+                                        snprintf(want, sizeof(want), "%d", b);
+                                        report("fixed_atoi", line, w, got,
+                                                        want);
+                                }
+                        }
+                }
+        }
+}
+
+/**
+ * old_one_letter_code: one_letter_code() as it was before the table
+ */
+static char
+old_one_letter_code(char *three_letter_code)
+{
+        static const struct {
+                const char *tlc;
+                char code;
+        } codes[] = {
+                {"ALA", 'A'}, {"ASX", 'B'}, {"CYS", 'C'}, {"ASP", 'D'},
+                {"GLU", 'E'}, {"PHE", 'F'}, {"GLY", 'G'}, {"HIS", 'H'},
+                {"ILE", 'I'}, {"LYS", 'K'}, {"LEU", 'L'}, {"MET", 'M'},
+                {"ASN", 'N'}, {"PRO", 'P'}, {"GLN", 'Q'}, {"ARG", 'R'},
+                {"SER", 'S'}, {"THR", 'T'}, {"VAL", 'V'}, {"TRP", 'W'},
+                {"XAA", 'X'}, {"TYR", 'Y'}, {"GLX", 'Z'},
+                {"  A", 'A'}, {"  C", 'C'}, {"  G", 'G'}, {"  U", 'U'},
+                {" DA", 'A'}, {" DC", 'C'}, {" DG", 'G'}, {" DT", 'T'},
+        };
+        size_t k;
+
+        if(three_letter_code == NULL) return 'X';
+        for(k = 0; k < sizeof(codes) / sizeof(*codes); k++)
+                if(0 == strncmp(three_letter_code, codes[k].tlc, 3))
+                        return codes[k].code;
+        return 'X';
+}
+
+/**
+ * check_codes: compare one_letter_code() with the old lookup on every
+ *              three-byte code, the 27^3 of ' ' and A-Z included
+ */
+static void
+check_codes(void)
+{
+        char tlc[4] = {0}, got[2] = {0}, want[2] = {0};
+        int a, b, c;
+
+        for(a = 0; a < 256; a++)
+                for(b = 0; b < 256; b++)
+                        for(c = 0; c < 256; c++){
+                                tlc[0] = a;
+                                tlc[1] = b;
+                                tlc[2] = c;
+                                got[0] = one_letter_code(tlc);
+                                want[0] = old_one_letter_code(tlc);
+                                g_checked++;
+                                if(got[0] != want[0])
+                                        report("one_letter_code", tlc, 3, got,
+                                                        want);
+                        }
+        got[0] = one_letter_code(NULL);
+        want[0] = old_one_letter_code(NULL);
+        g_checked++;
+        if(got[0] != want[0]) report("one_letter_code", "(null)", 6, got, want);
+}
+
+int
+main(void)
+{
+        check_coordinates();
+        check_layouts();
+        check_odd_fields();
+        check_atoi();
+        check_codes();
+        printf("%ld checks, %ld failed\n", g_checked, g_failed);
+        return g_failed == 0 ? 0 : 1;
+}
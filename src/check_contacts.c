@@ -0,0 +1,271 @@
+/*
+ *  Copyright 2018 Gearoid Fox
+ *
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Checks, for `make check`, that a contact list written by
+ * write_contacts_binary() comes back unchanged from read_contacts_binary(),
+ * and that every truncated copy of it, and a header promising more than
+ * the file holds, are rejected.
+ */
+
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+
+#include"contacts.h"
+#include"output.h"
+
+#define NRES 400
+#define MAX_REPORTS 10
+
+static long g_checked = 0;
+static long g_failed = 0;
+
+/**
+ * report: count a failed check, printing the first few
+ */
+static void
+report(const char *what)
+{
+        g_failed++;
+        if(g_failed <= MAX_REPORTS)
+                fprintf(stderr, "%s\n", what);
+}
+
+/**
+ * make_list: build a contact list with gaps of every varint length
+ *
+ * Each residue is in contact with a few near neighbours, which give the
+ * one-byte gaps most real lists are made of, and now and then with a
+ * residue far enough away to need a two-byte gap. Some rows are empty.
+ *
+ * Returns NULL if memory can't be allocated.
+ */
+static struct contacts *
+make_list(void)
+{
+        struct contacts *ct;
+        size_t k = 0;
+        int i, j;
+
+        ct = calloc(1, sizeof(*ct));
+        if(ct == NULL) return NULL;
+        ct->rowptr = malloc((NRES + 1) * sizeof(*ct->rowptr));
+        ct->col = malloc((size_t) NRES * 8 * sizeof(*ct->col));
+        ct->chain_name = strdup("AB");
+        ct->source_filename = strdup("check.cif");
+        ct->sequence = malloc(NRES + 1);
+        if(ct->rowptr == NULL || ct->col == NULL || ct->chain_name == NULL
+                        || ct->source_filename == NULL || ct->sequence == NULL){
+                freecontacts(ct);
+                return NULL;
+        }
+        for(i = 0; i < NRES; i++)
+                ct->sequence[i] = "ACDEFGHIKLMNPQRSTVWY"[i % 20];
+        ct->sequence[NRES] = '\0';
+        ct->nres = NRES;
+        ct->threshold = 8.25;
+        for(i = 0; i < NRES; i++){
+                ct->rowptr[i] = k;
+                if(i % 7 == 3) continue;
+                for(j = i + 1; j < NRES && j <= i + 1 + i % 4; j++)
+                        ct->col[k++] = j;
+                if(i % 5 == 0 && i + 200 < NRES)
+                        ct->col[k++] = i + 200;
+        }
+        ct->rowptr[NRES] = k;
+        ct->ncontacts = k;
+        return ct;
+}
+
+/**
+ * same_string: compare two optional strings
+ */
+static int
+same_string(const char *a, const char *b)
+{
+        if(a == NULL || b == NULL) return a == b;
+        return strcmp(a, b) == 0;
+}
+
+/**
+ * check_round_trip: compare a list read back with the one written
+ */
+static void
+check_round_trip(const struct contacts *want, const struct contacts *got)
+{
+        int i;
+
+        g_checked++;
+        if(got == NULL){
+                report("round trip: file was rejected");
+                return;
+        }
+        if(got->nres != want->nres || got->ncontacts != want->ncontacts
+                        || got->threshold != want->threshold
+                        || !same_string(got->chain_name, want->chain_name)
+                        || !same_string(got->source_filename,
+                                want->source_filename)
+                        || !same_string(got->sequence, want->sequence)){
+                report("round trip: header differs");
+                return;
+        }
+        for(i = 0; i <= want->nres; i++)
+                if(got->rowptr[i] != want->rowptr[i]){
+                        report("round trip: row pointers differ");
+                        return;
+                }
+        if(memcmp(got->col, want->col, want->ncontacts * sizeof(*want->col))
+                        != 0)
+                report("round trip: partners differ");
+}
+
+/**
+ * write_bytes: replace the contents of a file
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+write_bytes(const char *path, const unsigned char *data, size_t n)
+{
+        FILE *fp = fopen(path, "wb");
+
+        if(fp == NULL) return -1;
+        if(fwrite(data, 1, n, fp) != n){
+                fclose(fp);
+                return -1;
+        }
+        return fclose(fp) == 0 ? 0 : -1;
+}
+
+/**
+ * check_rejected: check that a file holding @n bytes of @data is rejected
+ */
+static void
+check_rejected(const char *what, char *path, const unsigned char *data,
+                size_t n)
+{
+        struct contacts *ct;
+        char msg[80];
+
+        g_checked++;
+        if(write_bytes(path, data, n) != 0){
+                snprintf(msg, sizeof(msg), "%s: couldn't write test file", what);
+                report(msg);
+                return;
+        }
+        ct = read_contacts_binary(path);
+        if(ct != NULL){
+                snprintf(msg, sizeof(msg), "%s (%zu bytes): not rejected",
+                                what, n);
+                report(msg);
+                freecontacts(ct);
+        }
+}
+
+/**
+ * check_oversized: a header claiming more than the file holds is rejected
+ *
+ * A short file claiming INT_MAX residues and as many contacts as that
+ * allows, which a reader trusting the header would try to allocate.
+ */
+static void
+check_oversized(char *path)
+{
+        unsigned char buf[64], *p = buf;
+        uint64_t v;
+        int k;
+
+        memcpy(p, CONTACTS_BIN_MAGIC, strlen(CONTACTS_BIN_MAGIC));
+        p += strlen(CONTACTS_BIN_MAGIC);
+        *p++ = CONTACTS_BIN_VERSION;
+        for(k = 0; k < 8; k++)
+                *p++ = 0;
+        for(k = 0; k < 2; k++){
+                v = k == 0 ? 0x7fffffff : (uint64_t) 0x7fffffff * 1000;
+                while(v >= 0x80){
+                        *p++ = (v & 0x7f) | 0x80;
+                        v >>= 7;
+                }
+                *p++ = v;
+        }
+        for(k = 0; k < 3; k++)
+                *p++ = 0;
+        check_rejected("oversized header", path, buf, p - buf);
+}
+
+int
+main(void)
+{
+        char path[] = "check_contacts_XXXXXX";
+        struct contacts *ct, *back;
+        unsigned char *data;
+        FILE *fp;
+        long size;
+        size_t n;
+        int fd;
+
+        ct = make_list();
+        fd = mkstemp(path);
+        if(ct == NULL || fd < 0 || (fp = fdopen(fd, "wb")) == NULL){
+                fprintf(stderr, "FATAL: couldn't set up test file\n");
+                if(fd >= 0) unlink(path);
+                return 1;
+        }
+        if(write_contacts_binary(fp, *ct) != 0 || fclose(fp) != 0){
+                fprintf(stderr, "FATAL: couldn't write test file\n");
+                unlink(path);
+                return 1;
+        }
+
+        back = read_contacts_binary(path);
+        check_round_trip(ct, back);
+        freecontacts(back);
+
+        /* Read the file in, then offer every proper prefix of it */
+        fp = fopen(path, "rb");
+        data = NULL;
+        size = -1;
+        if(fp != NULL && fseek(fp, 0, SEEK_END) == 0
+                        && (size = ftell(fp)) > 0
+                        && fseek(fp, 0, SEEK_SET) == 0
+                        && (data = malloc(size)) != NULL
+                        && fread(data, 1, size, fp) != (size_t) size){
+                free(data);
+                data = NULL;
+        }
+        if(fp != NULL) fclose(fp);
+        if(data == NULL){
+                fprintf(stderr, "FATAL: couldn't read test file back\n");
+                unlink(path);
+                return 1;
+        }
+        for(n = 0; n < (size_t) size; n++)
+                check_rejected("truncated file", path, data, n);
+        check_oversized(path);
+
+        unlink(path);
+        free(data);
+        freecontacts(ct);
+        printf("%ld checks, %ld failed\n", g_checked, g_failed);
+        return g_failed == 0 ? 0 : 1;
+}
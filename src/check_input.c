@@ -0,0 +1,230 @@
+/*
+ *  Copyright 2018 Gearoid Fox
+ *
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Checks, for `make check`, that compressed input comes back intact from
+ * open_input() and open_input_stream(), including files that decompress
+ * to more than the decompressor is allowed to run ahead of the reader.
+ * A hang counts as a failure: the alarm ends the program.
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+
+#include<bzlib.h>
+#include<zlib.h>
+
+#include"input.h"
+
+#define TEXT_LEN (24 * 1024 * 1024)     /* three times STREAM_AHEAD */
+#define TIME_LIMIT 120                  /* seconds */
+
+static long g_checked = 0;
+static long g_failed = 0;
+
+/**
+ * make_text: fill a buffer with lines of ATOM-record-like text
+ *
+ * The numbers vary from line to line, so the text doesn't compress away
+ * to nothing, and a misplaced block would be noticed.
+ */
+static void
+make_text(char *text, size_t n)
+{
+        char line[82];
+        size_t at = 0, k;
+        unsigned long i = 0;
+        int len;
+
+        while(at < n){
+                len = snprintf(line, sizeof(line), "ATOM  %5lu  CA  ALA A%4lu    %8.3f%8.3f%8.3f  1.00  0.00           C\n",
+                                i % 100000, i % 10000,
+                                (double) (i * 7 % 19997) / 10.0,
+                                (double) (i * 13 % 19993) / 10.0,
+                                (double) (i * 31 % 19991) / 10.0);
+                for(k = 0; k < (size_t) len && at < n; k++)
+                        text[at++] = line[k];
+                i++;
+        }
+}
+
+/**
+ * write_gzip: write @n bytes of @text to @path, gzip-compressed
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+write_gzip(const char *path, const char *text, size_t n)
+{
+        gzFile gz = gzopen(path, "wb1");
+        size_t done = 0, step;
+
+        if(gz == NULL) return -1;
+        while(done < n){
+                step = n - done > (1 << 20) ? (1 << 20) : n - done;
+                if(gzwrite(gz, text + done, step) != (int) step){
+                        gzclose(gz);
+                        return -1;
+                }
+                done += step;
+        }
+        return gzclose(gz) == Z_OK ? 0 : -1;
+}
+
+/**
+ * write_bzip2: write @n bytes of @text to @path, bzip2-compressed
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+write_bzip2(const char *path, const char *text, size_t n)
+{
+        FILE *fp = fopen(path, "wb");
+        BZFILE *bz;
+        size_t done = 0, step;
+        int err;
+
+        if(fp == NULL) return -1;
+        bz = BZ2_bzWriteOpen(&err, fp, 1, 0, 0);
+        if(err != BZ_OK){
+                fclose(fp);
+                return -1;
+        }
+        while(done < n){
+                step = n - done > (1 << 20) ? (1 << 20) : n - done;
+                BZ2_bzWrite(&err, bz, (char *) text + done, step);
+                if(err != BZ_OK) break;
+                done += step;
+        }
+        BZ2_bzWriteClose(&err, bz, 0, NULL, NULL);
+        if(fclose(fp) != 0 || err != BZ_OK || done < n) return -1;
+        return 0;
+}
+
+/**
+ * check_equal: compare what was read with what was written
+ */
+static void
+check_equal(const char *what, const struct inputbuf *in, const char *text,
+                size_t n)
+{
+        g_checked++;
+        if(in == NULL){
+                g_failed++;
+                fprintf(stderr, "%s: couldn't be opened\n", what);
+        }
+        else if(in->len != n || memcmp(in->data, text, n) != 0){
+                g_failed++;
+                fprintf(stderr, "%s: read %zu bytes, expected %zu bytes\n",
+                                what, in->len, n);
+        }
+}
+
+/**
+ * check_file: read a compressed file back in both ways and compare
+ *
+ * Once whole with open_input(), and once line by line with
+ * open_input_stream(), releasing each line as it is passed, as the
+ * parsers do.
+ */
+static void
+check_file(const char *what, char *path, const char *text, size_t n)
+{
+        struct inputbuf *in;
+        const char *line, *eol, *end, *last;
+        size_t nlines = 0, want = 0, at;
+        char name[64];
+
+        in = open_input(path);
+        snprintf(name, sizeof(name), "%s, whole", what);
+        check_equal(name, in, text, n);
+        close_input(in);
+
+        in = open_input_stream(path);
+        snprintf(name, sizeof(name), "%s, streamed", what);
+        g_checked++;
+        if(in == NULL){
+                g_failed++;
+                fprintf(stderr, "%s: couldn't be opened\n", name);
+                return;
+        }
+        end = in->data + in->len;
+        last = in->data;
+        for(line = in->data; (eol = input_line(in, line, &end)) != NULL;
+                        line = eol + 1){
+                nlines++;
+                last = line;
+                release_input(in, line);
+                if(eol == end) break;
+        }
+        for(line = text; line < text + n; line++)
+                if(*line == '\n') want++;
+        if(text[n - 1] != '\n') want++;
+        /* Only the last line is left unreleased to compare */
+        at = last - in->data;
+        if(input_all(in) != 0 || nlines != want || in->len != n
+                        || memcmp(last, text + at, n - at) != 0){
+                g_failed++;
+                fprintf(stderr, "%s: %zu lines of %zu bytes, expected %zu of %zu\n",
+                                name, nlines, in->len, want, n);
+        }
+        close_input(in);
+}
+
+int
+main(void)
+{
+        char gz_path[] = "check_input_XXXXXX";
+        char bz_path[] = "check_input_XXXXXX";
+        char *text;
+        int fd;
+
+        alarm(TIME_LIMIT);
+        text = malloc(TEXT_LEN);
+        if(text == NULL){
+                fprintf(stderr, "FATAL: out of memory\n");
+                return 1;
+        }
+        make_text(text, TEXT_LEN);
+
+        fd = mkstemp(gz_path);
+        if(fd < 0 || close(fd) != 0 || write_gzip(gz_path, text, TEXT_LEN)){
+                fprintf(stderr, "FATAL: couldn't write test file\n");
+                if(fd >= 0) unlink(gz_path);
+                return 1;
+        }
+        check_file("gzip", gz_path, text, TEXT_LEN);
+        unlink(gz_path);
+
+        fd = mkstemp(bz_path);
+        if(fd < 0 || close(fd) != 0 || write_bzip2(bz_path, text, TEXT_LEN)){
+                fprintf(stderr, "FATAL: couldn't write test file\n");
+                if(fd >= 0) unlink(bz_path);
+                return 1;
+        }
+        check_file("bzip2", bz_path, text, TEXT_LEN);
+        unlink(bz_path);
+
+        free(text);
+        printf("%ld checks, %ld failed\n", g_checked, g_failed);
+        return g_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,872 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+#include<strings.h>
+
+#include"atoms.h"
+#include"cif.h"
+#include"input.h"
+#include"pdb.h"
+
+#ifdef __SSE2__
+#include<emmintrin.h>
+#endif
+
+/*
+ * Tokens of a CIF file. Values may be bare words, quoted strings or
+ * semicolon-delimited text fields; the quotes and semicolons are not part
+ * of the token.
+ */
+enum cif_kind{
+        CIF_END,
+        CIF_VALUE,
+        CIF_TAG,
+        CIF_LOOP,
+        CIF_BLOCK
+};
+
+struct cif_token{
+        const char *s;
+        size_t len;
+        enum cif_kind kind;
+};
+
+/* Reads the tokens of a file held in memory, one at a time */
+struct cif_lexer{
+        const char *p;
+        const char *start;
+        const char *end;
+};
+
+/* Whitespace is space, tab and line breaks. CIF allows no other control
+ * characters, so they are treated as whitespace too, which takes a single
+ * comparison. */
+#define CIF_SPACE(c) ((unsigned char) (c) <= ' ')
+
+/**
+ * next_token: read the next token of a CIF file
+ *
+ * @lx:  lexer
+ * @tok: set to the token
+ *
+ * Comments are skipped. A quote only closes a quoted string if followed
+ * by white space, so "O5'" style atom names inside quotes are kept whole.
+ */
+static void
+next_token(struct cif_lexer *lx, struct cif_token *tok)
+{
+        const char *p = lx->p, *end = lx->end, *q;
+        char quote;
+
+        while(p < end){
+                if(CIF_SPACE(*p)){
+                        p++;
+                        continue;
+                }
+                if(*p != '#') break;
+                q = memchr(p, '\n', end - p);
+                p = q == NULL ? end : q;
+        }
+        if(p >= end){
+                lx->p = end;
+                tok->kind = CIF_END;
+                return;
+        }
+        tok->kind = CIF_VALUE;
+
+        /* Text field: from a ';' at the start of a line to the next one */
+        if(*p == ';' && (p == lx->start || p[-1] == '\n')){
+                tok->s = ++p;
+                for(q = p; q < end; q++){
+                        q = memchr(q, '\n', end - q);
+                        if(q == NULL || (q + 1 < end && q[1] == ';')) break;
+                }
+                if(q == NULL || q >= end){
+                        tok->len = end - tok->s;
+                        lx->p = end;
+                        return;
+                }
+                tok->len = q - tok->s;
+                lx->p = q + 2;
+                return;
+        }
+
+        if(*p == '\'' || *p == '"'){
+                quote = *p++;
+                tok->s = p;
+                while(p < end && !(*p == quote
+                                        && (p + 1 == end || CIF_SPACE(p[1]))))
+                        p++;
+                tok->len = p - tok->s;
+                lx->p = p < end ? p + 1 : end;
+                return;
+        }
+
+        tok->s = p;
+        while(p < end && !CIF_SPACE(*p)) p++;
+        tok->len = p - tok->s;
+        lx->p = p;
+        if(*tok->s == '_')
+                tok->kind = CIF_TAG;
+        else if(tok->len == 5 && strncasecmp(tok->s, "loop_", 5) == 0)
+                tok->kind = CIF_LOOP;
+        else if(tok->len >= 5 && (strncasecmp(tok->s, "data_", 5) == 0
+                                || strncasecmp(tok->s, "save_", 5) == 0))
+                tok->kind = CIF_BLOCK;
+}
+
+/**
+ * is_cif: check whether an input file is in mmCIF (PDBx) format
+ *
+ * The first token of a CIF file, after any comments, starts a data block.
+ * Only the first 64 KB are looked at, so a file still being decompressed
+ * needn't be waited for in full.
+ */
+int
+is_cif(struct inputbuf *in)
+{
+        struct cif_lexer lx;
+        struct cif_token tok;
+
+        input_wait(in, 1 << 16);
+        lx.p = lx.start = in->data;
+        lx.end = in->data + in->len;
+        next_token(&lx, &tok);
+        return tok.kind == CIF_BLOCK;
+}
+
+/*
+ * Columns of the two loops that are read. Column numbers are looked up
+ * from the loop's tags once, when the loop starts.
+ */
+enum{
+        AS_GROUP,
+        AS_ATOM,
+        AS_ENTITY,
+        AS_SEQ,
+        AS_AUTH_ASYM,
+        AS_LABEL_ASYM,
+        AS_X,
+        AS_Y,
+        AS_Z,
+        AS_MODEL,
+        AS_TYPE,
+        AS_ALT,
+        AS_NCOLS
+};
+
+static const char *atom_site_tags[AS_NCOLS] = {
+        "_atom_site.group_PDB",
+        "_atom_site.label_atom_id",
+        "_atom_site.label_entity_id",
+        "_atom_site.label_seq_id",
+        "_atom_site.auth_asym_id",
+        "_atom_site.label_asym_id",
+        "_atom_site.Cartn_x",
+        "_atom_site.Cartn_y",
+        "_atom_site.Cartn_z",
+        "_atom_site.pdbx_PDB_model_num",
+        "_atom_site.type_symbol",
+        "_atom_site.label_alt_id"
+};
+
+enum{
+        PS_ENTITY,
+        PS_NUM,
+        PS_MON,
+        PS_NCOLS
+};
+
+static const char *poly_seq_tags[PS_NCOLS] = {
+        "_entity_poly_seq.entity_id",
+        "_entity_poly_seq.num",
+        "_entity_poly_seq.mon_id"
+};
+
+/* An alpha carbon from _atom_site */
+struct cif_atom{
+        int seq;
+        double x, y, z;
+};
+
+/*
+ * A chain, by author chain ID, and the alpha carbons seen for it; in
+ * all-atom mode, its heavy atoms too
+ */
+struct cif_chain{
+        char *name;
+        char *entity;
+        struct cif_atom *atoms;
+        int natoms;
+        int cap;
+        struct atom_list heavy;
+};
+
+/* The sequence of a polymer entity from _entity_poly_seq */
+struct cif_entity{
+        char *id;
+        char *seq;
+        int len;
+        int cap;
+};
+
+/* Everything collected while reading one file */
+struct cif_state{
+        struct cif_chain *chains;
+        int nchains;
+        int nchains_cap;
+        struct cif_entity *entities;
+        int nentities;
+        int nentities_cap;
+        const char *target;
+        struct cif_token model;
+        int all_atoms;
+        int failed;
+};
+
+/**
+ * token_is: compare a token to a string
+ */
+static int
+token_is(const struct cif_token *tok, const char *s)
+{
+        return strlen(s) == tok->len && memcmp(tok->s, s, tok->len) == 0;
+}
+
+/**
+ * token_dup: copy a token into a new null-terminated string
+ */
+static char *
+token_dup(const struct cif_token *tok)
+{
+        char *s = malloc(tok->len + 1);
+
+        if(s == NULL) return NULL;
+        memcpy(s, tok->s, tok->len);
+        s[tok->len] = '\0';
+        return s;
+}
+
+/**
+ * token_null: true for the CIF null values "." and "?"
+ */
+static int
+token_null(const struct cif_token *tok)
+{
+        return tok->len == 1 && (*tok->s == '.' || *tok->s == '?');
+}
+
+/**
+ * grow: make room for one more element in a growable array
+ *
+ * Returns 0 on success, -1 if memory can't be allocated.
+ */
+static int
+grow(void **arr, int n, int *cap, size_t size)
+{
+        void *tmp;
+        int c;
+
+        if(n < *cap) return 0;
+        c = *cap > 0 ? 2 * *cap : 16;
+        tmp = realloc(*arr, c * size);
+        if(tmp == NULL) return -1;
+        *arr = tmp;
+        *cap = c;
+        return 0;
+}
+
+/**
+ * atom_site_row: take one row of the _atom_site loop
+ *
+ * Alpha carbons in ATOM records of the first model are kept, under the
+ * author's chain ID (or the label chain ID if there is none), with their
+ * index in the entity's sequence. As with PDB files, a later record for
+ * the same residue replaces an earlier one. In all-atom mode every heavy
+ * atom is kept as well, except alternate locations other than the first.
+ */
+static void
+atom_site_row(struct cif_state *st, struct cif_token *row)
+{
+        struct cif_token *name;
+        struct cif_chain *c;
+        struct cif_atom *a;
+        double x, y, z;
+        int k, seq, ca;
+
+        if(row[AS_MODEL].s != NULL){
+                if(st->model.s == NULL)
+                        st->model = row[AS_MODEL];
+                else if(row[AS_MODEL].len != st->model.len
+                                || memcmp(row[AS_MODEL].s, st->model.s,
+                                        st->model.len) != 0)
+                        return;
+        }
+        ca = token_is(&row[AS_ATOM], "CA");
+        if(!ca && !st->all_atoms) return;
+        if(row[AS_GROUP].s != NULL && !token_is(&row[AS_GROUP], "ATOM"))
+                return;
+        seq = fixed_atoi(row[AS_SEQ].s, row[AS_SEQ].len, 0, row[AS_SEQ].len);
+        if(seq <= 0) return;
+        name = row[AS_AUTH_ASYM].s != NULL && !token_null(&row[AS_AUTH_ASYM])
+                ? &row[AS_AUTH_ASYM] : &row[AS_LABEL_ASYM];
+        if(name->s == NULL || row[AS_ENTITY].s == NULL) return;
+        if(st->target != NULL && !token_is(name, st->target)) return;
+
+        /* Chains usually come in runs, so try the last one first */
+        for(k = st->nchains - 1; k >= 0; k--)
+                if(token_is(name, st->chains[k].name)) break;
+        if(k < 0){
+                if(grow((void **) &st->chains, st->nchains, &st->nchains_cap,
+                                        sizeof(*st->chains)) != 0)
+                        goto asr_nomem;
+                c = st->chains + st->nchains;
+                memset(c, 0, sizeof(*c));
+                c->name = token_dup(name);
+                c->entity = token_dup(&row[AS_ENTITY]);
+                st->nchains++;
+                if(c->name == NULL || c->entity == NULL) goto asr_nomem;
+                k = st->nchains - 1;
+        }
+        c = st->chains + k;
+        if(!token_is(&row[AS_ENTITY], c->entity)) return;
+        x = fixed_atof(row[AS_X].s, row[AS_X].len, 0, row[AS_X].len);
+        y = fixed_atof(row[AS_Y].s, row[AS_Y].len, 0, row[AS_Y].len);
+        z = fixed_atof(row[AS_Z].s, row[AS_Z].len, 0, row[AS_Z].len);
+        if(st->all_atoms && (row[AS_ALT].s == NULL || token_null(&row[AS_ALT])
+                                || token_is(&row[AS_ALT], "A"))
+                        && heavy_atom(token_null(&row[AS_TYPE]) ? NULL
+                                        : row[AS_TYPE].s, row[AS_TYPE].len,
+                                row[AS_ATOM].s, row[AS_ATOM].len)
+                        && add_atom(&c->heavy, seq, x, y, z) != 0)
+                goto asr_nomem;
+        if(!ca) return;
+        if(grow((void **) &c->atoms, c->natoms, &c->cap, sizeof(*a)) != 0)
+                goto asr_nomem;
+        a = c->atoms + c->natoms++;
+        a->seq = seq;
+        a->x = x;
+        a->y = y;
+        a->z = z;
+        return;
+
+        asr_nomem:
+        st->failed = 1;
+}
+
+/**
+ * poly_seq_row: take one row of the _entity_poly_seq loop
+ *
+ * Monomers are converted to one-letter codes as in SEQRES records. Where
+ * a position has several alternative monomers, the first is kept.
+ */
+static void
+poly_seq_row(struct cif_state *st, struct cif_token *row)
+{
+        struct cif_entity *e;
+        char tlc[3];
+        int k, num, cap;
+        char *tmp;
+
+        num = fixed_atoi(row[PS_NUM].s, row[PS_NUM].len, 0, row[PS_NUM].len);
+        if(num <= 0 || row[PS_ENTITY].s == NULL) return;
+        for(k = st->nentities - 1; k >= 0; k--)
+                if(token_is(&row[PS_ENTITY], st->entities[k].id)) break;
+        if(k < 0){
+                if(grow((void **) &st->entities, st->nentities,
+                                        &st->nentities_cap,
+                                        sizeof(*st->entities)) != 0)
+                        goto psr_nomem;
+                e = st->entities + st->nentities++;
+                memset(e, 0, sizeof(*e));
+                e->id = token_dup(&row[PS_ENTITY]);
+                if(e->id == NULL) goto psr_nomem;
+                k = st->nentities - 1;
+        }
+        e = st->entities + k;
+        if(num > e->cap){
+                cap = e->cap > 0 ? 2 * e->cap : 256;
+                while(cap < num) cap *= 2;
+                tmp = realloc(e->seq, cap);
+                if(tmp == NULL) goto psr_nomem;
+                memset(tmp + e->cap, 0, cap - e->cap);
+                e->seq = tmp;
+                e->cap = cap;
+        }
+        if(num > e->len) e->len = num;
+        if(e->seq[num - 1] != '\0') return;
+
+        /* Codes are right-justified in three columns, as in SEQRES */
+        memset(tlc, ' ', 3);
+        if(row[PS_MON].len <= 3)
+                memcpy(tlc + 3 - row[PS_MON].len, row[PS_MON].s,
+                                row[PS_MON].len);
+        e->seq[num - 1] = row[PS_MON].len <= 3 ? one_letter_code(tlc) : 'X';
+        return;
+
+        psr_nomem:
+        st->failed = 1;
+}
+
+/**
+ * split_line: split one line of a loop into values
+ *
+ * @p:     start of the line
+ * @eol:   end of the line
+ * @ntags: number of columns of the loop
+ * @want:  for each column, the index in @row to store it at, or -1
+ * @row:   receives the wanted values
+ *
+ * Quoted values are handled as by next_token(). Stops early once more
+ * than @ntags values are seen.
+ *
+ * Returns the number of values on the line.
+ */
+static int
+split_line(const char *p, const char *eol, int ntags, const int *want,
+                struct cif_token *row)
+{
+        const char *s;
+        char quote;
+        int n;
+
+        for(n = 0; n <= ntags; n++){
+                while(p < eol && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+                if(p >= eol || *p == '#') break;
+                if(*p == '\'' || *p == '"'){
+                        quote = *p++;
+                        s = p;
+                        while(p < eol && !(*p == quote
+                                        && (p + 1 == eol || CIF_SPACE(p[1]))))
+                                p++;
+                        if(n < ntags && want[n] >= 0){
+                                row[want[n]].s = s;
+                                row[want[n]].len = p - s;
+                        }
+                        if(p < eol) p++;
+                        continue;
+                }
+                s = p;
+                while(p < eol && !CIF_SPACE(*p)) p++;
+                if(n < ntags && want[n] >= 0){
+                        row[want[n]].s = s;
+                        row[want[n]].len = p - s;
+                }
+        }
+        return n;
+}
+
+/**
+ * space_mask: find the whitespace in up to 64 bytes
+ *
+ * @p:   start of the bytes
+ * @len: number of bytes, at most 64
+ *
+ * Returns a mask with bit k set if @p[k] is whitespace, and with every bit
+ * from @len up set.
+ */
+static uint64_t
+space_mask(const char *p, int len)
+{
+        uint64_t mask = len < 64 ? ~(uint64_t) 0 << len : 0;
+        int k = 0;
+#ifdef __SSE2__
+        const __m128i space = _mm_set1_epi8(' ');
+        __m128i v;
+
+        for(; k + 16 <= len; k += 16){
+                v = _mm_loadu_si128((const __m128i *) (p + k));
+                v = _mm_cmpeq_epi8(_mm_max_epu8(v, space), space);
+                mask |= (uint64_t) (unsigned) _mm_movemask_epi8(v) << k;
+        }
+#endif
+        for(; k < len; k++)
+                mask |= (uint64_t) CIF_SPACE(p[k]) << k;
+        return mask;
+}
+
+/**
+ * split_words: split a line of bare words into values
+ *
+ * As split_line(), but finds the words from a bitmask of the whitespace
+ * in each 64 bytes of the line, which avoids a hard-to-predict branch on
+ * every character. Stops once @stop values have been seen, so the columns
+ * after the last one wanted needn't be looked at.
+ *
+ * Returns the number of values seen, or -1 if a quoted value or a comment
+ * comes first, which are left to split_line().
+ */
+static int
+split_words(const char *p, const char *eol, int ntags, int stop,
+                const int *want, struct cif_token *row)
+{
+        const char *base, *s = NULL, *e;
+        uint64_t space, word, starts, ends, carry = 0;
+        int len, n = 0, open = 0;
+
+        for(base = p; base < eol; base += 64){
+                len = eol - base < 64 ? eol - base : 64;
+                space = space_mask(base, len);
+                word = ~space;
+                starts = word & ~(word << 1 | carry);
+                ends = space & (word << 1 | carry);
+                carry = word >> 63;
+                for(;;){
+                        if(!open){
+                                if(starts == 0) break;
+                                s = base + __builtin_ctzll(starts);
+                                starts &= starts - 1;
+                                if(*s == '\'' || *s == '"' || *s == '#')
+                                        return -1;
+                        }
+                        if(ends == 0){
+                                open = 1;
+                                break;
+                        }
+                        e = base + __builtin_ctzll(ends);
+                        ends &= ends - 1;
+                        open = 0;
+                        if(n < ntags && want[n] >= 0){
+                                row[want[n]].s = s;
+                                row[want[n]].len = e - s;
+                        }
+                        if(++n >= stop) return n;
+                }
+        }
+        if(open){
+                if(n < ntags && want[n] >= 0){
+                        row[want[n]].s = s;
+                        row[want[n]].len = eol - s;
+                }
+                n++;
+        }
+        return n;
+}
+
+/**
+ * column_is: check the value in one column of a line of a loop
+ *
+ * @p:   start of the line
+ * @eol: end of the line
+ * @col: column number
+ * @s:   value to compare with
+ *
+ * Returns 0 if the value is a bare word other than @s, or 1 if it is @s
+ * or can't be told apart cheaply (a quoted value on the way).
+ */
+static int
+column_is(const char *p, const char *eol, int col, const char *s)
+{
+        const char *t;
+        int n;
+
+        for(n = 0; ; n++){
+                while(p < eol && CIF_SPACE(*p)) p++;
+                if(p >= eol || *p == '\'' || *p == '"') return 1;
+                t = p;
+                while(p < eol && !CIF_SPACE(*p)) p++;
+                if(n == col)
+                        return (size_t) (p - t) == strlen(s)
+                                && memcmp(t, s, p - t) == 0;
+        }
+}
+
+/**
+ * last_word: find the value in the last column of a line of a loop
+ *
+ * @p:   start of the line
+ * @eol: end of the line
+ * @t:   set to the value
+ *
+ * Returns 0 on success, or -1 if the line is empty or ends in a quoted
+ * value.
+ */
+static int
+last_word(const char *p, const char *eol, struct cif_token *t)
+{
+        const char *e;
+
+        while(eol > p && CIF_SPACE(eol[-1])) eol--;
+        if(eol == p || eol[-1] == '\'' || eol[-1] == '"') return -1;
+        for(e = eol; e > p && !CIF_SPACE(e[-1]); e--)
+                ;
+        t->s = e;
+        t->len = eol - e;
+        return 0;
+}
+
+/**
+ * last_column_is: check the value in the last column of a line of a loop
+ *
+ * @p:   start of the line
+ * @eol: end of the line
+ * @t:   value to compare with
+ *
+ * Like column_is(), but works back from the end of the line, which is
+ * where the model number is usually found.
+ */
+static int
+last_column_is(const char *p, const char *eol, const struct cif_token *t)
+{
+        struct cif_token last;
+
+        if(last_word(p, eol, &last) != 0) return 1;
+        return last.len == t->len && memcmp(last.s, t->s, t->len) == 0;
+}
+
+/**
+ * atom_site_lines: read rows of the _atom_site loop a line at a time
+ *
+ * @lx:       lexer, at the start of a line of the loop
+ * @st:       parser state
+ * @ntags:    number of columns of the loop
+ * @want:     for each column, where its value goes in a row, or -1
+ * @atom_col: column of the atom name, or -1
+ * @last:     non-zero if the model number is in the last column
+ * @row:      scratch row
+ * @verified: set once a line has been found to hold exactly one row
+ *
+ * Once a line has held a whole row, lines whose atom isn't an alpha
+ * carbon (unless @atom_col is -1), or which belong to a later model, are
+ * stepped over without being split, and the rest are only split up to the
+ * last column wanted; a model number in the last column is taken from the
+ * end of the line. Stops at the first line
+ * that doesn't start with a value, or doesn't hold exactly one row, and
+ * leaves @lx at its start for next_token().
+ */
+static void
+atom_site_lines(struct cif_lexer *lx, struct cif_state *st, int ntags,
+                const int *want, int atom_col, int last,
+                struct cif_token *row, int *verified)
+{
+        const char *p = lx->p, *q, *eol, *end = lx->end;
+        int n, k, stop = 0;
+
+        /* Columns to split once lines are known to hold one row each */
+        for(k = 0; k < ntags - (last != 0); k++)
+                if(want[k] >= 0) stop = k + 1;
+
+        while(p < end){
+                eol = memchr(p, '\n', end - p);
+                if(eol == NULL) eol = end;
+                for(q = p; q < eol && (*q == ' ' || *q == '\t' || *q == '\r'); q++)
+                        ;
+                if(q == eol){
+                        p = eol < end ? eol + 1 : end;
+                        continue;
+                }
+                if(*q == '_' || *q == '#' || *q == ';') break;
+                if(eol - q >= 5 && strchr("dDlLsS", *q) != NULL
+                                && (strncasecmp(q, "loop_", 5) == 0
+                                        || strncasecmp(q, "data_", 5) == 0
+                                        || strncasecmp(q, "save_", 5) == 0
+                                        || strncasecmp(q, "stop_", 5) == 0))
+                        break;
+                if(*verified && ((atom_col >= 0
+                                        && !column_is(q, eol, atom_col, "CA"))
+                                || (last && st->model.s != NULL
+                                        && !last_column_is(q, eol,
+                                                &st->model)))){
+                        p = eol < end ? eol + 1 : end;
+                        continue;
+                }
+                n = -1;
+                if(*verified && split_words(q, eol, ntags, stop, want, row)
+                                == stop && (!last || last_word(q, eol,
+                                                &row[AS_MODEL]) == 0))
+                        n = ntags;
+                if(n < 0) n = split_words(q, eol, ntags, ntags + 1, want, row);
+                if(n < 0) n = split_line(q, eol, ntags, want, row);
+                if(n != ntags) break;
+                *verified = 1;
+                atom_site_row(st, row);
+                p = eol < end ? eol + 1 : end;
+        }
+        lx->p = p;
+}
+
+/**
+ * read_loop: read the tags and values of one loop
+ *
+ * @lx:  lexer, just past the loop_ keyword
+ * @st:  parser state
+ * @tok: set to the first token after the loop
+ *
+ * If the loop is _atom_site or _entity_poly_seq, the columns that are
+ * needed are found from the tags once, and each row's values for those
+ * columns handed on; the other loops are skipped.
+ *
+ * Programs writing mmCIF put each row of _atom_site on a line of its own,
+ * so those rows are read by atom_site_lines() while that holds. Anything
+ * else is read token by token.
+ */
+static void
+read_loop(struct cif_lexer *lx, struct cif_state *st, struct cif_token *tok)
+{
+        struct cif_token row[AS_NCOLS];
+        const char **tags = NULL;
+        int *want = NULL;
+        int ntags = 0, cap = 0, nwant = 0;
+        int k, c, col, atom_col = -1, lines, verified = 0;
+        void (*take)(struct cif_state *, struct cif_token *) = NULL;
+
+        next_token(lx, tok);
+        if(tok->kind == CIF_TAG){
+                if(tok->len > 11 && memcmp(tok->s, "_atom_site.", 11) == 0){
+                        tags = atom_site_tags;
+                        nwant = AS_NCOLS;
+                        take = atom_site_row;
+                }
+                else if(tok->len > 17
+                                && memcmp(tok->s, "_entity_poly_seq.", 17) == 0){
+                        tags = poly_seq_tags;
+                        nwant = PS_NCOLS;
+                        take = poly_seq_row;
+                }
+        }
+        for(; tok->kind == CIF_TAG; next_token(lx, tok), ntags++){
+                if(take == NULL) continue;
+                if(grow((void **) &want, ntags, &cap, sizeof(*want)) != 0){
+                        st->failed = 1;
+                        take = NULL;
+                        continue;
+                }
+                want[ntags] = -1;
+                for(k = 0; k < nwant; k++)
+                        if(token_is(tok, tags[k])) want[ntags] = k;
+                if(take == atom_site_row && want[ntags] == AS_ATOM
+                                && !st->all_atoms)
+                        atom_col = ntags;
+        }
+        if(take == NULL || ntags == 0){
+                while(tok->kind == CIF_VALUE) next_token(lx, tok);
+                free(want);
+                return;
+        }
+
+        memset(row, 0, sizeof(row));
+        lines = take == atom_site_row;
+        for(col = 0; tok->kind == CIF_VALUE; next_token(lx, tok)){
+                if(col == 0 && lines && tok->s > lx->start
+                                && tok->s[-1] == '\n'){
+                        lx->p = tok->s;
+                        atom_site_lines(lx, st, ntags, want, atom_col,
+                                        want[ntags - 1] == AS_MODEL, row,
+                                        &verified);
+                        lines = verified;
+                        next_token(lx, tok);
+                        if(tok->kind != CIF_VALUE) break;
+                }
+                c = want[col];
+                if(c >= 0) row[c] = *tok;
+                if(++col < ntags) continue;
+                col = 0;
+                take(st, row);
+        }
+        free(want);
+}
+
+/**
+ * parse_cif: read sequences and alpha carbon coordinates of an mmCIF file
+ *
+ * @in:       the file contents
+ * @filename: input file name, recorded in each chain
+ * @target:   chain ID to read, or NULL for every chain
+ * @tab:      empty chain table to fill in
+ *
+ * The file is tokenised in a single pass. Sequences come from the
+ * _entity_poly_seq loop and alpha carbons from the _atom_site loop, placed
+ * by their label_seq_id, so there is no limit on the length of a chain and
+ * chain IDs may be several characters long. Chains are named by their
+ * author chain IDs, in order of their first atom, and only polymer chains
+ * are kept. Only the first data block and first model are read. In
+ * all-atom mode each chain's heavy atoms are placed by label_seq_id too.
+ *
+ * Returns 0 on success, -1 if memory can't be allocated.
+ */
+int
+parse_cif(const struct inputbuf *in, char *filename, const char *target,
+                struct chain_table *tab)
+{
+        struct cif_lexer lx = {in->data, in->data, in->data + in->len};
+        struct cif_state st;
+        struct cif_token tok;
+        struct cif_chain *c;
+        struct cif_entity *e;
+        struct coords *cs;
+        int blocks = 0, k, m, n, ret = -1;
+
+        memset(&st, 0, sizeof(st));
+        st.target = target;
+        st.all_atoms = all_atoms_in_use();
+        next_token(&lx, &tok);
+        while(tok.kind != CIF_END && !st.failed){
+                if(tok.kind == CIF_LOOP){
+                        read_loop(&lx, &st, &tok);
+                        continue;
+                }
+                if(tok.kind == CIF_BLOCK && blocks++ > 0) break;
+                next_token(&lx, &tok);
+        }
+        if(st.failed) goto pc_cleanup;
+
+        for(k = 0; k < st.nchains; k++){
+                c = st.chains + k;
+                for(m = 0, e = NULL; m < st.nentities && e == NULL; m++)
+                        if(strcmp(st.entities[m].id, c->entity) == 0)
+                                e = st.entities + m;
+                if(e == NULL || e->len == 0) continue;
+                cs = new_chain(tab, filename, c->name, e->len, in->len);
+                if(cs == NULL) goto pc_cleanup;
+                for(n = 0; n < e->len; n++)
+                        cs->sequence[n] = e->seq[n] ? e->seq[n] : 'X';
+                for(m = 0; m < c->natoms; m++){
+                        n = c->atoms[m].seq - 1;
+                        if(n >= e->len) continue;
+                        cs->x[n] = c->atoms[m].x;
+                        cs->y[n] = c->atoms[m].y;
+                        cs->z[n] = c->atoms[m].z;
+                        cs->present[n / 8] |= 1 << (n % 8);
+                }
+                if(st.all_atoms){
+                        cs->atoms = group_atoms(&c->heavy, e->len);
+                        if(cs->atoms == NULL) goto pc_cleanup;
+                }
+        }
+        ret = 0;
+
+        pc_cleanup:
+        for(k = 0; k < st.nchains; k++){
+                free(st.chains[k].name);
+                free(st.chains[k].entity);
+                free(st.chains[k].atoms);
+                free(st.chains[k].heavy.recs);
+        }
+        free(st.chains);
+        for(k = 0; k < st.nentities; k++){
+                free(st.entities[k].id);
+                free(st.entities[k].seq);
+        }
+        free(st.entities);
+        return ret;
+}
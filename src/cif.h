@@ -0,0 +1,31 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#ifndef CMAP_CIF_H_
+#define CMAP_CIF_H_
+
+#include "input.h"
+#include "pdb.h"
+
+int is_cif(struct inputbuf *in);
+int parse_cif(const struct inputbuf *in, char *filename, const char *target,
+                struct chain_table *tab);
+
+#endif // CMAP_CIF_H_
@@ -19,7 +19,9 @@
  */
 
 #define _XOPEN_SOURCE_EXTENDED
+#include<ctype.h>
 #include<getopt.h>
+#include<limits.h>
 #include<locale.h>
 #include<math.h>
 #include<ncurses.h>
@@ -27,15 +29,36 @@
 #include<string.h>
 #include<stdio.h>
 #include<stdlib.h>
+#include<time.h>
 #include<wchar.h>
 
+#include"atoms.h"
+#include"batch.h"
+#include"cache.h"
 #include"cmap.h"
+#include"contacts.h"
+#include"dcd.h"
+#include"distance.h"
+#include"ensemble.h"
 #include"pdb.h"
+#include"threads.h"
+#include"tiles.h"
 #include"output.h"
+#include"zoom.h"
 
 /* Global flag indicating if the terminal supports colour */
 bool g_has_colours = false; 
 
+/**
+ * elapsed: seconds between two timestamps from clock_gettime()
+ */
+static double
+elapsed(struct timespec start, struct timespec stop)
+{
+        return (stop.tv_sec - start.tv_sec)
+                + (stop.tv_nsec - start.tv_nsec) / 1e9;
+}
+
 /**
  * make_hpos_str: create a string marking every 20th position in protein chain
  * horizontally.
@@ -45,12 +68,13 @@ bool g_has_colours = false;
  * @x_draw_limit: maximum number of columns to be printed in unicode
  *      representation of contact map. (We display 2 points per character in 
  *      the x direction)
+ * @scale: residues per point, i.e. the zoom level's block size
  *
  * Allocates and returns a null-terminated string of length @x_draw_limit + 1
  * which should be freed manually if necessary.
  */
 char *
-make_hpos_str(unsigned int x_draw_limit)
+make_hpos_str(unsigned int x_draw_limit, unsigned int scale)
 {
         char *s = NULL;
         char buf[16];
@@ -70,7 +94,7 @@ make_hpos_str(unsigned int x_draw_limit)
         while ( screen_counter < x_draw_limit - (unsigned int)num_len){
                 snprintf(buf, 16, "%u", residue_counter);
                 strncpy(s + screen_counter, buf, num_len); 
-                residue_counter += 20;
+                residue_counter += 20 * scale;
                 screen_counter += 10;
                 num_len = (size_t) floor(log10((double) residue_counter)) + 1; 
         }
@@ -87,12 +111,13 @@ make_hpos_str(unsigned int x_draw_limit)
  * @x_draw_limit: maximum number of rows to be printed in unicode
  *      representation of contact map. (We display 4 points per character in 
  *      the x direction)
+ * @scale: residues per point, i.e. the zoom level's block size
  *
  * Allocates and returns a null-terminated string of length @y_draw_limit + 1
  * which should be freed manually if necessary.
  */
 char *
-make_vpos_str(unsigned int y_draw_limit)
+make_vpos_str(unsigned int y_draw_limit, unsigned int scale)
 {
         char *s = NULL;
         char buf[16];
@@ -111,7 +136,7 @@ make_vpos_str(unsigned int y_draw_limit)
         while ( screen_counter < y_draw_limit - (unsigned int)num_len){
                 snprintf(buf, 16, "%u", residue_counter);
                 strncpy(s + screen_counter, buf, num_len); 
-                residue_counter += 20;
+                residue_counter += 20 * scale;
                 screen_counter += 5;
                 num_len = (size_t) floor(log10( (double) residue_counter)) + 1; 
         }
@@ -119,6 +144,64 @@ make_vpos_str(unsigned int y_draw_limit)
         return s;
 }
 
+/**
+ * draw_hpos_pad: create a curses pad holding the horizontal position bar
+ *
+ * @x_draw_limit: number of columns in the unicode representation of the map
+ * @scale:        residues per point, i.e. the zoom level's block size
+ *
+ * Allocates and returns a WINDOW, which should be freed manually, or NULL
+ * on error.
+ */
+WINDOW *
+draw_hpos_pad(unsigned int x_draw_limit, unsigned int scale)
+{
+        WINDOW *hpos = NULL;
+        char *s = NULL;
+
+        s = make_hpos_str(x_draw_limit, scale);
+        if(s == NULL) return NULL;
+        hpos = newpad(1, x_draw_limit);
+        if(hpos == NULL){
+                free(s);
+                return NULL;
+        }
+        if(g_has_colours) wattron(hpos, COLOR_PAIR(5));
+        waddnstr(hpos, s, x_draw_limit);
+        free(s);
+        return hpos;
+}
+
+/**
+ * draw_vpos_pad: create a curses pad holding the vertical position bar
+ *
+ * @y_draw_limit: number of rows in the unicode representation of the map
+ * @scale:        residues per point, i.e. the zoom level's block size
+ *
+ * Allocates and returns a WINDOW, which should be freed manually, or NULL
+ * on error.
+ */
+WINDOW *
+draw_vpos_pad(unsigned int y_draw_limit, unsigned int scale)
+{
+        WINDOW *vpos = NULL;
+        char *s = NULL;
+        unsigned int j;
+
+        s = make_vpos_str(y_draw_limit, scale);
+        if(s == NULL) return NULL;
+        vpos = newpad(y_draw_limit, 1);
+        if(vpos == NULL){
+                free(s);
+                return NULL;
+        }
+        if(g_has_colours) wattron(vpos, COLOR_PAIR(5));
+        for(j = 0; j < y_draw_limit; j++)
+            waddch(vpos, s[j]);
+        free(s);
+        return vpos;
+}
+
 /**
  * init_curses: initialise curses environment
  */
@@ -134,12 +217,18 @@ init_curses(void)
                  * Pair 2: status bar
                  * Pairs 3,4: contact map
                  * Pair 5: position counter bars
+                 * Pairs 6,7 and 8,9: medium and high contact density when
+                 * zoomed out, on the light and dark checkerboard squares
                  */
                 init_pair(1, COLOR_WHITE, COLOR_BLACK);
                 init_pair(2, COLOR_YELLOW, COLOR_BLACK);
                 init_pair(3, COLOR_WHITE, COLOR_BLUE);
                 init_pair(4, COLOR_WHITE, COLOR_BLACK);
                 init_pair(5, COLOR_WHITE, COLOR_BLACK);
+                init_pair(6, COLOR_YELLOW, COLOR_BLUE);
+                init_pair(7, COLOR_RED, COLOR_BLUE);
+                init_pair(8, COLOR_YELLOW, COLOR_BLACK);
+                init_pair(9, COLOR_RED, COLOR_BLACK);
         }
         if(can_change_color() == true){
                 def_colours();
@@ -148,6 +237,10 @@ init_curses(void)
                 init_pair(3, COLOR_WHITE, 11);
                 init_pair(4, COLOR_WHITE, 12);
                 init_pair(5, COLOR_WHITE, 13);
+                init_pair(6, 10, 11);
+                init_pair(7, 14, 11);
+                init_pair(8, 10, 12);
+                init_pair(9, 14, 12);
         }
         keypad(stdscr, true);
         curs_set(0);
@@ -168,6 +261,7 @@ def_colours(void)
         init_color(10, 945, 769, 59);  // "sun flower"
         init_color(11, 204, 286, 369); // "wet asphalt"
         init_color(12, 173, 243, 314); // "midnight blue"
+        init_color(14, 906, 298, 235); // "alizarin"
 }
 
 /**
@@ -191,152 +285,306 @@ draw_bg(WINDOW * scr, unsigned int cols, unsigned int rows){
         }
 }
 
+/*
+ * Offsets from U+2800 of the braille glyph for each 4x2 block of contacts.
+ * The table is indexed by the block's bits packed two per row, top row
+ * first, with the left column in the lower bit of each pair.
+ */
+static wchar_t braille_lut[256];
+
+/**
+ * init_braille_lut: fill braille_lut[] with the braille dot numbering
+ *
+ * Dots 1-3 and 7 run down the left column, dots 4-6 and 8 down the right.
+ */
+static void
+init_braille_lut(void)
+{
+        static const wchar_t dot[4][2] = {
+                {0x01, 0x08},
+                {0x02, 0x10},
+                {0x04, 0x20},
+                {0x40, 0x80}
+        };
+        int idx, r;
+        for(idx = 0; idx < 256; idx++){
+                braille_lut[idx] = 0x2800;
+                for(r = 0; r < 4; r++){
+                        if(idx & (1 << (2 * r)))
+                                braille_lut[idx] += dot[r][0];
+                        if(idx & (2 << (2 * r)))
+                                braille_lut[idx] += dot[r][1];
+                }
+        }
+}
+
 /**
- * draw_contacts_pad: create a curses pad containing the unicode "picture" of 
- * the contact map.
+ * draw_contacts_view: draw the visible part of the contact map
  *
- * @dist: distance matrix used to calculate contacts
+ * @view:      window covering the map area of the screen
+ * @tc:        tile cache to draw from
+ * @y_offset:  map cell shown in the top row of @view
+ * @x_offset:  map cell shown in the leftmost column of @view
  * @threshold: threshold for defining a contact (Angstroms)
  *
- * Allocates and returns a pointer to a WINDOW, which should be freed manually.
- *
  * Draws the contact map using the unicode braille character set 
- * (U+2800 to U+28FF)
+ * (U+2800 to U+28FF). Only the cells inside @view are drawn, taking each
+ * from its tile; parts of @view past the end of the map are left blank.
+ * Characters are written in runs that end at the edges of the 10-column
+ * squares of the checkerboard background.
  */
-WINDOW *
-draw_contacts_pad(struct distmat dist, double threshold)
+void
+draw_contacts_view(WINDOW *view, struct tile_cache *tc, int y_offset,
+                int x_offset, double threshold)
 {
+        int i, j, k; // track coordinates in the view
+        int x, y;
+        int nrow, ncol;
+        int run;
+        wchar_t s[11];
+        const struct tile *t;
+        const unsigned char *pattern;
+        int tcol;
 
-        int i, j; // track coordinates in the pad
-        int prot_y, prot_x; // track coordinates in terms of the protein chain
-        int x_draw_limit;
-        int y_draw_limit;
-        wchar_t ch = ' ';
-        wchar_t s[2] = L" ";
-        WINDOW *contacts = NULL;
-        int nres;
-
-        nres = dist.nres;
-        x_draw_limit = nres % 2 == 0 ? nres/2 : nres/2 + 1;
-        y_draw_limit = nres % 4 == 0 ? nres/4 : nres/4 + 1;
-        contacts = newpad(y_draw_limit, x_draw_limit);
-        if(contacts == NULL){
-                return NULL;
-        }
+        if(braille_lut[0] == 0) init_braille_lut();
+        if(y_offset < 0) y_offset = 0;
+        if(x_offset < 0) x_offset = 0;
 
-        for(j = 0, prot_y = 0; j < nres/4; j++, prot_y += 4){
-                for (i=0, prot_x=0; i < nres/2; i++, prot_x+=2)
-                {
+        getmaxyx(view, nrow, ncol);
+        werase(view);
+        for(j = 0; j < nrow && y_offset + j < tc->rows; j++){
+                y = y_offset + j;
+                wmove(view, j, 0);
+                t = NULL;
+                tcol = -1;
+                for(i = 0; i < ncol && x_offset + i < tc->cols; i += run){
+                        x = x_offset + i;
+                        run = 10 - x % 10;
+                        if(run > ncol - i) run = ncol - i;
+                        if(run > tc->cols - x) run = tc->cols - x;
                         if(g_has_colours){
-                                if(CHECKB_LIGHT(j,i))
-                                        wattron(contacts, COLOR_PAIR(3));
-                                else wattron(contacts, COLOR_PAIR(4));
+                                if(CHECKB_LIGHT(y,x))
+                                        wattron(view, COLOR_PAIR(3));
+                                else wattron(view, COLOR_PAIR(4));
                         }
-                        ch = 0x2800;
-                        if(getdist(dist, prot_y, prot_x) <= threshold)
-                                ch+=0x01;
-                        if(getdist(dist, prot_y + 1, prot_x) <= threshold)
-                                ch+=0x02;
-                        if(getdist(dist, prot_y + 2, prot_x) <= threshold)
-                                ch+=0x04;
-                        if(getdist(dist, prot_y + 3, prot_x) <= threshold)
-                                ch+=0x40;
-                        if(getdist(dist, prot_y, prot_x + 1) <= threshold)
-                                ch+=0x08;
-                        if(getdist(dist, prot_y + 1, prot_x + 1) <= threshold)
-                                ch+=0x10;
-                        if(getdist(dist, prot_y + 2, prot_x + 1) <= threshold)
-                                ch+=0x20;
-                        if(getdist(dist, prot_y + 3, prot_x + 1) <= threshold)
-                                ch+=0x80;
-                        s[0] = ch; 
-                        waddwstr(contacts, s);
-                }
-                /* Special case for printing final column */
-                if(i < x_draw_limit){
-                        if(g_has_colours){
-                                if(CHECKB_LIGHT(j,i))
-                                        wattron(contacts, COLOR_PAIR(3));
-                                else wattron(contacts, COLOR_PAIR(4));
+                        /* Runs never cross a tile edge, as TILE_COLS is a
+                         * multiple of 10, so each tile is looked up once
+                         * per row */
+                        if(t == NULL || x / TILE_COLS != tcol){
+                                tcol = x / TILE_COLS;
+                                t = get_tile(tc, y / TILE_ROWS, tcol,
+                                                threshold);
                         }
+                        pattern = t->pattern + y % TILE_ROWS * TILE_COLS
+                                + x % TILE_COLS;
+                        for(k = 0; k < run; k++)
+                                s[k] = braille_lut[pattern[k]];
+                        s[run] = L'\0';
+                        waddnwstr(view, s, run);
+                }
+        }
+}
 
-                        ch = 0x2800;
-                        if( getdist(dist, prot_y, prot_x) <= threshold) 
-                                ch+=0x01;
-                        if( getdist(dist, prot_y + 1, prot_x) <= threshold)
-                                ch+=0x02;
-                        if( getdist(dist, prot_y + 2, prot_x) <= threshold)
-                                ch+=0x04;
-                        if( getdist(dist, prot_y + 3, prot_x) <= threshold)
-                                ch+=0x40;
-                        s[0] = ch; 
-                        waddwstr(contacts, s);
-                }
-                mvwaddnstr(contacts, j + 1, 0, "", 0);
-        }
-        /* Special case for last row */
-        if(j < y_draw_limit){
-                for (i = 0, prot_x = 0; i < nres / 2; i++, prot_x += 2)
-                {
-                        if(g_has_colours){
-                                if(CHECKB_LIGHT(j, i))
-                                        wattron(contacts, COLOR_PAIR(3));
-                                else wattron(contacts, COLOR_PAIR(4));
-                        }
+/**
+ * draw_chain_bounds: mark where chains meet in a map of a whole complex
+ *
+ * @view:     window covering the map area of the screen, already drawn
+ * @tab:      the chains, in the order they were joined
+ * @y_offset: map cell shown in the top row of @view
+ * @x_offset: map cell shown in the leftmost column of @view
+ * @scale:    residues per dot, i.e. the zoom level's block size
+ *
+ * The row and the column of characters holding the first residue of each
+ * chain after the first are shown in reverse video. Only attributes are
+ * changed, so the contacts drawn in those characters stay visible.
+ */
+void
+draw_chain_bounds(WINDOW *view, const struct chain_table *tab, int y_offset,
+                int x_offset, int scale)
+{
+        int nrow, ncol, rows, cols;
+        int first, nres, k, r, c, row, col;
 
-                        ch = 0x2800;
-                        /* falling through on purpose here */
-                        switch(nres - (4 * j)){
-                        case 3:
-                                if( getdist(dist, prot_y + 2, prot_x) <= threshold)
-                                        ch+=0x04;
-                                if( getdist(dist, prot_y + 2, prot_x + 1) <= threshold)
-                                        ch+=0x20;
-                        case 2: 
-                                if( getdist(dist, prot_y + 1, prot_x) <= threshold)
-                                        ch+=0x02;
-                                if(getdist(dist, prot_y + 1, prot_x + 1) <= threshold)
-                                        ch+=0x10;
-                        default:
-                        case 1:
-                                if( getdist(dist, prot_y, prot_x)
-                                                <= threshold)
-                                        ch+=0x01;
-                                if(getdist(dist, prot_y, prot_x + 1) <= threshold)
-                                        ch+=0x08;
-                                break;
-                        }
-                        s[0] = ch; 
-                        waddwstr(contacts, s);
-                }
-                /* Special special case for printing final LR corner */
-                if(i < x_draw_limit){
+        getmaxyx(view, nrow, ncol);
+        for(k = 0, nres = 0; k < tab->nchains; k++)
+                nres += tab->chains[k]->nres;
+        rows = (nres + 4 * scale - 1) / (4 * scale) - y_offset;
+        cols = (nres + 2 * scale - 1) / (2 * scale) - x_offset;
+        if(rows > nrow) rows = nrow;
+        if(cols > ncol) cols = ncol;
+        for(k = 1, first = 0; k < tab->nchains; k++){
+                first += tab->chains[k - 1]->nres;
+                row = first / (4 * scale) - y_offset;
+                col = first / (2 * scale) - x_offset;
+                for(r = 0; col >= 0 && col < cols && r < rows; r++)
+                        mvwchgat(view, r, col, 1, A_REVERSE,
+                                        PAIR_NUMBER(mvwinch(view, r, col)
+                                                & A_COLOR), NULL);
+                for(c = 0; row >= 0 && row < rows && c < cols; c++)
+                        mvwchgat(view, row, c, 1, A_REVERSE,
+                                        PAIR_NUMBER(mvwinch(view, row, c)
+                                                & A_COLOR), NULL);
+        }
+}
+
+/**
+ * density_pair: colour pair for a zoomed-out character
+ *
+ * @light:   true if the character is on a light square of the checkerboard
+ * @count:   number of contacts among the residue pairs the character covers
+ * @area:    number of residue pairs the character covers
+ *
+ * Characters where at least a quarter of the pairs are in contact are
+ * drawn in the high density colour, and those where at least one in
+ * sixteen is in the medium density colour.
+ */
+static short
+density_pair(bool light, uint32_t count, size_t area)
+{
+        if(4 * (size_t) count >= area)
+                return light ? 7 : 9;
+        if(16 * (size_t) count >= area)
+                return light ? 6 : 8;
+        return light ? 3 : 4;
+}
+
+/**
+ * draw_zoomed_view: draw the visible part of a zoomed-out contact map
+ *
+ * @view:      window covering the map area of the screen
+ * @zl:        zoom level to draw
+ * @nres:      number of residues in the map
+ * @y_offset:  map cell shown in the top row of @view
+ * @x_offset:  map cell shown in the leftmost column of @view
+ *
+ * As draw_contacts_view(), but each dot of a braille character stands for
+ * a block of residue pairs and is lit if any of them are in contact. The
+ * colour of each character shows the density of contacts in the blocks it
+ * covers. Every count is a lookup in the zoom level's summed-area table.
+ */
+void
+draw_zoomed_view(WINDOW *view, const struct zoom_level *zl, int nres,
+                int y_offset, int x_offset)
+{
+        int i, j, r, c; // track coordinates in the view
+        int x, y;
+        int nrow, ncol;
+        int rows, cols;
+        unsigned int idx;
+        uint32_t count;
+        wchar_t s[2];
+
+        if(braille_lut[0] == 0) init_braille_lut();
+        if(y_offset < 0) y_offset = 0;
+        if(x_offset < 0) x_offset = 0;
+        rows = zl->blocks % 4 == 0 ? zl->blocks/4 : zl->blocks/4 + 1;
+        cols = zl->blocks % 2 == 0 ? zl->blocks/2 : zl->blocks/2 + 1;
+
+        getmaxyx(view, nrow, ncol);
+        werase(view);
+        s[1] = L'\0';
+        for(j = 0; j < nrow && y_offset + j < rows; j++){
+                y = y_offset + j;
+                wmove(view, j, 0);
+                for(i = 0; i < ncol && x_offset + i < cols; i++){
+                        x = x_offset + i;
+                        idx = 0;
+                        for(r = 0; r < 4; r++)
+                                for(c = 0; c < 2; c++)
+                                        if(zoom_count(zl, 4 * y + r, 2 * x + c,
+                                                        4 * y + r + 1,
+                                                        2 * x + c + 1) > 0)
+                                                idx |= 1 << (2 * r + c);
                         if(g_has_colours){
-                                if(CHECKB_LIGHT(j, i))
-                                        wattron(contacts, COLOR_PAIR(3));
-                                else wattron(contacts, COLOR_PAIR(4));
+                                count = zoom_count(zl, 4 * y, 2 * x,
+                                                4 * y + 4, 2 * x + 2);
+                                wattron(view, COLOR_PAIR(density_pair(
+                                                CHECKB_LIGHT(y,x), count,
+                                                zoom_area(zl, nres, 4 * y,
+                                                        2 * x, 4 * y + 4,
+                                                        2 * x + 2))));
                         }
+                        s[0] = braille_lut[idx];
+                        waddnwstr(view, s, 1);
+                }
+        }
+}
 
-                        ch = 0x2800;
-                        switch(nres - (4 * j)){
-                        case 3:
-                                if( getdist(dist, prot_y + 2, prot_x)
-                                                <= threshold)
-                                        ch+=0x04;
-                        case 2: 
-                                if( getdist(dist, prot_y + 1, prot_x)
-                                                <= threshold)
-                                        ch+=0x02;
-                        case 1:
-                                if( getdist(dist, prot_y, prot_x)
-                                                <= threshold)
-                                        ch+=0x01;
+/**
+ * freq_pair: colour pair for a character of an ensemble map
+ *
+ * @light: true if the character is on a light square of the checkerboard
+ * @freq:  highest contact frequency among the dots of the character
+ *
+ * Contacts present in at least three models in four are drawn in the high
+ * density colour, and those in at least one in four in the medium density
+ * colour.
+ */
+static short
+freq_pair(bool light, double freq)
+{
+        if(freq >= 0.75)
+                return light ? 7 : 9;
+        if(freq >= 0.25)
+                return light ? 6 : 8;
+        return light ? 3 : 4;
+}
+
+/**
+ * draw_ensemble_view: draw the visible part of an ensemble contact map
+ *
+ * @view:      window covering the map area of the screen
+ * @e:         ensemble statistics
+ * @y_offset:  map cell shown in the top row of @view
+ * @x_offset:  map cell shown in the leftmost column of @view
+ *
+ * As draw_contacts_view(), but a dot is lit if its residue pair is in
+ * contact in any model, and the colour of each character shows how often
+ * the most persistent of its contacts is present.
+ */
+void
+draw_ensemble_view(WINDOW *view, const struct ensemble *e, int y_offset,
+                int x_offset)
+{
+        int i, j, r, c; // track coordinates in the view
+        int x, y;
+        int nrow, ncol;
+        int rows, cols;
+        unsigned int idx;
+        double f, fmax;
+        wchar_t s[2];
+
+        if(braille_lut[0] == 0) init_braille_lut();
+        if(y_offset < 0) y_offset = 0;
+        if(x_offset < 0) x_offset = 0;
+        rows = (e->nres + 3) / 4;
+        cols = (e->nres + 1) / 2;
+
+        getmaxyx(view, nrow, ncol);
+        werase(view);
+        s[1] = L'\0';
+        for(j = 0; j < nrow && y_offset + j < rows; j++){
+                y = y_offset + j;
+                wmove(view, j, 0);
+                for(i = 0; i < ncol && x_offset + i < cols; i++){
+                        x = x_offset + i;
+                        idx = 0;
+                        fmax = 0;
+                        for(r = 0; r < 4 && 4 * y + r < e->nres; r++){
+                                for(c = 0; c < 2 && 2 * x + c < e->nres; c++){
+                                        f = ensemble_freq(e, 4 * y + r,
+                                                        2 * x + c);
+                                        if(f > 0) idx |= 1 << (2 * r + c);
+                                        if(f > fmax) fmax = f;
+                                }
                         }
-                        s[0] = ch; 
-                        waddwstr(contacts, s);
+                        if(g_has_colours)
+                                wattron(view, COLOR_PAIR(freq_pair(
+                                                CHECKB_LIGHT(y,x), fmax)));
+                        s[0] = braille_lut[idx];
+                        waddnwstr(view, s, 1);
                 }
         }
-        return contacts;
 }
 
 /**
@@ -345,14 +593,16 @@ draw_contacts_pad(struct distmat dist, double threshold)
  * information aligned to the left.
  *
  * @filename:  pointer to string containing name of input file
- * @chain:     chain being displayed
+ * @chain:     chain being displayed, or NULL for a whole complex
  * @nres:      number of residues in chain
  * @threshold: distance threshold used for contacts
+ * @scale:     residues per point of the map; shown if greater than 1
  *
  * Allocates and returns a WINDOW, which should be freed manually.
  */
 WINDOW *
-draw_status_pad(char *filename, char chain, int nres, double threshold)
+draw_status_pad(char *filename, const char *chain, int nres, double threshold,
+                int scale)
 {
         int i;
         WINDOW *status = NULL;
@@ -369,7 +619,10 @@ draw_status_pad(char *filename, char chain, int nres, double threshold)
         wattroff(status, A_REVERSE);
         wprintw(status, "\u2501");
         wattron(status, A_REVERSE);
-        wprintw(status, " Chain: %c ", chain);
+        if(chain == NULL)
+                wprintw(status, " Chain: all ");
+        else
+                wprintw(status, " Chain: %s ", chain);
         wattroff(status, A_REVERSE);
         wprintw(status, "\u2501");
         wattron(status, A_REVERSE);
@@ -379,61 +632,437 @@ draw_status_pad(char *filename, char chain, int nres, double threshold)
         wattron(status, A_REVERSE);
         wprintw(status, " Threshold: %2.2f ", threshold);
         wattroff(status, A_REVERSE);
+        if(scale > 1){
+                wprintw(status, "\u2501");
+                wattron(status, A_REVERSE);
+                wprintw(status, " Zoom: 1:%d ", scale);
+                wattroff(status, A_REVERSE);
+        }
         mvwaddstr(status, 0, 1024,  "");
         return status;
 }
 
+/* Output files asked for on the command line, and how to write them */
+struct output_opts{
+        char *ofname;
+        char *binname;
+        char *epsname;
+        char *rastername;
+        double threshold;
+        enum dm_precision precision;
+        bool auto_precision;
+        int raster_scale;
+        bool raster_distances;
+        int nthreads;
+        bool timing;
+};
+
+/**
+ * chain_file_name: add a chain identifier to an output file name
+ *
+ * @name:  file name, or NULL
+ * @chain: chain identifier
+ *
+ * Inserts "_" and the chain identifier before the extension of @name, if
+ * it has one, so "map.txt" becomes "map_A.txt". Characters of the
+ * identifier that aren't letters or digits are written as "_".
+ *
+ * Returns a newly allocated string, or NULL if @name is NULL or memory
+ * can't be allocated.
+ */
+static char *
+chain_file_name(const char *name, const char *chain)
+{
+        const char *base, *dot;
+        char *out, *p;
+        size_t stem, len;
+
+        if(name == NULL) return NULL;
+        base = strrchr(name, '/');
+        base = base == NULL ? name : base + 1;
+        dot = strrchr(base, '.');
+        stem = dot == NULL || dot == base ? strlen(name) : (size_t) (dot - name);
+        len = strlen(name) + strlen(chain) + 2;
+        out = malloc(len);
+        if(out == NULL) return NULL;
+        snprintf(out, len, "%.*s_%s%s", (int) stem, name, chain, name + stem);
+        for(p = out + stem + 1; p < out + stem + 1 + strlen(chain); p++)
+                if(!isalnum((unsigned char) *p)) *p = '_';
+        return out;
+}
+
+/**
+ * write_outputs: write the output files asked for, for one chain
+ *
+ * @cs:  coordinates of the chain
+ * @o:   output files and settings
+ * @dmp: if not NULL, set to the distance matrix of the chain (computed if
+ *       no output needed it), to be freed by the caller
+ *
+ * Returns 0 on success, or -1 after printing an error message.
+ */
+static int
+write_outputs(struct coords *cs, const struct output_opts *o,
+                struct distmat **dmp)
+{
+        FILE *ofp = NULL;
+        FILE *bfp = NULL;
+        FILE *rfp = NULL;
+        struct distmat *dist = NULL;
+        struct contacts *ct = NULL;
+        enum dm_precision precision = o->precision;
+        double threshold = o->threshold;
+        int nthreads = o->nthreads;
+        int nres = cs->nres;
+        struct timespec t_start, t_dist;
+
+        /*
+         * Write contacts to text and/or binary files (optional)
+         *
+         * Contacts are found with a cell list straight from the coordinates,
+         * without the full distance matrix. Thresholds beyond DIST_MISSING
+         * would make residues without coordinates count as contacts, so in
+         * that (silly) case the list is written from the matrix instead, as
+         * it is for all-atom distances, which the cell list doesn't measure.
+         */
+
+        if(o->ofname != NULL){
+                ofp = fopen(o->ofname, "w");
+                if(ofp == NULL){
+                        fprintf(stderr, "FATAL: couldn't open output file [%s]\n", o->ofname);
+                        goto wo_error;
+                }
+        }
+        if(o->binname != NULL){
+                bfp = fopen(o->binname, "wb");
+                if(bfp == NULL){
+                        fprintf(stderr, "FATAL: couldn't open output file [%s]\n", o->binname);
+                        goto wo_error;
+                }
+        }
+        if((ofp != NULL || bfp != NULL) && threshold <= DIST_MISSING
+                        && cs->atoms == NULL){
+                clock_gettime(CLOCK_MONOTONIC, &t_start);
+                ct = find_contacts(*cs, threshold);
+                if (ct == NULL) goto wo_nomem;
+                if(write_contact_list(ofp, *ct, nthreads) != 0
+                                || write_contacts_binary(bfp, *ct) != 0)
+                        goto wo_nomem;
+                clock_gettime(CLOCK_MONOTONIC, &t_dist);
+                if(o->timing)
+                        fprintf(stderr, "Found %zu contacts in %.3f s.\n",
+                                        ct->ncontacts,
+                                        elapsed(t_start, t_dist));
+                freecontacts(ct);
+                ct = NULL;
+                if(ofp != NULL){
+                        printf("Wrote contacts to file [%s].\n", o->ofname);
+                        fclose(ofp);
+                        ofp = NULL;
+                }
+                if(bfp != NULL){
+                        printf("Wrote binary contacts to file [%s].\n", o->binname);
+                        fclose(bfp);
+                        bfp = NULL;
+                }
+        }
+
+        /*
+         * Write PGM image (optional), also straight from the coordinates
+         */
+
+        if(o->rastername != NULL){
+                rfp = fopen(o->rastername, "wb");
+                if(rfp == NULL){
+                        fprintf(stderr, "FATAL: couldn't open output file [%s]\n", o->rastername);
+                        goto wo_error;
+                }
+                clock_gettime(CLOCK_MONOTONIC, &t_start);
+                if(write_pgm(rfp, *cs, threshold, o->raster_scale,
+                                        o->raster_distances, nthreads) != 0)
+                        goto wo_nomem;
+                clock_gettime(CLOCK_MONOTONIC, &t_dist);
+                if(o->timing)
+                        fprintf(stderr, "Wrote image in %.3f s.\n",
+                                        elapsed(t_start, t_dist));
+                printf("Wrote image to file [%s].\n", o->rastername);
+                fclose(rfp);
+                rfp = NULL;
+        }
+
+        if(ofp != NULL || bfp != NULL || o->epsname != NULL || dmp != NULL){
+                precision = dm_auto_precision(precision, o->auto_precision,
+                                nres, threshold);
+                clock_gettime(CLOCK_MONOTONIC, &t_start);
+                dist = calculate_distmat(*cs, precision, nthreads);
+                if (dist == NULL) goto wo_nomem;
+                clock_gettime(CLOCK_MONOTONIC, &t_dist);
+                if(o->timing)
+                        fprintf(stderr, "Distance matrix for %d residues in %.3f s "
+                                        "(%s kernel, %s storage, %d threads).\n", nres,
+                                        elapsed(t_start, t_dist), dist_kernel_name(),
+                                        precision == DM_UINT8 ? "uint8" :
+                                        precision == DM_FLOAT ? "float" : "double",
+                                        nthreads);
+        }
+
+        if(ofp != NULL){
+                if(write_contacts(ofp, *dist, threshold, nthreads) != 0)
+                        goto wo_nomem;
+                printf("Wrote contacts to file [%s].\n", o->ofname);
+                fclose(ofp);
+                ofp = NULL;
+        }
+        if(bfp != NULL){
+                ct = distmat_contacts(*dist, threshold);
+                if(ct == NULL || write_contacts_binary(bfp, *ct) != 0)
+                        goto wo_nomem;
+                freecontacts(ct);
+                ct = NULL;
+                printf("Wrote binary contacts to file [%s].\n", o->binname);
+                fclose(bfp);
+                bfp = NULL;
+        }
+
+        /*
+         * Write EPS file (optional)
+         */
+
+        if(o->epsname != NULL){
+                ofp = fopen(o->epsname, "w");
+                if(ofp == NULL){
+                        fprintf(stderr, "FATAL: couldn't open output file [%s]\n", o->epsname);
+                        goto wo_error;
+                }
+                if(write_eps(ofp, *dist, threshold) != 0)
+                        goto wo_nomem;
+                printf("Wrote postscript to file [%s].\n", o->epsname);
+                fclose(ofp);
+                ofp = NULL;
+        }
+
+        if(dmp != NULL)
+                *dmp = dist;
+        else if(dist != NULL)
+                freedm(dist);
+        return 0;
+
+        wo_nomem:
+        fprintf(stderr, "FATAL: couldn't allocate memory.\n");
+        wo_error:
+        if(ofp != NULL) fclose(ofp);
+        if(bfp != NULL) fclose(bfp);
+        if(rfp != NULL) fclose(rfp);
+        if(ct != NULL) freecontacts(ct);
+        if(dist != NULL) freedm(dist);
+        return -1;
+}
+
+/**
+ * view_distmat: compute the distance matrix shown by the viewer
+ *
+ * @cs:             coordinates of the chain shown
+ * @precision:      storage for the distances
+ * @auto_precision: if true, long chains may be stored as DM_UINT8 instead;
+ *                  see dm_auto_precision()
+ * @threshold:      current distance threshold
+ * @nthreads:       number of threads to compute the matrix with
+ * @dist, @tc, @zp: the matrix and the tiles and zoom levels drawn from
+ *                  it; any old ones are freed first
+ *
+ * All-atom distances are made exact up to a little beyond @threshold, if
+ * they weren't already.
+ *
+ * Returns 0 on success, -1 if memory can't be allocated.
+ */
+static int
+view_distmat(struct coords *cs, enum dm_precision precision,
+                bool auto_precision, double threshold, int nthreads,
+                struct distmat **dist, struct tile_cache **tc,
+                struct zoom_pyramid **zp)
+{
+        freetilecache(*tc);
+        freezoompyramid(*zp);
+        if(*dist != NULL) freedm(*dist);
+        *tc = NULL;
+        *zp = NULL;
+        if(cs->atoms != NULL && cs->atoms->cutoff < threshold)
+                set_atom_cutoff(cs, threshold + ATOM_CUTOFF_SLACK);
+        precision = dm_auto_precision(precision, auto_precision, cs->nres,
+                        threshold);
+        *dist = calculate_distmat(*cs, precision, nthreads);
+        if(*dist == NULL) return -1;
+        *tc = make_tile_cache(**dist, TILE_CACHE_SIZE);
+        *zp = make_zoom_pyramid(**dist);
+        return *tc == NULL || *zp == NULL ? -1 : 0;
+}
+
+/**
+ * parse_frames: parse a range of trajectory frames
+ *
+ * @arg: "FIRST:LAST" or "FIRST:LAST:STRIDE"; any field may be left empty
+ *       for its default of the first frame, the last frame, or 1
+ * @fr:  set to the range
+ *
+ * Returns 0 on success, -1 if @arg isn't a valid range.
+ */
+static int
+parse_frames(const char *arg, struct frame_range *fr)
+{
+        long v[3] = {1, 0, 1};
+        char *end;
+        int k;
+
+        for(k = 0; k < 3; k++){
+                if(*arg != ':' && *arg != '\0'){
+                        v[k] = strtol(arg, &end, 10);
+                        if(end == arg || v[k] < 1 || v[k] > INT_MAX) return -1;
+                        arg = end;
+                }
+                if(*arg == '\0') break;
+                if(*arg++ != ':' || k == 2) return -1;
+        }
+        if(k == 0 || (v[1] != 0 && v[1] < v[0])) return -1;
+        fr->first = v[0];
+        fr->last = v[1];
+        fr->stride = v[2];
+        return 0;
+}
+
 int
 main(int argc, char **argv)
 {	
         setlocale(LC_CTYPE, "");
-        int j;
         char *filename = NULL;
         char *ofname = NULL;
         char *epsname = NULL;
-        FILE *ofp;
+        char *binname = NULL;
+        char *rastername = NULL;
+        char *ifname = NULL;
+        char *trajname = NULL;
+        char *countsname = NULL;
+        struct frame_range frames = {1, 0, 1};
+        bool frames_set = false;
         struct distmat * dist = NULL; 
         double threshold = 8;
         char chain = 'A';
+        char *chain_id = "A";
+        const char *shown;
         int nres = 0; 
+        struct chain_table *tab = NULL;
         struct coords *cs = NULL;
+        struct coords *whole = NULL;
+        struct ensemble *ens = NULL;
+        struct output_opts oo, co;
+        bool all_chains = false;
+        int current = -1, k;
+        bool view = true;
         int nrow, ncol;
-        char usage_str[1024];
+        char usage_str[4096];
+        bool timing = false;
+        bool batch = false;
+        bool models = false;
+        bool all_atom = false;
+        bool raster_distances = false;
+        int raster_scale = 1;
+        enum dm_precision precision = DM_DOUBLE;
+        bool auto_precision = true;
+        int nthreads = default_threads();
+        struct timespec t_start, t_parsed, t_dist;
+        int ret;
 
-        snprintf(usage_str, 1024, "cmap version %s\n"
+        snprintf(usage_str, sizeof(usage_str), "cmap version %s\n"
                         "View protein contact maps.\n\n"
                         "Usage:\n"
                         "  cmap [options] <FILE>\n"
+                        "  cmap --batch [options] <FILE|DIR>...\n"
+                        "  cmap -x <DCD> [options] <FILE>\n"
+                        "  (use - as FILE to read from standard input)\n"
                         "\nInput options:\n"
-                        "  -c, --chain=CHAR     chain from which to read coordinates\n"
+                        "  -c, --chain=ID       chain from which to read coordinates; mmCIF chain\n"
+                        "                       IDs may be several characters long\n"
+                        "  -A, --all-atom       measure the shortest distance between the heavy\n"
+                        "                       atoms of two residues, not their alpha carbons\n"
+                        "  -a, --all-chains     write output files for every chain, adding the\n"
+                        "                       chain to each file name (map.txt -> map_A.txt)\n"
+                        "  -m, --models         read every MODEL of the chain and show how often\n"
+                        "                       each contact occurs; -o lists contact frequencies\n"
+                        "                       and mean distances, -r shades by frequency\n"
+                        "  -x, --trajectory=DCD read frames from a DCD trajectory, with FILE as its\n"
+                        "                       topology; output and viewer are as for -m\n"
+                        "  -F, --frames=FIRST:LAST[:STRIDE]\n"
+                        "                       frames of the trajectory to read, from 1\n"
                         "  -t, --threshold=NUM  distance threshold for contact (Angstroms)\n"
+                        "  -p, --precision=TYPE store distances as double, float (half memory) or\n"
+                        "                       uint8 (1/8 memory, %.1f A steps); default: double,\n"
+                        "                       or uint8 for chains of %d residues or more (in\n"
+                        "                       output files, only if -t is a multiple of %.1f\n"
+                        "                       up to %.1f)\n"
+                        "  -f, --float          same as --precision=float\n"
+                        "  -j, --threads=NUM    number of threads (default: one per CPU)\n"
+                        "  -C, --cache          keep parsed coordinates in FILE.cmapcache and read\n"
+                        "                       them from there while FILE is unchanged\n"
                         "\nOutput options:\n"
                         "  -h, --help           show this message\n"
                         "  -o, --output=FILE    save list of contacts to text file\n"
+                        "  -b, --binary=FILE    save list of contacts in compact binary form\n"
+                        "  -k, --frame-counts=FILE\n"
+                        "                       with -m or -x, save the number of contacts in\n"
+                        "                       each model or frame\n"
+                        "  -I, --interfaces=FILE\n"
+                        "                       save contacts between every pair of chains\n"
                         "  -e, --eps=FILE       save EPS image of contact map (experimental)\n"
-                        "\n", PACKAGE_VERSION); 
+                        "  -r, --raster=FILE    save PGM image of contact map, streamed to disk\n"
+                        "  -s, --scale=NUM      residues per pixel in the PGM image (default: 1)\n"
+                        "  -d, --distances      shade the PGM image by distance, not contacts\n"
+                        "  -n, --no-view        write output files and exit without the viewer\n"
+                        "  -T, --timing         report parse and distance matrix timings\n"
+                        "  -B, --batch          process many files, or every file under a directory,\n"
+                        "                       in parallel without the viewer; -o, -b, -e and -r\n"
+                        "                       name directories for one output per input file\n"
+                        "\n", PACKAGE_VERSION, DM_QUANT_STEP, DM_QUANT_AUTO,
+                        DM_QUANT_STEP, DM_QUANT_MAX); 
 
         /*
          * Parse command line arguments
          */
         static struct option long_options[] =
         {
+                {"all-atom", no_argument, 0, 'A'},
+                {"all-chains", no_argument, 0, 'a'},
+                {"batch", no_argument, 0, 'B'},
+                {"binary", required_argument, 0, 'b'},
+                {"cache", no_argument, 0, 'C'},
                 {"chain", required_argument, 0, 'c'},
+                {"distances", no_argument, 0, 'd'},
                 {"eps", required_argument, 0, 'e'},
+                {"float", no_argument, 0, 'f'},
+                {"frame-counts", required_argument, 0, 'k'},
+                {"frames", required_argument, 0, 'F'},
                 {"help", no_argument, 0, 'h'},
+                {"interfaces", required_argument, 0, 'I'},
+                {"models", no_argument, 0, 'm'},
+                {"no-view", no_argument, 0, 'n'},
                 {"output", required_argument, 0, 'o'},
+                {"precision", required_argument, 0, 'p'},
+                {"raster", required_argument, 0, 'r'},
+                {"scale", required_argument, 0, 's'},
+                {"threads", required_argument, 0, 'j'},
                 {"threshold", required_argument, 0, 't'},
+                {"timing", no_argument, 0, 'T'},
+                {"trajectory", required_argument, 0, 'x'},
                 {0, 0, 0, 0}
         };
 
         int option_index = 0;
         int opt;
         while(1){
-                opt = getopt_long(argc, argv, "c:e:ho:t:", long_options, &option_index);
+                opt = getopt_long(argc, argv, "aAb:BCc:de:fF:hI:j:k:mno:p:r:s:t:Tx:", long_options, &option_index);
                 if(opt == -1)
                         break;
                 if (opt == 'c'){
                         chain = optarg[0];
+                        chain_id = optarg;
                 }
                 if (opt == 't'){
                         threshold = atof(optarg);
@@ -448,6 +1077,87 @@ main(int argc, char **argv)
                 if(opt == 'e'){
                         epsname = optarg;
                 }
+                if(opt == 'b'){
+                        binname = optarg;
+                }
+                if(opt == 'r'){
+                        rastername = optarg;
+                }
+                if(opt == 's'){
+                        raster_scale = atoi(optarg);
+                        if(raster_scale < 1){
+                                fprintf(stderr, "%s", usage_str);
+                                fprintf(stderr, "FATAL: invalid scale [%s].\n", optarg);
+                                return 1;
+                        }
+                }
+                if(opt == 'd'){
+                        raster_distances = true;
+                }
+                if(opt == 'f'){
+                        precision = DM_FLOAT;
+                        auto_precision = false;
+                }
+                if(opt == 'p'){
+                        if(strcmp(optarg, "double") == 0)
+                                precision = DM_DOUBLE;
+                        else if(strcmp(optarg, "float") == 0)
+                                precision = DM_FLOAT;
+                        else if(strcmp(optarg, "uint8") == 0)
+                                precision = DM_UINT8;
+                        else {
+                                fprintf(stderr, "%s", usage_str);
+                                fprintf(stderr, "FATAL: unknown precision [%s].\n", optarg);
+                                return 1;
+                        }
+                        auto_precision = false;
+                }
+                if(opt == 'j'){
+                        nthreads = atoi(optarg);
+                        if(nthreads < 1){
+                                fprintf(stderr, "%s", usage_str);
+                                fprintf(stderr, "FATAL: invalid number of threads [%s].\n", optarg);
+                                return 1;
+                        }
+                }
+                if(opt == 'n'){
+                        view = false;
+                }
+                if(opt == 'T'){
+                        timing = true;
+                }
+                if(opt == 'B'){
+                        batch = true;
+                }
+                if(opt == 'C'){
+                        use_cache(1);
+                }
+                if(opt == 'a'){
+                        all_chains = true;
+                }
+                if(opt == 'A'){
+                        all_atom = true;
+                }
+                if(opt == 'I'){
+                        ifname = optarg;
+                }
+                if(opt == 'm'){
+                        models = true;
+                }
+                if(opt == 'x'){
+                        trajname = optarg;
+                }
+                if(opt == 'k'){
+                        countsname = optarg;
+                }
+                if(opt == 'F'){
+                        if(parse_frames(optarg, &frames) != 0){
+                                fprintf(stderr, "%s", usage_str);
+                                fprintf(stderr, "FATAL: invalid frame range [%s].\n", optarg);
+                                return 1;
+                        }
+                        frames_set = true;
+                }
         }
         if( argc < 2){
                 fprintf(stderr, "%s", usage_str);
@@ -464,60 +1174,250 @@ main(int argc, char **argv)
         }
 
 
-        /*
-         * Read PDB coords and calculate distances
-         */
-        cs = getcoords( filename, chain);
-        if (cs == NULL){
-                fprintf(stderr, "FATAL: couldn't read coordinates from file [%s].\nTried to read chain [%c].\n", filename, chain);
+        if((models || trajname != NULL) && (batch || all_chains
+                                || binname != NULL || epsname != NULL
+                                || ifname != NULL)){
+                fprintf(stderr, "%s", usage_str);
+                fprintf(stderr, "FATAL: -m and -x can't be used with -a, -b, -e, -I or --batch.\n");
                 return 1;
         }
-        nres = cs->nres;
-        dist = calculate_distmat(*cs);
-        if (dist == NULL){
-                fprintf(stderr, "FATAL: couldn't allocate memory.\n");
+        /* Models and trajectories are read from PDB files, whose chain
+         * identifiers are one character long */
+        if((models || trajname != NULL) && strlen(chain_id) != 1){
+                fprintf(stderr, "%s", usage_str);
+                fprintf(stderr, "FATAL: -m and -x need a one-character chain identifier, not [%s].\n", chain_id);
+                return 1;
+        }
+        if((frames_set && trajname == NULL) || (countsname != NULL
+                                && !models && trajname == NULL)){
+                fprintf(stderr, "%s", usage_str);
+                fprintf(stderr, "FATAL: -F needs -x, and -k needs -m or -x.\n");
                 return 1;
         }
-        freecoords(cs);
-        cs = NULL;
+        if(all_atom && (models || trajname != NULL || ifname != NULL)){
+                fprintf(stderr, "%s", usage_str);
+                fprintf(stderr, "FATAL: -A can't be used with -m, -x or -I.\n");
+                return 1;
+        }
+        use_all_atoms(all_atom);
 
         /*
-         * Write contacts to file (optional)
+         * Batch mode: write outputs for every input file and exit
          */
+        if(batch){
+                struct batch_options bo;
+                int nfailed;
 
-        if(ofname != NULL){
-                ofp = fopen(ofname, "w");
-                if(ofp == NULL){
+                if(ifname != NULL){
                         fprintf(stderr, "%s", usage_str);
-                        fprintf(stderr, "FATAL: couldn't open output file [%s]\n", ofname);
+                        fprintf(stderr, "FATAL: -I can't be used in batch mode.\n");
                         return 1;
                 }
-                write_contacts(ofp, *dist, threshold);
-                printf("Wrote contacts to file [%s].\n", ofname);
-                fclose(ofp);
-                ofp = NULL;
+                if(ofname == NULL && binname == NULL && epsname == NULL
+                                && rastername == NULL){
+                        fprintf(stderr, "%s", usage_str);
+                        fprintf(stderr, "FATAL: batch mode needs at least one of -o, -b, -e or -r.\n");
+                        return 1;
+                }
+                bo.contacts_dir = ofname;
+                bo.binary_dir = binname;
+                bo.eps_dir = epsname;
+                bo.raster_dir = rastername;
+                bo.threshold = threshold;
+                bo.precision = precision;
+                bo.auto_precision = auto_precision;
+                bo.raster_scale = raster_scale;
+                bo.raster_distances = raster_distances;
+                bo.chain = chain_id;
+                bo.all_chains = all_chains;
+                clock_gettime(CLOCK_MONOTONIC, &t_start);
+                nfailed = run_batch(bo, argv + optind, argc - optind, nthreads);
+                if(nfailed < 0){
+                        fprintf(stderr, "FATAL: couldn't allocate memory.\n");
+                        return 1;
+                }
+                clock_gettime(CLOCK_MONOTONIC, &t_dist);
+                if(timing)
+                        fprintf(stderr, "Batch finished in %.3f s (%d threads).\n",
+                                        elapsed(t_start, t_dist), nthreads);
+                return nfailed == 0 ? 0 : 1;
         }
 
         /*
-         * Write EPS file (optional)
+         * Ensemble mode: read the models or trajectory frames one at a
+         * time, keeping only the running statistics, and write them out
+         * (optional)
          */
+        if(models || trajname != NULL){
+                FILE *efp;
+                char *err;
 
-        if(epsname != NULL){
-                ofp = fopen(epsname, "w");
-                if(ofp == NULL){
-                        fprintf(stderr, "%s", usage_str);
-                        fprintf(stderr, "FATAL: couldn't open output file [%s]\n", epsname);
+                clock_gettime(CLOCK_MONOTONIC, &t_start);
+                if(trajname != NULL){
+                        ens = read_trajectory(filename, trajname, chain,
+                                        threshold, frames, nthreads, &err);
+                        if(ens == NULL){
+                                fprintf(stderr, "FATAL: %s [%s, %s].\nTried to read chain [%c].\n", err, filename, trajname, chain);
+                                return 1;
+                        }
+                }
+                else {
+                        ens = read_ensemble(filename, chain, threshold, nthreads);
+                        if(ens == NULL){
+                                fprintf(stderr, "FATAL: couldn't read models from file [%s].\nTried to read chain [%c].\n", filename, chain);
+                                return 1;
+                        }
+                }
+                clock_gettime(CLOCK_MONOTONIC, &t_parsed);
+                if(timing)
+                        fprintf(stderr, "Read %d %s of %d residues in %.3f s (%d threads).\n",
+                                        ens->nframes,
+                                        trajname != NULL ? "frames" : "models",
+                                        ens->nres,
+                                        elapsed(t_start, t_parsed), nthreads);
+                if(countsname != NULL){
+                        efp = fopen(countsname, "w");
+                        if(efp == NULL){
+                                fprintf(stderr, "FATAL: couldn't open output file [%s]\n", countsname);
+                                return 1;
+                        }
+                        write_frame_counts(efp, ens);
+                        printf("Wrote contacts per frame to file [%s].\n", countsname);
+                        fclose(efp);
+                }
+                if(ofname != NULL){
+                        efp = fopen(ofname, "w");
+                        if(efp == NULL){
+                                fprintf(stderr, "FATAL: couldn't open output file [%s]\n", ofname);
+                                return 1;
+                        }
+                        write_ensemble(efp, ens);
+                        printf("Wrote contact frequencies to file [%s].\n", ofname);
+                        fclose(efp);
+                }
+                if(rastername != NULL){
+                        efp = fopen(rastername, "wb");
+                        if(efp == NULL){
+                                fprintf(stderr, "FATAL: couldn't open output file [%s]\n", rastername);
+                                return 1;
+                        }
+                        if(write_ensemble_pgm(efp, ens, raster_scale,
+                                                raster_distances) != 0){
+                                fprintf(stderr, "FATAL: couldn't allocate memory.\n");
+                                return 1;
+                        }
+                        printf("Wrote image to file [%s].\n", rastername);
+                        fclose(efp);
+                }
+                if(!view){
+                        freeensemble(ens);
+                        return 0;
+                }
+                shown = chain_id;
+                nres = ens->nres;
+                goto start_view;
+        }
+
+        /*
+         * Read PDB coords for every chain in one pass
+         */
+        clock_gettime(CLOCK_MONOTONIC, &t_start);
+        tab = getchains(filename);
+        current = tab == NULL ? -1 : find_chain(tab, chain_id);
+        if(current < 0 && tab != NULL && all_chains)
+                current = 0;
+        if (current < 0){
+                fprintf(stderr, "FATAL: couldn't read coordinates from file [%s].\nTried to read chain [%s].\n", filename, chain_id);
+                return 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t_parsed);
+        if(timing){
+                fprintf(stderr, "Parsed %.1f MB (%d chains) in %.3f s (%.1f MB/s).\n",
+                                tab->source_bytes / 1e6, tab->nchains,
+                                elapsed(t_start, t_parsed),
+                                tab->source_bytes / 1e6
+                                / elapsed(t_start, t_parsed));
+        }
+        for(k = 0; k < tab->nchains; k++)
+                set_atom_cutoff(tab->chains[k], threshold);
+
+        /*
+         * Write contacts between chains (optional)
+         */
+        if(ifname != NULL){
+                FILE *ifp = fopen(ifname, "w");
+                if(ifp == NULL){
+                        fprintf(stderr, "FATAL: couldn't open output file [%s]\n", ifname);
                         return 1;
                 }
-                write_eps(ofp, *dist, threshold);
-                printf("Wrote postscript to file [%s].\n", epsname);
-                fclose(ofp);
-                ofp = NULL;
+                clock_gettime(CLOCK_MONOTONIC, &t_start);
+                if(write_interfaces(ifp, tab, threshold) != 0){
+                        fprintf(stderr, "FATAL: couldn't allocate memory.\n");
+                        return 1;
+                }
+                clock_gettime(CLOCK_MONOTONIC, &t_dist);
+                if(timing)
+                        fprintf(stderr, "Wrote contacts between %d chains in %.3f s.\n",
+                                        tab->nchains, elapsed(t_start, t_dist));
+                printf("Wrote contacts between chains to file [%s].\n", ifname);
+                fclose(ifp);
+        }
+
+        /*
+         * Write output files (optional), for the chosen chain or for every
+         * chain. The distance matrix of the chain to view is kept.
+         */
+        oo.ofname = ofname;
+        oo.binname = binname;
+        oo.epsname = epsname;
+        oo.rastername = rastername;
+        oo.threshold = threshold;
+        oo.precision = precision;
+        oo.auto_precision = auto_precision;
+        oo.raster_scale = raster_scale;
+        oo.raster_distances = raster_distances;
+        oo.nthreads = nthreads;
+        oo.timing = timing;
+        for(k = 0; k < tab->nchains; k++){
+                if(!all_chains && k != current) continue;
+                co = oo;
+                if(all_chains){
+                        cs = tab->chains[k];
+                        co.ofname = chain_file_name(ofname, cs->chain_name);
+                        co.binname = chain_file_name(binname, cs->chain_name);
+                        co.epsname = chain_file_name(epsname, cs->chain_name);
+                        co.rastername = chain_file_name(rastername, cs->chain_name);
+                        if((ofname != NULL && co.ofname == NULL)
+                                        || (binname != NULL && co.binname == NULL)
+                                        || (epsname != NULL && co.epsname == NULL)
+                                        || (rastername != NULL && co.rastername == NULL)){
+                                fprintf(stderr, "FATAL: couldn't allocate memory.\n");
+                                return 1;
+                        }
+                }
+                ret = write_outputs(tab->chains[k], &co,
+                                view && k == current ? &dist : NULL);
+                if(all_chains){
+                        free(co.ofname);
+                        free(co.binname);
+                        free(co.epsname);
+                        free(co.rastername);
+                }
+                if(ret != 0) return 1;
+        }
+        cs = tab->chains[current];
+        shown = cs->chain_name;
+        nres = cs->nres;
+
+        if(!view){
+                freechains(tab);
+                return 0;
         }
 
         /* 
          * Set up curses display
          */
+        start_view:
 
         init_curses();
         getmaxyx(stdscr, nrow, ncol);
@@ -537,7 +1437,7 @@ main(int argc, char **argv)
          * Draw status bar
          */
         WINDOW *status = NULL;
-        status = draw_status_pad(filename, chain, nres, threshold);
+        status = draw_status_pad(filename, shown, nres, threshold, 1);
         if(status == NULL){
                 endwin();
                 fprintf(stderr, "FATAL: error drawing curses display.");
@@ -551,48 +1451,54 @@ main(int argc, char **argv)
          */
 
         WINDOW *hpos = NULL;
-        hpos = newpad(1, x_draw_limit);
+        hpos = draw_hpos_pad(x_draw_limit, 1);
         if(hpos == NULL){
+                endwin();
                 fprintf(stderr, "FATAL: error drawing curses display.\n");
                 return 1;
         } 
-        char *s1 = NULL;
-        s1 = make_hpos_str(x_draw_limit);
-        if (s1 == NULL){
-                fprintf(stderr, "FATAL: couldn't allocate memory.\n");
-                return 1;
-        }
-        if(g_has_colours) wattron(hpos, COLOR_PAIR(5));
-        waddnstr(hpos, s1, x_draw_limit);
-        free(s1);
-        s1 = NULL;
-        
         WINDOW *vpos = NULL;
-        vpos = newpad(y_draw_limit, 1);
+        vpos = draw_vpos_pad(y_draw_limit, 1);
         if(vpos == NULL){
+                endwin();
                 fprintf(stderr, "FATAL: error drawing curses display.\n");
                 return 1;
         } 
-        s1 = make_vpos_str(y_draw_limit);
-        if (s1 == NULL){
+
+
+        /*
+         * Draw the contact map. Only the part on screen is drawn, from tiles
+         * that are computed as they come into view. An ensemble is drawn
+         * straight from its statistics, without tiles or zoom levels.
+         */
+        struct tile_cache *tc = NULL;
+        struct zoom_pyramid *zp = NULL;
+        const struct zoom_level *zl = NULL;
+        int zoom = 0;
+        if(ens == NULL){
+                tc = make_tile_cache(*dist, TILE_CACHE_SIZE);
+                zp = make_zoom_pyramid(*dist);
+        }
+        if(ens == NULL && (tc == NULL || zp == NULL)){
+                endwin();
                 fprintf(stderr, "FATAL: couldn't allocate memory.\n");
                 return 1;
         }
-        if(g_has_colours) wattron(vpos, COLOR_PAIR(5));
-        for(j = 0; j < y_draw_limit; j++)
-            waddch(vpos, s1[j]);
-        free(s1);
-
-
         WINDOW *contacts = NULL;
-        contacts = draw_contacts_pad(*dist, threshold);        
+        contacts = newwin(nrow > 3 ? nrow - 2 : 1, ncol > 2 ? ncol - 1 : 1, 2, 1);
         if(contacts == NULL){
+                endwin();
                 fprintf(stderr, "FATAL: error drawing curses display.\n");
                 return 1;
         } 
+        if(g_has_colours) wbkgdset(contacts, ' ' | COLOR_PAIR(1));
+        if(ens != NULL)
+                draw_ensemble_view(contacts, ens, 0, 0);
+        else
+                draw_contacts_view(contacts, tc, 0, 0, threshold);
         pnoutrefresh(hpos, 0, 0, 1, 1, 1, ncol - 1);
         pnoutrefresh(vpos, 0, 0, 2, 0, nrow - 1, 1);
-        pnoutrefresh(contacts, 0, 0, 2, 1, nrow - 1, ncol - 1);
+        wnoutrefresh(contacts);
         doupdate();
 
         /*
@@ -600,15 +1506,21 @@ main(int argc, char **argv)
          */
         int x_offset = 0;
         int y_offset = 0;
+        int dx, dy, dt; /* direction of the last move, for prefetching */
         int c;
         bool pressed_g = false; /* */
         while(1){
                 c =  getch();		
+                dx = dy = dt = 0;
                 /* q or Q to quit */
                 if (c == 'q' || c == 'Q')
                         break;
                 if (c != 'g') 
                         pressed_g = false;
+                /* An ensemble has one threshold, chain and zoom level */
+                if (ens != NULL && (c == 'o' || c == 'i' || c == 'c'
+                                        || c == 'C' || c == '+' || c == '-'))
+                        continue;
                 switch(c){
                         /* Move view with WASD, hjkl, arrow keys*/ 
                         case KEY_LEFT:
@@ -616,6 +1528,7 @@ main(int argc, char **argv)
                         case 'a':
                         case 'h':
                                 x_offset-=10;
+                                dx = -1;
                                 if (x_offset < 0)
                                         x_offset =0;
                                 break;
@@ -624,6 +1537,7 @@ main(int argc, char **argv)
                         case 'd':
                         case 'l':
                                 x_offset+=10;
+                                dx = 1;
                                 if (x_offset + ncol > x_draw_limit)
                                         x_offset = x_draw_limit - ncol + 1;
                                 if (x_draw_limit < ncol)
@@ -634,6 +1548,7 @@ main(int argc, char **argv)
                         case 'w':
                         case 'k':
                                 y_offset -= 5;
+                                dy = -1;
                                 if (y_offset < 0)
                                         y_offset = 0;
                                 break;
@@ -642,6 +1557,7 @@ main(int argc, char **argv)
                         case 's':
                         case 'j':
                                 y_offset += 5;
+                                dy = 1;
                                 if (y_offset + nrow > y_draw_limit)
                                         y_offset = y_draw_limit - nrow + 2;
                                 if (y_draw_limit < nrow)
@@ -674,18 +1590,123 @@ main(int argc, char **argv)
                                         pressed_g = true;
                                 }
                                 break;
+                        /*
+                         * Zoom out and in with o/i. Each level doubles the
+                         * scale, keeping the same residue at the top left.
+                         */
+                        case 'o':
+                        case 'i':
+                                if(c == 'i' && zoom == 0)
+                                        break;
+                                if(c == 'o' && (zoom + 1 >= ZOOM_LEVELS
+                                                || (x_draw_limit < ncol
+                                                && y_draw_limit < nrow - 1)))
+                                        break;
+                                if(c == 'o'){
+                                        zoom++;
+                                        x_offset /= 2;
+                                        y_offset /= 2;
+                                } else {
+                                        zoom--;
+                                        x_offset *= 2;
+                                        y_offset *= 2;
+                                }
+                                x_draw_limit = (nres + (2 << zoom) - 1) / (2 << zoom);
+                                y_draw_limit = (nres + (4 << zoom) - 1) / (4 << zoom);
+                                if (x_offset + ncol > x_draw_limit)
+                                        x_offset = x_draw_limit - ncol + 1;
+                                if (x_offset < 0)
+                                        x_offset = 0;
+                                if (y_offset + nrow > y_draw_limit)
+                                        y_offset = y_draw_limit - nrow + 2;
+                                if (y_offset < 0)
+                                        y_offset = 0;
+                                delwin(hpos);
+                                delwin(vpos);
+                                delwin(status);
+                                hpos = draw_hpos_pad(x_draw_limit, 1 << zoom);
+                                vpos = draw_vpos_pad(y_draw_limit, 1 << zoom);
+                                status = draw_status_pad(filename, shown, nres,
+                                                threshold, 1 << zoom);
+                                if(hpos == NULL || vpos == NULL || status == NULL){
+                                        endwin();
+                                        fprintf(stderr, "FATAL: error drawing curses display.\n");
+                                        return 1;
+                                }
+                                break;
+                        /*
+                         * Switch to the next/previous chain with c/C, the
+                         * whole complex coming after the last chain. The
+                         * coordinates are already loaded; only the distance
+                         * matrix and the structures built on it are redone.
+                         */
+                        case 'c':
+                        case 'C':
+                                if(tab->nchains < 2)
+                                        break;
+                                current += c == 'c' ? 1 : tab->nchains;
+                                current %= tab->nchains + 1;
+                                if(current == tab->nchains && whole == NULL)
+                                        whole = join_chains(tab);
+                                if(current == tab->nchains && whole == NULL){
+                                        endwin();
+                                        fprintf(stderr, "FATAL: couldn't allocate memory.\n");
+                                        return 1;
+                                }
+                                cs = current == tab->nchains ? whole
+                                        : tab->chains[current];
+                                shown = cs->chain_name;
+                                nres = cs->nres;
+                                if(view_distmat(cs, precision, auto_precision,
+                                                        threshold, nthreads,
+                                                        &dist, &tc, &zp) != 0){
+                                        endwin();
+                                        fprintf(stderr, "FATAL: couldn't allocate memory.\n");
+                                        return 1;
+                                }
+                                zoom = 0;
+                                x_offset = 0;
+                                y_offset = 0;
+                                x_draw_limit = (nres + 1) / 2;
+                                y_draw_limit = (nres + 3) / 4;
+                                delwin(hpos);
+                                delwin(vpos);
+                                delwin(status);
+                                hpos = draw_hpos_pad(x_draw_limit, 1);
+                                vpos = draw_vpos_pad(y_draw_limit, 1);
+                                status = draw_status_pad(filename, shown, nres,
+                                                threshold, 1);
+                                if(hpos == NULL || vpos == NULL || status == NULL){
+                                        endwin();
+                                        fprintf(stderr, "FATAL: error drawing curses display.\n");
+                                        return 1;
+                                }
+                                break;
                         /* Change distance threshold with +/- */
                         case '+':
                                 threshold += 0.5;
-                                delwin(contacts);
-                                contacts = NULL;
-                                contacts = draw_contacts_pad(*dist, threshold);        
-                                if(contacts == NULL){
-                                        fprintf(stderr, "FATAL: error drawing curses display.\n");
+                                dt = 1;
+                                /* All-atom distances past the cutoff are
+                                 * only bounds, so measure further. An
+                                 * automatic uint8 matrix stops being exact
+                                 * past DM_QUANT_MAX, so is rebuilt too */
+                                if(((cs->atoms != NULL
+                                                && threshold > cs->atoms->cutoff)
+                                        || (dist->precision == DM_UINT8
+                                                && precision != DM_UINT8
+                                                && !dm_quant_exact(threshold)))
+                                                && view_distmat(cs, precision,
+                                                        auto_precision,
+                                                        threshold, nthreads,
+                                                        &dist, &tc, &zp) != 0){
+                                        endwin();
+                                        fprintf(stderr, "FATAL: couldn't allocate memory.\n");
                                         return 1;
-                                } 
+                                }
+                                delwin(status);
                                 status = NULL;
-                                status = draw_status_pad(filename, chain, nres, threshold);
+                                status = draw_status_pad(filename, shown, nres,
+                                                threshold, 1 << zoom);
                                 if(status == NULL){
                                         endwin();
                                         fprintf(stderr, "FATAL: error drawing curses display.");
@@ -697,15 +1718,11 @@ main(int argc, char **argv)
                         case '-':
                                 threshold -= 0.5;
                                 if (threshold < 0) threshold = 0;
-                                delwin(contacts);
-                                contacts = NULL;
-                                contacts = draw_contacts_pad(*dist, threshold);        
-                                if(contacts == NULL){
-                                        fprintf(stderr, "FATAL: error drawing curses display.\n");
-                                        return 1;
-                                } 
+                                dt = -1;
+                                delwin(status);
                                 status = NULL;
-                                status = draw_status_pad(filename, chain, nres, threshold);
+                                status = draw_status_pad(filename, shown, nres,
+                                                threshold, 1 << zoom);
                                 if(status == NULL){
                                         endwin();
                                         fprintf(stderr, "FATAL: error drawing curses display.");
@@ -718,22 +1735,62 @@ main(int argc, char **argv)
                         case KEY_RESIZE:
                                 getmaxyx(stdscr, nrow, ncol);
                                 draw_bg(stdscr, nrow, ncol);
+                                wresize(contacts, nrow > 3 ? nrow - 2 : 1,
+                                                ncol > 2 ? ncol - 1 : 1);
                                 break;
                 }
                 wnoutrefresh(stdscr);
                 pnoutrefresh(hpos, 0, 0 + x_offset, 1, 1, 1, ncol - 1);
                 pnoutrefresh(vpos, 0 + y_offset, 0, 2, 0, nrow - 1, 1);
-                pnoutrefresh(contacts, 0 + y_offset, 0 + x_offset,
-                                2, 1, nrow - 1, ncol - 1);
+                if(ens != NULL){
+                        draw_ensemble_view(contacts, ens, y_offset, x_offset);
+                }
+                else if(zoom == 0){
+                        draw_contacts_view(contacts, tc, y_offset, x_offset,
+                                        threshold);
+                }
+                else {
+                        zl = get_zoom_level(zp, zoom, threshold);
+                        if(zl == NULL){
+                                endwin();
+                                fprintf(stderr, "FATAL: couldn't allocate memory.\n");
+                                return 1;
+                        }
+                        draw_zoomed_view(contacts, zl, nres, y_offset, x_offset);
+                }
+                if(whole != NULL && cs == whole)
+                        draw_chain_bounds(contacts, tab, y_offset, x_offset,
+                                        1 << zoom);
+                wnoutrefresh(contacts);
                 pnoutrefresh(status, 0, 0, 0, 0, 1, ncol - 1);
                 doupdate();
+
+                /* Get the next tiles ready while waiting for a key */
+                if(zoom != 0 || ens != NULL)
+                        continue;
+                if(dx != 0 || dy != 0)
+                        prefetch_tiles(tc, y_offset, x_offset, nrow - 2,
+                                        ncol - 1, dy, dx, threshold);
+                if(dt != 0 && threshold + 0.5 * dt >= 0)
+                        prefetch_tiles(tc, y_offset, x_offset, nrow - 2,
+                                        ncol - 1, 0, 0, threshold + 0.5 * dt);
         }
 
         /*
          * Clean up and exit
          */
-        freedm(dist);
+        freetilecache(tc);
+        tc = NULL;
+        freezoompyramid(zp);
+        zp = NULL;
+        if(dist != NULL) freedm(dist);
         dist = NULL;
+        freeensemble(ens);
+        ens = NULL;
+        freecoords(whole);
+        whole = NULL;
+        freechains(tab);
+        tab = NULL;
 
         delwin(status);
         delwin(contacts);
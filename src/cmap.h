@@ -22,7 +22,10 @@
 #ifndef CMAP_H_
 #define CMAP_H_
 
+#include "ensemble.h"
 #include "pdb.h"
+#include "tiles.h"
+#include "zoom.h"
 
 /**
  * CHECKB_LIGHT(y, x):
@@ -42,11 +45,21 @@
 
 void def_colours(void);
 void draw_bg(WINDOW * scr, unsigned int cols, unsigned int rows);
-WINDOW * draw_contacts_pad(struct distmat dist, double threshold);
-WINDOW * draw_status_pad(char *filename, char chain, int nres, double threshold);
+void draw_chain_bounds(WINDOW *view, const struct chain_table *tab,
+                int y_offset, int x_offset, int scale);
+void draw_contacts_view(WINDOW *view, struct tile_cache *tc, int y_offset,
+                int x_offset, double threshold);
+void draw_ensemble_view(WINDOW *view, const struct ensemble *e, int y_offset,
+                int x_offset);
+WINDOW * draw_hpos_pad(unsigned int x_draw_limit, unsigned int scale);
+WINDOW * draw_status_pad(char *filename, const char *chain, int nres,
+                double threshold, int scale);
+WINDOW * draw_vpos_pad(unsigned int y_draw_limit, unsigned int scale);
+void draw_zoomed_view(WINDOW *view, const struct zoom_level *zl, int nres,
+                int y_offset, int x_offset);
 void init_curses(void);
 int main(int argc, char **argv);
-char * make_hpos_str(unsigned int x_draw_limit);
-char * make_vpos_str(unsigned int y_draw_limit);
+char * make_hpos_str(unsigned int x_draw_limit, unsigned int scale);
+char * make_vpos_str(unsigned int y_draw_limit, unsigned int scale);
 
 #endif // CMAP_H_
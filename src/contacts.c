@@ -0,0 +1,701 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#include<limits.h>
+#include<math.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include"contacts.h"
+#include"distance.h"
+#include"input.h"
+#include"pdb.h"
+
+/* Number of candidate distances computed per kernel call */
+#define CL_BLOCK 256
+
+/*
+ * A uniform grid over the bounding box of the coordinates. Residues are
+ * sorted by cell, so the residues in cell c are entries
+ * start[c] .. start[c+1] - 1 of x, y, z and idx.
+ */
+struct cell_grid{
+        double origin[3];
+        double size;
+        int dim[3];
+        size_t *start;
+        double *x, *y, *z;
+        int *idx;
+};
+
+/**
+ * cell_of: grid coordinate along one axis for position @v
+ */
+static int
+cell_of(const struct cell_grid *g, int axis, double v)
+{
+        int c = (int) floor((v - g->origin[axis]) / g->size);
+        if(c < 0) c = 0;
+        if(c >= g->dim[axis]) c = g->dim[axis] - 1;
+        return c;
+}
+
+static size_t
+cell_index(const struct cell_grid *g, int cx, int cy, int cz)
+{
+        return ((size_t) cz * g->dim[1] + cy) * g->dim[0] + cx;
+}
+
+static void
+free_grid(struct cell_grid *g)
+{
+        free(g->start);
+        free(g->x);
+        free(g->y);
+        free(g->z);
+        free(g->idx);
+}
+
+/**
+ * build_grid: bin the residues of @cs into cells at least @threshold wide
+ *
+ * Cells are widened if needed so that there are never many more cells than
+ * residues; the search stays correct as long as cells are at least
+ * @threshold wide. Residues without coordinates are left out.
+ *
+ * Returns 0 on success, -1 if memory couldn't be allocated.
+ */
+static int
+build_grid(struct cell_grid *g, const struct coords *cs, double threshold)
+{
+        double lo[3], hi[3], v[3];
+        double ncells;
+        size_t *fill = NULL;
+        size_t c, total;
+        int npresent = 0;
+        int i, a;
+
+        memset(g, 0, sizeof(*g));
+        for(i = 0; i < cs->nres; i++){
+                if(!RES_PRESENT(*cs, i)) continue;
+                v[0] = cs->x[i];
+                v[1] = cs->y[i];
+                v[2] = cs->z[i];
+                for(a = 0; a < 3; a++){
+                        if(npresent == 0 || v[a] < lo[a]) lo[a] = v[a];
+                        if(npresent == 0 || v[a] > hi[a]) hi[a] = v[a];
+                }
+                npresent++;
+        }
+        if(npresent == 0){
+                lo[0] = lo[1] = lo[2] = 0;
+                hi[0] = hi[1] = hi[2] = 0;
+        }
+
+        g->size = threshold;
+        while(1){
+                ncells = 1;
+                for(a = 0; a < 3; a++)
+                        ncells *= floor((hi[a] - lo[a]) / g->size) + 1;
+                if(ncells <= 2.0 * npresent + 8) break;
+                g->size *= 1.5;
+        }
+        total = 1;
+        for(a = 0; a < 3; a++){
+                g->origin[a] = lo[a];
+                g->dim[a] = (int) floor((hi[a] - lo[a]) / g->size) + 1;
+                total *= g->dim[a];
+        }
+
+        g->start = calloc(total + 1, sizeof(*g->start));
+        fill = malloc(total * sizeof(*fill));
+        g->x = malloc((npresent + 1) * sizeof(*g->x));
+        g->y = malloc((npresent + 1) * sizeof(*g->y));
+        g->z = malloc((npresent + 1) * sizeof(*g->z));
+        g->idx = malloc((npresent + 1) * sizeof(*g->idx));
+        if(g->start == NULL || fill == NULL || g->x == NULL || g->y == NULL
+                        || g->z == NULL || g->idx == NULL){
+                free(fill);
+                free_grid(g);
+                return -1;
+        }
+
+        /* Counting sort of residues by cell */
+        for(i = 0; i < cs->nres; i++){
+                if(!RES_PRESENT(*cs, i)) continue;
+                c = cell_index(g, cell_of(g, 0, cs->x[i]),
+                                cell_of(g, 1, cs->y[i]),
+                                cell_of(g, 2, cs->z[i]));
+                g->start[c + 1]++;
+        }
+        for(c = 0; c < total; c++){
+                g->start[c + 1] += g->start[c];
+                fill[c] = g->start[c];
+        }
+        for(i = 0; i < cs->nres; i++){
+                if(!RES_PRESENT(*cs, i)) continue;
+                c = cell_index(g, cell_of(g, 0, cs->x[i]),
+                                cell_of(g, 1, cs->y[i]),
+                                cell_of(g, 2, cs->z[i]));
+                g->x[fill[c]] = cs->x[i];
+                g->y[fill[c]] = cs->y[i];
+                g->z[fill[c]] = cs->z[i];
+                g->idx[fill[c]] = i;
+                fill[c]++;
+        }
+        free(fill);
+        return 0;
+}
+
+static int
+compare_int(const void *a, const void *b)
+{
+        int x = *(const int *) a;
+        int y = *(const int *) b;
+        return (x > y) - (x < y);
+}
+
+/* A growable list of partner indices, shared by the cell list searches */
+struct partner_list{
+        int *col;
+        size_t n;
+        size_t cap;
+};
+
+/**
+ * grid_partners: append the residues of a grid close to a point
+ *
+ * @g:         grid of the residues to search
+ * @x, @y, @z: the point, used as the reference point for the distances
+ * @threshold: distance threshold; residues strictly closer are appended
+ * @after:     only residues with index greater than this are appended
+ * @pl:        list to append to, grown if necessary
+ *
+ * Only the point's own cell and the 26 around it are searched, which is
+ * enough as long as the cells are at least @threshold wide. The residues
+ * appended are sorted into increasing order.
+ *
+ * Returns 0 on success, -1 if memory couldn't be allocated.
+ */
+static int
+grid_partners(const struct cell_grid *g, double x, double y, double z,
+                double threshold, int after, struct partner_list *pl)
+{
+        double d[CL_BLOCK];
+        size_t row_start = pl->n;
+        size_t first, last, k;
+        int *tmp;
+        int cx, cy, cz, nx, ny, nz;
+        int m, n;
+
+        cx = cell_of(g, 0, x);
+        cy = cell_of(g, 1, y);
+        cz = cell_of(g, 2, z);
+        for(nz = cz - 1; nz <= cz + 1; nz++){
+                if(nz < 0 || nz >= g->dim[2]) continue;
+                for(ny = cy - 1; ny <= cy + 1; ny++){
+                        if(ny < 0 || ny >= g->dim[1]) continue;
+                        /* cells nx = cx-1 .. cx+1 are adjacent in the sorted
+                         * arrays */
+                        nx = cx > 0 ? cx - 1 : 0;
+                        first = g->start[cell_index(g, nx, ny, nz)];
+                        nx = cx + 1 < g->dim[0] ? cx + 1 : cx;
+                        last = g->start[cell_index(g, nx, ny, nz) + 1];
+                        for(k = first; k < last; k += CL_BLOCK){
+                                n = last - k < CL_BLOCK ? last - k : CL_BLOCK;
+                                dist_points(x, y, z, g->x + k, g->y + k,
+                                                g->z + k, n, d, 0);
+                                for(m = 0; m < n; m++){
+                                        if(g->idx[k + m] <= after) continue;
+                                        if(!(d[m] < threshold)) continue;
+                                        if(pl->n == pl->cap){
+                                                tmp = realloc(pl->col, 2 * pl->cap * sizeof(*tmp));
+                                                if(tmp == NULL) return -1;
+                                                pl->col = tmp;
+                                                pl->cap *= 2;
+                                        }
+                                        pl->col[pl->n++] = g->idx[k + m];
+                                }
+                        }
+                }
+        }
+        qsort(pl->col + row_start, pl->n - row_start, sizeof(*pl->col),
+                        compare_int);
+        return 0;
+}
+
+/**
+ * find_contacts: list all pairs of residues closer than @threshold
+ *
+ * @cs:        coordinates
+ * @threshold: distance threshold (Angstroms); pairs with distance strictly
+ *             less than this are contacts, as in write_contacts()
+ *
+ * Residues are binned into a grid of cells at least @threshold wide, so
+ * each residue only needs to be compared with those in its own and the 26
+ * neighbouring cells. Time and memory are roughly linear in the number of
+ * residues plus the number of contacts, and no distance matrix is built.
+ * Residues without coordinates have no contacts.
+ *
+ * Distances are computed by the same kernel as calculate_distmat(), with
+ * the lower-numbered residue as the reference point, so a pair is a contact
+ * here exactly when getdist() on the full matrix is below @threshold.
+ *
+ * Allocates and returns a struct contacts, which should be freed with
+ * freecontacts(), or returns NULL on error.
+ */
+struct contacts *
+find_contacts(struct coords cs, double threshold)
+{
+        struct contacts *ct = NULL;
+        struct cell_grid g;
+        struct partner_list pl = {NULL, 0, 1024};
+        int i;
+
+        if(cs.nres <= 0 || cs.x == NULL) return NULL;
+        if(!(threshold > 0)) threshold = 0;
+
+        ct = malloc(sizeof(*ct));
+        if(ct == NULL) return NULL;
+        memset(ct, 0, sizeof(*ct));
+        ct->nres = cs.nres;
+        ct->source_chain = cs.source_chain;
+        ct->threshold = threshold;
+        if(cs.chain_name != NULL){
+                ct->chain_name = strdup(cs.chain_name);
+                if(ct->chain_name == NULL) goto fc_error_cleanup;
+        }
+        if(cs.source_filename != NULL){
+                ct->source_filename = strdup(cs.source_filename);
+                if(ct->source_filename == NULL) goto fc_error_cleanup;
+        }
+        if(cs.sequence != NULL){
+                ct->sequence = strdup(cs.sequence);
+                if(ct->sequence == NULL) goto fc_error_cleanup;
+        }
+        ct->rowptr = malloc((cs.nres + 1) * sizeof(*ct->rowptr));
+        pl.col = malloc(pl.cap * sizeof(*pl.col));
+        ct->col = pl.col;
+        if(ct->rowptr == NULL || pl.col == NULL) goto fc_error_cleanup;
+
+        if(build_grid(&g, &cs, threshold > 0 ? threshold : 1) != 0)
+                goto fc_error_cleanup;
+
+        for(i = 0; i < cs.nres; i++){
+                ct->rowptr[i] = pl.n;
+                if(threshold == 0 || !RES_PRESENT(cs, i)) continue;
+                if(grid_partners(&g, cs.x[i], cs.y[i], cs.z[i], threshold, i,
+                                        &pl) != 0){
+                        ct->col = pl.col;
+                        free_grid(&g);
+                        goto fc_error_cleanup;
+                }
+        }
+        ct->rowptr[cs.nres] = pl.n;
+        ct->col = pl.col;
+        ct->ncontacts = pl.n;
+        free_grid(&g);
+        return ct;
+
+        fc_error_cleanup:
+        freecontacts(ct);
+        return NULL;
+}
+
+/**
+ * find_interface: list all pairs of residues from two chains closer than
+ * @threshold
+ *
+ * @a, @b:     coordinates of the two chains
+ * @threshold: distance threshold (Angstroms); pairs with distance strictly
+ *             less than this are contacts
+ *
+ * Works like find_contacts(), with the grid built over chain @b and
+ * searched from every residue of chain @a, so the search is linear in the
+ * size of the two chains and no @a x @b matrix is built. Nothing is
+ * assumed about symmetry: every residue of @a gets all of its partners.
+ *
+ * Distances are computed with the residue of @a as the reference point,
+ * so when @a comes before @b in join_chains(), a pair is a contact here
+ * exactly when it is in the distance matrix of the joined chains.
+ *
+ * Allocates and returns a struct interface, which should be freed with
+ * freeinterface(), or returns NULL on error.
+ */
+struct interface *
+find_interface(struct coords a, struct coords b, double threshold)
+{
+        struct interface *ifc = NULL;
+        struct cell_grid g;
+        struct partner_list pl = {NULL, 0, 1024};
+        int i;
+
+        if(a.nres <= 0 || b.nres <= 0 || a.x == NULL || b.x == NULL)
+                return NULL;
+        if(!(threshold > 0)) threshold = 0;
+
+        ifc = calloc(1, sizeof(*ifc));
+        if(ifc == NULL) return NULL;
+        ifc->nres_a = a.nres;
+        ifc->nres_b = b.nres;
+        ifc->threshold = threshold;
+        ifc->rowptr = malloc((a.nres + 1) * sizeof(*ifc->rowptr));
+        pl.col = malloc(pl.cap * sizeof(*pl.col));
+        ifc->col = pl.col;
+        if(ifc->rowptr == NULL || pl.col == NULL) goto fi_error_cleanup;
+
+        if(build_grid(&g, &b, threshold > 0 ? threshold : 1) != 0)
+                goto fi_error_cleanup;
+
+        for(i = 0; i < a.nres; i++){
+                ifc->rowptr[i] = pl.n;
+                if(threshold == 0 || !RES_PRESENT(a, i)) continue;
+                if(grid_partners(&g, a.x[i], a.y[i], a.z[i], threshold, -1,
+                                        &pl) != 0){
+                        ifc->col = pl.col;
+                        free_grid(&g);
+                        goto fi_error_cleanup;
+                }
+        }
+        ifc->rowptr[a.nres] = pl.n;
+        ifc->col = pl.col;
+        ifc->ncontacts = pl.n;
+        free_grid(&g);
+        return ifc;
+
+        fi_error_cleanup:
+        freeinterface(ifc);
+        return NULL;
+}
+
+/**
+ * distmat_contacts: list the contacts in a distance matrix
+ *
+ * @dm:        distance matrix
+ * @threshold: distance threshold for defining a contact (Angstroms)
+ *
+ * Lists the same pairs as write_contacts(), i.e. those where getdist() is
+ * below @threshold. Unlike find_contacts() this counts pairs involving
+ * residues without coordinates if @threshold is beyond DIST_MISSING.
+ *
+ * Allocates and returns a struct contacts, which should be freed with
+ * freecontacts(), or returns NULL on error.
+ */
+struct contacts *
+distmat_contacts(struct distmat dm, double threshold)
+{
+        struct contacts *ct = NULL;
+        size_t n = 0;
+        int i, j;
+
+        ct = malloc(sizeof(*ct));
+        if(ct == NULL) return NULL;
+        memset(ct, 0, sizeof(*ct));
+        ct->nres = dm.nres;
+        ct->source_chain = dm.source_chain;
+        ct->threshold = threshold;
+        if(dm.chain_name != NULL){
+                ct->chain_name = strdup(dm.chain_name);
+                if(ct->chain_name == NULL) goto dc_error_cleanup;
+        }
+        if(dm.source_filename != NULL){
+                ct->source_filename = strdup(dm.source_filename);
+                if(ct->source_filename == NULL) goto dc_error_cleanup;
+        }
+        if(dm.sequence != NULL){
+                ct->sequence = strdup(dm.sequence);
+                if(ct->sequence == NULL) goto dc_error_cleanup;
+        }
+        ct->rowptr = malloc((dm.nres + 1) * sizeof(*ct->rowptr));
+        if(ct->rowptr == NULL) goto dc_error_cleanup;
+
+        /* Count, then fill */
+        for(i = 0; i < dm.nres; i++)
+                for(j = i + 1; j < dm.nres; j++)
+                        if(getdist(dm, i, j) < threshold) n++;
+        ct->col = malloc((n + 1) * sizeof(*ct->col));
+        if(ct->col == NULL) goto dc_error_cleanup;
+        for(i = 0; i < dm.nres; i++){
+                ct->rowptr[i] = ct->ncontacts;
+                for(j = i + 1; j < dm.nres; j++)
+                        if(getdist(dm, i, j) < threshold)
+                                ct->col[ct->ncontacts++] = j;
+        }
+        ct->rowptr[dm.nres] = ct->ncontacts;
+        return ct;
+
+        dc_error_cleanup:
+        freecontacts(ct);
+        return NULL;
+}
+
+/**
+ * get_varint: decode an unsigned LEB128 varint
+ *
+ * @p:   pointer to the read position, advanced past the varint
+ * @end: end of the data
+ * @v:   receives the value
+ *
+ * Returns 0 on success, or -1 if the varint runs off the end of the data
+ * or doesn't fit in 64 bits.
+ */
+static inline int
+get_varint(const unsigned char **p, const unsigned char *end, uint64_t *v)
+{
+        const unsigned char *q = *p;
+        uint64_t x = 0;
+        int shift;
+
+        for(shift = 0; shift < 64; shift += 7){
+                if(q == end) return -1;
+                x |= (uint64_t) (*q & 0x7f) << shift;
+                if(!(*q++ & 0x80)){
+                        *v = x;
+                        *p = q;
+                        return 0;
+                }
+        }
+        return -1;
+}
+
+/**
+ * get_string: decode an optional string stored as length + 1 and bytes
+ *
+ * Sets @s to a newly allocated null-terminated copy, or NULL if the string
+ * is absent. Returns 0 on success, -1 on malformed data or allocation
+ * failure.
+ */
+static int
+get_string(const unsigned char **p, const unsigned char *end, char **s)
+{
+        uint64_t len;
+
+        *s = NULL;
+        if(get_varint(p, end, &len) != 0) return -1;
+        if(len == 0) return 0;
+        len--;
+        if(len > (uint64_t) (end - *p)) return -1;
+        *s = malloc(len + 1);
+        if(*s == NULL) return -1;
+        memcpy(*s, *p, len);
+        (*s)[len] = '\0';
+        *p += len;
+        return 0;
+}
+
+/**
+ * read_contacts_binary: load a contact list written by write_contacts_binary()
+ *
+ * @filename: path to the file, or "-" to read from standard input
+ *
+ * The whole file is checked: the header, that the file is long enough for
+ * the residues and contacts the header claims, that every partner lies
+ * between its residue and the end of the chain, and that the rows add up
+ * to the number of contacts in the header.
+ *
+ * Allocates and returns a struct contacts, which should be freed with
+ * freecontacts(), or returns NULL if the file can't be read or isn't a
+ * valid contact list.
+ */
+struct contacts *
+read_contacts_binary(char *filename)
+{
+        struct inputbuf *in = NULL;
+        struct contacts *ct = NULL;
+        const unsigned char *p, *end;
+        uint64_t bits = 0, nres, ncontacts, count, gap;
+        size_t magic_len = strlen(CONTACTS_BIN_MAGIC);
+        int64_t j;
+        int i, b;
+
+        in = open_input(filename);
+        if(in == NULL) return NULL;
+        p = (const unsigned char *) in->data;
+        end = p + in->len;
+        if(in->len < magic_len + 9
+                        || memcmp(p, CONTACTS_BIN_MAGIC, magic_len) != 0
+                        || p[magic_len] != CONTACTS_BIN_VERSION)
+                goto rb_error_cleanup;
+        p += magic_len + 1;
+
+        ct = malloc(sizeof(*ct));
+        if(ct == NULL) goto rb_error_cleanup;
+        memset(ct, 0, sizeof(*ct));
+        for(b = 0; b < 8; b++)
+                bits |= (uint64_t) *p++ << (8 * b);
+        memcpy(&ct->threshold, &bits, sizeof(ct->threshold));
+        if(get_varint(&p, end, &nres) != 0 || nres > INT_MAX
+                        || get_varint(&p, end, &ncontacts) != 0
+                        || ncontacts > nres * nres / 2)
+                goto rb_error_cleanup;
+        ct->nres = nres;
+        if(get_string(&p, end, &ct->chain_name) != 0
+                        || get_string(&p, end, &ct->source_filename) != 0
+                        || get_string(&p, end, &ct->sequence) != 0)
+                goto rb_error_cleanup;
+        if(ct->chain_name != NULL && ct->chain_name[0] != '\0'
+                        && ct->chain_name[1] == '\0')
+                ct->source_chain = ct->chain_name[0];
+        /* Every row count and every gap takes at least a byte, so a header
+         * promising more than the rest of the file can hold is rejected
+         * before anything is allocated for it */
+        if(nres > (uint64_t) (end - p)
+                        || ncontacts > (uint64_t) (end - p) - nres)
+                goto rb_error_cleanup;
+
+        ct->rowptr = malloc((nres + 1) * sizeof(*ct->rowptr));
+        ct->col = malloc((ncontacts + 1) * sizeof(*ct->col));
+        if(ct->rowptr == NULL || ct->col == NULL) goto rb_error_cleanup;
+        for(i = 0; i < ct->nres; i++){
+                ct->rowptr[i] = ct->ncontacts;
+                if(get_varint(&p, end, &count) != 0
+                                || count > ncontacts - ct->ncontacts)
+                        goto rb_error_cleanup;
+                for(j = i; count > 0; count--){
+                        if(get_varint(&p, end, &gap) != 0 || gap == 0
+                                        || gap >= nres - j)
+                                goto rb_error_cleanup;
+                        j += gap;
+                        ct->col[ct->ncontacts++] = j;
+                }
+        }
+        ct->rowptr[ct->nres] = ct->ncontacts;
+        if(ct->ncontacts != ncontacts || p != end) goto rb_error_cleanup;
+        close_input(in);
+        return ct;
+
+        rb_error_cleanup:
+        freecontacts(ct);
+        close_input(in);
+        return NULL;
+}
+
+/**
+ * freecontacts: free a struct contacts allocated by find_contacts()
+ * @ct: pointer to struct contacts which is to be freed
+ */
+void
+freecontacts(struct contacts *ct)
+{
+        if(ct == NULL) return;
+        free(ct->rowptr);
+        free(ct->col);
+        if(ct->source_filename != NULL) free(ct->source_filename);
+        if(ct->sequence != NULL) free(ct->sequence);
+        free(ct->chain_name);
+        free(ct);
+}
+
+/**
+ * freeinterface: free a struct interface allocated by find_interface()
+ */
+void
+freeinterface(struct interface *ifc)
+{
+        if(ifc == NULL) return;
+        free(ifc->rowptr);
+        free(ifc->col);
+        free(ifc);
+}
+
+/**
+ * set_pair: mark residues @i and @j as in contact in both triangles
+ */
+static void
+set_pair(struct contact_bitmap *bm, int i, int j)
+{
+        bm->bits[(size_t) i * bm->words_per_row + j / 64] |= (uint64_t) 1 << (j % 64);
+        bm->bits[(size_t) j * bm->words_per_row + i / 64] |= (uint64_t) 1 << (i % 64);
+}
+
+/**
+ * make_bitmap: build a contact bitmap from a distance matrix
+ *
+ * @dm:        distance matrix
+ * @threshold: distance threshold; pairs with distance <= @threshold are
+ *             contacts, as drawn by the viewer (the diagonal always is)
+ *
+ * Each pair in the packed triangle is read once and sets a bit in both
+ * triangles of the bitmap, so lookups never need to order i and j.
+ *
+ * Allocates and returns a struct contact_bitmap, which should be freed with
+ * freebitmap(), or returns NULL on error.
+ */
+struct contact_bitmap *
+make_bitmap(struct distmat dm, double threshold)
+{
+        struct contact_bitmap *bm;
+        const double *drow;
+        const float *frow;
+        const unsigned char *qrow;
+        unsigned char qcontact[256];
+        size_t k;
+        int i, j;
+
+        bm = malloc(sizeof(*bm));
+        if(bm == NULL) return NULL;
+        bm->nres = dm.nres;
+        bm->threshold = threshold;
+        bm->words_per_row = (dm.nres + 63) / 64;
+        bm->bits = calloc((size_t) dm.nres * bm->words_per_row + 1,
+                        sizeof(*bm->bits));
+        if(bm->bits == NULL){
+                free(bm);
+                return NULL;
+        }
+        /* Quantised distances are tested by table, one entry per code */
+        for(j = 0; j < 256; j++)
+                qcontact[j] = dm_unquantize(j) <= threshold;
+        for(i = 0; i < dm.nres; i++){
+                if(0 <= threshold) set_pair(bm, i, i);
+                k = DM_INDEX(dm.nres, i, i + 1);
+                if(dm.precision == DM_UINT8){
+                        qrow = (const unsigned char *) dm.mat + k;
+                        for(j = i + 1; j < dm.nres; j++)
+                                if(qcontact[qrow[j - i - 1]])
+                                        set_pair(bm, i, j);
+                }
+                else if(dm.precision == DM_FLOAT){
+                        frow = (const float *) dm.mat + k;
+                        for(j = i + 1; j < dm.nres; j++)
+                                if(frow[j - i - 1] <= threshold)
+                                        set_pair(bm, i, j);
+                }
+                else {
+                        drow = (const double *) dm.mat + k;
+                        for(j = i + 1; j < dm.nres; j++)
+                                if(drow[j - i - 1] <= threshold)
+                                        set_pair(bm, i, j);
+                }
+        }
+        return bm;
+}
+
+/**
+ * freebitmap: free a struct contact_bitmap allocated by make_bitmap()
+ * @bm: pointer to struct contact_bitmap which is to be freed
+ */
+void
+freebitmap(struct contact_bitmap *bm)
+{
+        if(bm == NULL) return;
+        free(bm->bits);
+        free(bm);
+}
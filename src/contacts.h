@@ -0,0 +1,108 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#ifndef CMAP_CONTACTS_H_
+#define CMAP_CONTACTS_H_
+
+#include<stddef.h>
+#include<stdint.h>
+#include "pdb.h"
+
+/*
+ * A sparse list of contacts in compressed sparse row form: the partners
+ * of residue i (zero-based) are col[rowptr[i]] .. col[rowptr[i+1] - 1],
+ * in increasing order. Only partners j > i are stored.
+ */
+struct contacts{
+        size_t *rowptr;
+        int *col;
+        size_t ncontacts;
+        char *source_filename;
+        char *sequence;
+        char *chain_name;
+        double threshold;
+        int nres;
+        char source_chain;
+};
+
+/*
+ * Contacts between two chains a and b, in the same compressed sparse row
+ * form: the partners in chain b of residue i of chain a are
+ * col[rowptr[i]] .. col[rowptr[i+1] - 1], in increasing order. Indices
+ * are zero-based within each chain.
+ */
+struct interface{
+        size_t *rowptr;
+        int *col;
+        size_t ncontacts;
+        double threshold;
+        int nres_a;
+        int nres_b;
+};
+
+/*
+ * Binary contact list format, written by write_contacts_binary() and read
+ * by read_contacts_binary(). Varints are unsigned LEB128: seven bits per
+ * byte, least significant first, high bit set on all but the last byte.
+ *
+ *   "cmapct"                magic (6 bytes)
+ *   CONTACTS_BIN_VERSION    format version (1 byte)
+ *   threshold               IEEE 754 double, little-endian (8 bytes)
+ *   nres, ncontacts         varints
+ *   chain, source file,     each a varint length + 1 (0 if absent),
+ *   sequence                followed by that many bytes minus one
+ *   nres rows               for each residue i: a varint count of its
+ *                           partners j > i, then each partner as a varint
+ *                           gap from the previous one, starting from i
+ */
+#define CONTACTS_BIN_MAGIC "cmapct"
+#define CONTACTS_BIN_VERSION 2
+
+/*
+ * A square bitmap of contacts: bit j of row i is set if residues i and j
+ * are in contact. Rows are padded to whole 64-bit words, and bits beyond
+ * nres are always clear.
+ */
+struct contact_bitmap{
+        uint64_t *bits;
+        size_t words_per_row;
+        double threshold;
+        int nres;
+};
+
+/*
+ * BITMAP_TEST(bm, i, j):
+ * Non-zero if residues @i and @j are in contact in struct contact_bitmap @bm.
+ */
+#define BITMAP_TEST(bm, i, j) \
+        (((bm).bits[(size_t)(i) * (bm).words_per_row + (j) / 64] \
+          >> ((j) % 64)) & 1)
+
+struct contacts * distmat_contacts(struct distmat dm, double threshold);
+struct contacts * find_contacts(struct coords cs, double threshold);
+struct interface * find_interface(struct coords a, struct coords b,
+                double threshold);
+void freebitmap(struct contact_bitmap *bm);
+void freecontacts(struct contacts *ct);
+void freeinterface(struct interface *ifc);
+struct contact_bitmap * make_bitmap(struct distmat dm, double threshold);
+struct contacts * read_contacts_binary(char *filename);
+
+#endif // CMAP_CONTACTS_H_
@@ -0,0 +1,289 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include"dcd.h"
+#include"ensemble.h"
+#include"input.h"
+#include"pdb.h"
+
+/**
+ * get_u32: read a 32-bit word from a DCD file
+ *
+ * @d:   trajectory
+ * @off: byte offset of the word; must be in the file
+ */
+static uint32_t
+get_u32(const struct dcd *d, size_t off)
+{
+        uint32_t v;
+
+        memcpy(&v, d->in->data + off, sizeof(v));
+        if(d->swap)
+                v = (v >> 24) | ((v >> 8) & 0xff00)
+                        | ((v << 8) & 0xff0000) | (v << 24);
+        return v;
+}
+
+/**
+ * skip_record: step over one Fortran record of a DCD file
+ *
+ * @d:   trajectory
+ * @off: offset of the record's leading length marker; on success, moved
+ *       past its trailing marker
+ *
+ * Returns the length of the record's contents, or -1 if the record runs
+ * past the end of the file or its two markers differ.
+ */
+static long
+skip_record(const struct dcd *d, size_t *off)
+{
+        size_t len;
+
+        if(*off + 4 > d->in->len) return -1;
+        len = get_u32(d, *off);
+        if(len > d->in->len - *off - 4 || d->in->len - *off - 4 - len < 4)
+                return -1;
+        if(get_u32(d, *off + 4 + len) != len) return -1;
+        *off += len + 8;
+        return len;
+}
+
+/**
+ * open_dcd: open a CHARMM or NAMD DCD trajectory
+ *
+ * @filename: path to the trajectory
+ * @err:      set to a description of the problem if the file can't be used
+ *
+ * The file is memory-mapped and its header read. Files written on a
+ * machine of the other byte order are recognised and swapped as they are
+ * read. Files with fixed atoms, which store only the free atoms after the
+ * first frame, aren't supported.
+ *
+ * Returns NULL on failure. Free the result with close_dcd().
+ */
+struct dcd *
+open_dcd(char *filename, char **err)
+{
+        struct dcd *d;
+        uint32_t icntrl[20];
+        size_t off;
+        int charmm, k;
+        long len;
+
+        d = calloc(1, sizeof(*d));
+        if(d == NULL){
+                *err = "couldn't allocate memory";
+                return NULL;
+        }
+        d->in = open_input(filename);
+        if(d->in == NULL){
+                *err = "couldn't read file";
+                goto od_error_cleanup;
+        }
+        *err = "not a DCD trajectory";
+        if(d->in->len < 92) goto od_error_cleanup;
+        if(get_u32(d, 0) != 84){
+                d->swap = 1;
+                if(get_u32(d, 0) != 84) goto od_error_cleanup;
+        }
+        if(memcmp(d->in->data + 4, "CORD", 4) != 0) goto od_error_cleanup;
+        for(k = 0; k < 20; k++)
+                icntrl[k] = get_u32(d, 8 + 4 * k);
+        off = 0;
+        if(skip_record(d, &off) != 84) goto od_error_cleanup;
+        if(icntrl[8] != 0){
+                *err = "trajectories with fixed atoms aren't supported";
+                goto od_error_cleanup;
+        }
+        charmm = icntrl[19] != 0;
+
+        /* Title record, then the number of atoms */
+        if(skip_record(d, &off) < 4) goto od_error_cleanup;
+        if(skip_record(d, &off) != 4) goto od_error_cleanup;
+        d->natoms = get_u32(d, off - 8);
+        if(d->natoms <= 0) goto od_error_cleanup;
+        d->first = off;
+
+        /* Work out the frame size from the first frame */
+        if(charmm && icntrl[10] != 0){
+                len = skip_record(d, &off);
+                if(len < 0) goto od_error_cleanup;
+                d->cell_bytes = len + 8;
+        }
+        for(k = 0; k < (charmm && icntrl[11] != 0 ? 4 : 3); k++){
+                if(skip_record(d, &off) != 4 * (long) d->natoms){
+                        *err = "truncated or corrupt DCD trajectory";
+                        goto od_error_cleanup;
+                }
+        }
+        d->frame_bytes = off - d->first;
+        d->nframes = (d->in->len - d->first) / d->frame_bytes;
+        return d;
+
+        od_error_cleanup:
+        close_dcd(d);
+        return NULL;
+}
+
+/**
+ * dcd_frame: read the alpha carbons of one frame of a trajectory
+ *
+ * @d:     trajectory
+ * @k:     frame number, from 0
+ * @index: atom number of each residue of @cs, or -1 (see ca_atom_index())
+ * @cs:    coordinates to fill in; residues whose atom number is -1 or
+ *         beyond the trajectory's atoms are left as they are
+ *
+ * Returns 0 on success, -1 if the frame is corrupt.
+ */
+int
+dcd_frame(const struct dcd *d, int k, const int *index, struct coords *cs)
+{
+        size_t off = d->first + (size_t) k * d->frame_bytes + d->cell_bytes;
+        size_t rec = 4 * (size_t) d->natoms + 8;
+        size_t xo = off + 4, yo = xo + rec, zo = yo + rec;
+        uint32_t v;
+        float f;
+        int i, a;
+
+        if(get_u32(d, off) != rec - 8 || get_u32(d, off + 2 * rec) != rec - 8)
+                return -1;
+        for(i = 0; i < cs->nres; i++){
+                a = index[i];
+                if(a < 0 || a >= d->natoms) continue;
+                v = get_u32(d, xo + 4 * (size_t) a);
+                memcpy(&f, &v, sizeof(f));
+                cs->x[i] = f;
+                v = get_u32(d, yo + 4 * (size_t) a);
+                memcpy(&f, &v, sizeof(f));
+                cs->y[i] = f;
+                v = get_u32(d, zo + 4 * (size_t) a);
+                memcpy(&f, &v, sizeof(f));
+                cs->z[i] = f;
+        }
+        return 0;
+}
+
+/**
+ * close_dcd: free a struct dcd allocated by open_dcd()
+ */
+void
+close_dcd(struct dcd *d)
+{
+        if(d == NULL) return;
+        if(d->in != NULL) close_input(d->in);
+        free(d);
+}
+
+/**
+ * read_trajectory: gather contact and distance statistics over the frames
+ *                  of a DCD trajectory
+ *
+ * @topology:   PDB file giving the sequence of the chain and, through the
+ *              order of its atom records, which trajectory atoms are its
+ *              alpha carbons
+ * @trajectory: DCD trajectory
+ * @chain:      chain identifier
+ * @threshold:  distance threshold (Angstroms); pairs with distance strictly
+ *              less than this are counted as contacts
+ * @fr:         frames to read, numbered from 1; a last frame of 0 or past
+ *              the end means the last frame of the trajectory
+ * @nthreads:   number of threads to process each frame with
+ * @err:        set to a description of the problem on failure
+ *
+ * The alpha carbons are looked up once. Each frame is then copied from the
+ * mapped trajectory into a single set of coordinates and added to the
+ * ensemble, and the pages holding it released, so memory use doesn't grow
+ * with the length of the trajectory.
+ *
+ * Returns NULL on failure. Free the result with freeensemble().
+ */
+struct ensemble *
+read_trajectory(char *topology, char *trajectory, char chain, double threshold,
+                struct frame_range fr, int nthreads, char **err)
+{
+        struct coords *cs = NULL;
+        struct dcd *d = NULL;
+        struct ensemble *e = NULL;
+        int *index = NULL;
+        int natoms, k;
+        char *tmp;
+        char name[2] = {chain, '\0'};
+
+        cs = getcoords(topology, name);
+        if(cs == NULL){
+                *err = "couldn't read chain from topology file";
+                return NULL;
+        }
+        index = ca_atom_index(topology, cs, &natoms);
+        if(index == NULL){
+                *err = "couldn't read topology file";
+                goto rt_error_cleanup;
+        }
+        d = open_dcd(trajectory, err);
+        if(d == NULL) goto rt_error_cleanup;
+        if(d->natoms != natoms){
+                *err = "topology and trajectory have different numbers of atoms";
+                goto rt_error_cleanup;
+        }
+
+        /* Mark the residues the trajectory has coordinates for */
+        memset(cs->present, 0, (cs->nres + 7) / 8);
+        for(k = 0; k < cs->nres; k++)
+                if(index[k] >= 0)
+                        cs->present[k / 8] |= 1 << (k % 8);
+
+        if(fr.first < 1) fr.first = 1;
+        if(fr.last < 1 || fr.last > d->nframes) fr.last = d->nframes;
+        if(fr.stride < 1) fr.stride = 1;
+        *err = "couldn't allocate memory";
+        tmp = strdup(trajectory);
+        if(tmp == NULL) goto rt_error_cleanup;
+        free(cs->source_filename);
+        cs->source_filename = tmp;
+        e = new_ensemble(cs, threshold, nthreads);
+        if(e == NULL) goto rt_error_cleanup;
+        e->first_frame = fr.first;
+        e->frame_step = fr.stride;
+        for(k = fr.first - 1; k < fr.last; k += fr.stride){
+                if(dcd_frame(d, k, index, cs) != 0){
+                        *err = "corrupt frame in DCD trajectory";
+                        goto rt_error_cleanup;
+                }
+                if(add_frame(e, cs) != 0) goto rt_error_cleanup;
+                release_input(d->in, d->in->data + d->first
+                                + (size_t) (k + 1) * d->frame_bytes);
+        }
+        close_dcd(d);
+        free(index);
+        freecoords(cs);
+        return e;
+
+        rt_error_cleanup:
+        close_dcd(d);
+        free(index);
+        freecoords(cs);
+        freeensemble(e);
+        return NULL;
+}
@@ -0,0 +1,59 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#ifndef CMAP_DCD_H_
+#define CMAP_DCD_H_
+
+#include<stddef.h>
+#include "ensemble.h"
+#include "input.h"
+#include "pdb.h"
+
+/*
+ * A CHARMM/NAMD DCD trajectory, memory-mapped. Every frame has the same
+ * size, so frame k starts at @first + k * @frame_bytes. Each frame is an
+ * optional unit cell record, then the x, y and z records of @natoms
+ * single precision floats, then an optional fourth dimension record.
+ */
+struct dcd{
+        struct inputbuf *in;
+        size_t first;
+        size_t frame_bytes;
+        size_t cell_bytes;
+        int natoms;
+        int nframes;
+        int swap;
+};
+
+/* Frames to read from a trajectory: first, first + stride, ... up to last */
+struct frame_range{
+        int first;
+        int last;
+        int stride;
+};
+
+void close_dcd(struct dcd *d);
+int dcd_frame(const struct dcd *d, int k, const int *index, struct coords *cs);
+struct dcd * open_dcd(char *filename, char **err);
+struct ensemble * read_trajectory(char *topology, char *trajectory, char chain,
+                double threshold, struct frame_range fr, int nthreads,
+                char **err);
+
+#endif // CMAP_DCD_H_
@@ -0,0 +1,417 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#include<math.h>
+#include<stddef.h>
+
+#include"atoms.h"
+#include"distance.h"
+#include"pdb.h"
+
+/*
+ * Vector kernels are compiled for x86 with GCC-compatible compilers, using
+ * per-function target attributes so the rest of the program keeps the
+ * default instruction set. The best kernel the CPU supports is chosen at
+ * run time; everywhere else the scalar kernel is used.
+ *
+ * All kernels perform the same IEEE operations in the same order as
+ * euclid3d(), so they produce identical results. That requires GCC not to
+ * fuse the multiplies and adds where the target has FMA (AVX-512 does).
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CMAP_X86_KERNELS
+#include<immintrin.h>
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+/*
+ * A row kernel computes the distances from the point (xi, yi, zi) to the
+ * @n points (x[k], y[k], z[k]), storing them in out[k]. If @squared is
+ * non-zero, squared distances are stored instead and no square roots are
+ * taken.
+ */
+typedef void (*row_kernel)(double xi, double yi, double zi,
+                const double *x, const double *y, const double *z,
+                int n, double *out, int squared);
+
+/*
+ * A min kernel returns the shortest squared distance between any of the
+ * @na points (xa[a], ya[a], za[a]) and any of the @n points (x[k], y[k],
+ * z[k]), or infinity if there are none. Each squared distance is computed
+ * exactly as by a row kernel.
+ */
+typedef double (*min_kernel)(const double *xa, const double *ya,
+                const double *za, int na, const double *x, const double *y,
+                const double *z, int n);
+
+static void
+row_scalar(double xi, double yi, double zi,
+           const double *x, const double *y, const double *z,
+           int n, double *out, int squared)
+{
+        int k;
+        double dx, dy, dz, d2;
+        for(k = 0; k < n; k++){
+                dx = xi - x[k];
+                dy = yi - y[k];
+                dz = zi - z[k];
+                d2 = dx * dx + dy * dy + dz * dz;
+                out[k] = squared ? d2 : sqrt(d2);
+        }
+}
+
+static double
+min_scalar(const double *xa, const double *ya, const double *za, int na,
+           const double *x, const double *y, const double *z, int n)
+{
+        double dx, dy, dz, d2, best = INFINITY;
+        int a, k;
+
+        for(a = 0; a < na; a++)
+                for(k = 0; k < n; k++){
+                        dx = xa[a] - x[k];
+                        dy = ya[a] - y[k];
+                        dz = za[a] - z[k];
+                        d2 = dx * dx + dy * dy + dz * dz;
+                        if(d2 < best) best = d2;
+                }
+        return best;
+}
+
+#ifdef CMAP_X86_KERNELS
+__attribute__((target("sse2")))
+static void
+row_sse2(double xi, double yi, double zi,
+         const double *x, const double *y, const double *z,
+         int n, double *out, int squared)
+{
+        int k;
+        __m128d vxi = _mm_set1_pd(xi);
+        __m128d vyi = _mm_set1_pd(yi);
+        __m128d vzi = _mm_set1_pd(zi);
+        __m128d dx, dy, dz, d2;
+
+        for(k = 0; k + 2 <= n; k += 2){
+                dx = _mm_sub_pd(vxi, _mm_loadu_pd(x + k));
+                dy = _mm_sub_pd(vyi, _mm_loadu_pd(y + k));
+                dz = _mm_sub_pd(vzi, _mm_loadu_pd(z + k));
+                d2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx),
+                                           _mm_mul_pd(dy, dy)),
+                                _mm_mul_pd(dz, dz));
+                if(!squared) d2 = _mm_sqrt_pd(d2);
+                _mm_storeu_pd(out + k, d2);
+        }
+        row_scalar(xi, yi, zi, x + k, y + k, z + k, n - k, out + k, squared);
+}
+
+__attribute__((target("sse2")))
+static double
+min_sse2(const double *xa, const double *ya, const double *za, int na,
+         const double *x, const double *y, const double *z, int n)
+{
+        __m128d vx, vy, vz, dx, dy, dz, d2;
+        __m128d best = _mm_set1_pd(INFINITY);
+        double lane[2], rest;
+        int a, k = 0;
+
+        if(n < 2) return min_scalar(xa, ya, za, na, x, y, z, n);
+        for(a = 0; a < na; a++){
+                vx = _mm_set1_pd(xa[a]);
+                vy = _mm_set1_pd(ya[a]);
+                vz = _mm_set1_pd(za[a]);
+                for(k = 0; k + 2 <= n; k += 2){
+                        dx = _mm_sub_pd(vx, _mm_loadu_pd(x + k));
+                        dy = _mm_sub_pd(vy, _mm_loadu_pd(y + k));
+                        dz = _mm_sub_pd(vz, _mm_loadu_pd(z + k));
+                        d2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx),
+                                                   _mm_mul_pd(dy, dy)),
+                                        _mm_mul_pd(dz, dz));
+                        best = _mm_min_pd(best, d2);
+                }
+        }
+        _mm_storeu_pd(lane, best);
+        rest = min_scalar(xa, ya, za, na, x + k, y + k, z + k, n - k);
+        if(lane[1] < lane[0]) lane[0] = lane[1];
+        return rest < lane[0] ? rest : lane[0];
+}
+
+__attribute__((target("avx2")))
+static void
+row_avx2(double xi, double yi, double zi,
+         const double *x, const double *y, const double *z,
+         int n, double *out, int squared)
+{
+        int k;
+        __m256d vxi = _mm256_set1_pd(xi);
+        __m256d vyi = _mm256_set1_pd(yi);
+        __m256d vzi = _mm256_set1_pd(zi);
+        __m256d dx, dy, dz, d2;
+
+        for(k = 0; k + 4 <= n; k += 4){
+                dx = _mm256_sub_pd(vxi, _mm256_loadu_pd(x + k));
+                dy = _mm256_sub_pd(vyi, _mm256_loadu_pd(y + k));
+                dz = _mm256_sub_pd(vzi, _mm256_loadu_pd(z + k));
+                d2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx),
+                                                 _mm256_mul_pd(dy, dy)),
+                                   _mm256_mul_pd(dz, dz));
+                if(!squared) d2 = _mm256_sqrt_pd(d2);
+                _mm256_storeu_pd(out + k, d2);
+        }
+        row_scalar(xi, yi, zi, x + k, y + k, z + k, n - k, out + k, squared);
+}
+
+__attribute__((target("avx2")))
+static double
+min_avx2(const double *xa, const double *ya, const double *za, int na,
+         const double *x, const double *y, const double *z, int n)
+{
+        __m256d vx, vy, vz, dx, dy, dz, d2;
+        __m256d best = _mm256_set1_pd(INFINITY);
+        double lane[4], rest;
+        int a, k = 0, m;
+
+        if(n < 4) return min_sse2(xa, ya, za, na, x, y, z, n);
+        for(a = 0; a < na; a++){
+                vx = _mm256_set1_pd(xa[a]);
+                vy = _mm256_set1_pd(ya[a]);
+                vz = _mm256_set1_pd(za[a]);
+                for(k = 0; k + 4 <= n; k += 4){
+                        dx = _mm256_sub_pd(vx, _mm256_loadu_pd(x + k));
+                        dy = _mm256_sub_pd(vy, _mm256_loadu_pd(y + k));
+                        dz = _mm256_sub_pd(vz, _mm256_loadu_pd(z + k));
+                        d2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx),
+                                                         _mm256_mul_pd(dy, dy)),
+                                           _mm256_mul_pd(dz, dz));
+                        best = _mm256_min_pd(best, d2);
+                }
+        }
+        _mm256_storeu_pd(lane, best);
+        /*
+         * GCC doesn't always clear the upper halves on the way out of here,
+         * and SSE code run while they are dirty is slowed down badly.
+         */
+        _mm256_zeroupper();
+        rest = min_scalar(xa, ya, za, na, x + k, y + k, z + k, n - k);
+        for(m = 0; m < 4; m++)
+                if(lane[m] < rest) rest = lane[m];
+        return rest;
+}
+
+__attribute__((target("avx512f")))
+static void
+row_avx512(double xi, double yi, double zi,
+           const double *x, const double *y, const double *z,
+           int n, double *out, int squared)
+{
+        int k;
+        __m512d vxi = _mm512_set1_pd(xi);
+        __m512d vyi = _mm512_set1_pd(yi);
+        __m512d vzi = _mm512_set1_pd(zi);
+        __m512d dx, dy, dz, d2;
+
+        for(k = 0; k + 8 <= n; k += 8){
+                dx = _mm512_sub_pd(vxi, _mm512_loadu_pd(x + k));
+                dy = _mm512_sub_pd(vyi, _mm512_loadu_pd(y + k));
+                dz = _mm512_sub_pd(vzi, _mm512_loadu_pd(z + k));
+                d2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx),
+                                                 _mm512_mul_pd(dy, dy)),
+                                   _mm512_mul_pd(dz, dz));
+                if(!squared) d2 = _mm512_sqrt_pd(d2);
+                _mm512_storeu_pd(out + k, d2);
+        }
+        row_scalar(xi, yi, zi, x + k, y + k, z + k, n - k, out + k, squared);
+}
+
+__attribute__((target("avx512f")))
+static double
+min_avx512(const double *xa, const double *ya, const double *za, int na,
+           const double *x, const double *y, const double *z, int n)
+{
+        __m512d vx, vy, vz, dx, dy, dz, d2;
+        __m512d best = _mm512_set1_pd(INFINITY);
+        double low, rest;
+        int a, k = 0;
+
+        if(n < 8) return min_avx2(xa, ya, za, na, x, y, z, n);
+        for(a = 0; a < na; a++){
+                vx = _mm512_set1_pd(xa[a]);
+                vy = _mm512_set1_pd(ya[a]);
+                vz = _mm512_set1_pd(za[a]);
+                for(k = 0; k + 8 <= n; k += 8){
+                        dx = _mm512_sub_pd(vx, _mm512_loadu_pd(x + k));
+                        dy = _mm512_sub_pd(vy, _mm512_loadu_pd(y + k));
+                        dz = _mm512_sub_pd(vz, _mm512_loadu_pd(z + k));
+                        d2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, dx),
+                                                         _mm512_mul_pd(dy, dy)),
+                                           _mm512_mul_pd(dz, dz));
+                        best = _mm512_min_pd(best, d2);
+                }
+        }
+        low = _mm512_reduce_min_pd(best);
+        _mm256_zeroupper();     /* see min_avx2() */
+        rest = min_scalar(xa, ya, za, na, x + k, y + k, z + k, n - k);
+        return rest < low ? rest : low;
+}
+#endif
+
+static row_kernel g_kernel = NULL;
+static min_kernel g_min_kernel = NULL;
+static const char *g_kernel_name = "scalar";
+
+/**
+ * select_kernel: pick the widest row and min kernels supported by this CPU
+ *
+ * Safe to call from several threads at once: every caller stores the same
+ * values.
+ */
+static void
+select_kernel(void)
+{
+        row_kernel k = row_scalar;
+        min_kernel m = min_scalar;
+        const char *name = "scalar";
+#ifdef CMAP_X86_KERNELS
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx512f")){
+                k = row_avx512;
+                m = min_avx512;
+                name = "avx512";
+        }
+        else if(__builtin_cpu_supports("avx2")){
+                k = row_avx2;
+                m = min_avx2;
+                name = "avx2";
+        }
+        else if(__builtin_cpu_supports("sse2")){
+                k = row_sse2;
+                m = min_sse2;
+                name = "sse2";
+        }
+#endif
+        g_kernel_name = name;
+        g_min_kernel = m;
+        g_kernel = k;
+}
+
+/**
+ * dist_kernel_name: name of the distance kernel selected for this CPU
+ */
+const char *
+dist_kernel_name(void)
+{
+        if(g_kernel == NULL) select_kernel();
+        return g_kernel_name;
+}
+
+/**
+ * dist_points: compute distances from one point to an array of points
+ *
+ * @xi, @yi, @zi: the reference point
+ * @x, @y, @z:    coordinates of the other points
+ * @n:            number of other points
+ * @out:          array of at least @n doubles to receive the distances
+ * @squared:      if non-zero, store squared distances and skip the square root
+ *
+ * Uses the same kernel as dist_row(), so a pair gives the same distance
+ * either way, provided the reference point is the same residue.
+ */
+void
+dist_points(double xi, double yi, double zi, const double *x, const double *y,
+                const double *z, int n, double *out, int squared)
+{
+        if(n <= 0) return;
+        if(g_kernel == NULL) select_kernel();
+        g_kernel(xi, yi, zi, x, y, z, n, out, squared);
+}
+
+/**
+ * dist_min2: shortest squared distance between two sets of points
+ *
+ * @xa, @ya, @za: coordinates of the first set
+ * @na:           number of points in the first set
+ * @x, @y, @z:    coordinates of the second set
+ * @n:            number of points in the second set
+ *
+ * Each squared distance is computed as by dist_points(). The second set
+ * is the one run through the vector registers, so should be the larger.
+ *
+ * Returns infinity if either set is empty.
+ */
+double
+dist_min2(const double *xa, const double *ya, const double *za, int na,
+                const double *x, const double *y, const double *z, int n)
+{
+        if(na <= 0 || n <= 0) return INFINITY;
+        if(g_min_kernel == NULL) select_kernel();
+        return g_min_kernel(xa, ya, za, na, x, y, z, n);
+}
+
+/**
+ * dist_row: compute a run of distances from one residue to many
+ *
+ * @cs:      coordinates
+ * @i:       index of the reference residue
+ * @start:   index of the first residue to measure to
+ * @n:       number of residues to measure to, i.e. @start .. @start + n - 1
+ * @out:     array of at least @n doubles to receive the distances
+ * @squared: if non-zero, store squared distances and skip the square root
+ *
+ * Pairs where either residue has no coordinates get the distance
+ * DIST_MISSING (or its square, in squared mode). If @cs has atoms, the
+ * distances are between residues' nearest heavy atoms; see
+ * atom_dist_row().
+ */
+void
+dist_row(const struct coords *cs, int i, int start, int n, double *out,
+                int squared)
+{
+        double missing = squared ? DIST_MISSING * DIST_MISSING : DIST_MISSING;
+        int k, j;
+
+        if(cs->atoms != NULL){
+                atom_dist_row(cs->atoms, i, start, n, out, squared);
+                return;
+        }
+        if(n <= 0) return;
+        if(!RES_PRESENT(*cs, i)){
+                for(k = 0; k < n; k++)
+                        out[k] = missing;
+                return;
+        }
+        if(g_kernel == NULL) select_kernel();
+        g_kernel(cs->x[i], cs->y[i], cs->z[i], cs->x + start, cs->y + start,
+                        cs->z + start, n, out, squared);
+
+        /* Patch up missing residues, skipping whole bytes of the mask that
+         * are fully present */
+        for(j = start; j < start + n; ){
+                if(j % 8 == 0 && j + 8 <= start + n
+                                && cs->present[j / 8] == 0xff){
+                        j += 8;
+                        continue;
+                }
+                if(!RES_PRESENT(*cs, j))
+                        out[j - start] = missing;
+                j++;
+        }
+}
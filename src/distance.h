@@ -0,0 +1,37 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#ifndef CMAP_DISTANCE_H_
+#define CMAP_DISTANCE_H_
+
+#include "pdb.h"
+
+/* Distance reported for pairs involving a residue without coordinates */
+#define DIST_MISSING 999.
+
+const char * dist_kernel_name(void);
+double dist_min2(const double *xa, const double *ya, const double *za, int na,
+                const double *x, const double *y, const double *z, int n);
+void dist_points(double xi, double yi, double zi, const double *x, const double *y,
+                const double *z, int n, double *out, int squared);
+void dist_row(const struct coords *cs, int i, int start, int n, double *out,
+                int squared);
+
+#endif // CMAP_DISTANCE_H_
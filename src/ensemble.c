@@ -0,0 +1,330 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#include<math.h>
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+
+#include"distance.h"
+#include"ensemble.h"
+#include"pdb.h"
+#include"threads.h"
+
+/* Work shared by the threads adding one frame to an ensemble */
+struct ens_job{
+        const struct coords *cs;
+        struct ensemble *e;
+        size_t *count;          /* contacts found in each band */
+};
+
+/**
+ * ens_band: add one band of rows of a frame to the ensemble statistics
+ *
+ * @arg: pointer to struct ens_job
+ * @k:   band number; band k covers rows band[k] .. band[k+1] - 1
+ *
+ * Distances are computed a block of a row at a time, and only pairs where
+ * both residues have coordinates in this frame are counted.
+ */
+static void
+ens_band(void *arg, size_t k)
+{
+        struct ens_job *job = arg;
+        const struct coords *cs = job->cs;
+        struct ensemble *e = job->e;
+        double block[256];
+        double d, delta;
+        size_t idx, count = 0;
+        uint32_t n;
+        int i, j, m, r;
+
+        for(i = e->band[k]; i < e->band[k + 1]; i++){
+                if(!RES_PRESENT(*cs, i)) continue;
+                idx = DM_INDEX(cs->nres, i, i + 1);
+                for(j = i + 1; j < cs->nres; j += 256){
+                        m = cs->nres - j < 256 ? cs->nres - j : 256;
+                        dist_row(cs, i, j, m, block, 0);
+                        for(r = 0; r < m; r++, idx++){
+                                if(!RES_PRESENT(*cs, j + r)) continue;
+                                d = block[r];
+                                n = ++e->nobs[idx];
+                                if(d < e->threshold){
+                                        e->ncontact[idx]++;
+                                        count++;
+                                }
+                                delta = d - e->mean[idx];
+                                e->mean[idx] += delta / n;
+                                e->m2[idx] += delta * (d - e->mean[idx]);
+                        }
+                }
+        }
+        job->count[k] = count;
+}
+
+/**
+ * new_ensemble: start an empty ensemble for a chain
+ *
+ * @cs:        coordinates giving the chain's name, length and sequence;
+ *             only their layout is used
+ * @threshold: distance threshold (Angstroms); pairs with distance strictly
+ *             less than this are counted as contacts
+ * @nthreads:  number of threads to add each frame with
+ *
+ * The triangle of residue pairs is split into bands of roughly equal work
+ * once, as in calculate_distmat(), and reused for every frame.
+ *
+ * Returns NULL if memory can't be allocated. Free the result with
+ * freeensemble().
+ */
+struct ensemble *
+new_ensemble(const struct coords *cs, double threshold, int nthreads)
+{
+        struct ensemble *e;
+        size_t pairs, target, size;
+        int nres = cs->nres;
+        int i, k;
+
+        e = calloc(1, sizeof(*e));
+        if(e == NULL) return NULL;
+        e->nres = nres;
+        e->threshold = threshold;
+        e->source_chain = cs->source_chain;
+        e->first_frame = 1;
+        e->frame_step = 1;
+        if(cs->chain_name != NULL){
+                e->chain_name = strdup(cs->chain_name);
+                if(e->chain_name == NULL) goto ne_error_cleanup;
+        }
+        if(cs->source_filename != NULL){
+                e->source_filename = strdup(cs->source_filename);
+                if(e->source_filename == NULL) goto ne_error_cleanup;
+        }
+        if(cs->sequence != NULL){
+                e->sequence = strdup(cs->sequence);
+                if(e->sequence == NULL) goto ne_error_cleanup;
+        }
+        size = DM_SIZE(nres) + 1;
+        e->nobs = calloc(size, sizeof(*(e->nobs)));
+        e->ncontact = calloc(size, sizeof(*(e->ncontact)));
+        e->mean = calloc(size, sizeof(*(e->mean)));
+        e->m2 = calloc(size, sizeof(*(e->m2)));
+        e->present = calloc((nres + 7) / 8 + 1, 1);
+        if(e->nobs == NULL || e->ncontact == NULL || e->mean == NULL
+                        || e->m2 == NULL || e->present == NULL)
+                goto ne_error_cleanup;
+
+        /* Split the triangle into bands of roughly equal work */
+        if(nthreads < 1) nthreads = 1;
+        e->nthreads = nthreads;
+        e->nbands = nthreads == 1 ? 1 : 8 * nthreads;
+        if(e->nbands > nres - 1) e->nbands = nres - 1;
+        if(e->nbands < 1) e->nbands = 1;
+        e->band = malloc((e->nbands + 1) * sizeof(*(e->band)));
+        if(e->band == NULL) goto ne_error_cleanup;
+        target = DM_SIZE(nres) / e->nbands + 1;
+        e->band[0] = 0;
+        pairs = 0;
+        for(i = 0, k = 1; i < nres - 1 && k < e->nbands; i++){
+                pairs += nres - i - 1;
+                if(pairs >= target * k) e->band[k++] = i + 1;
+        }
+        while(k <= e->nbands) e->band[k++] = nres > 0 ? nres - 1 : 0;
+        return e;
+
+        ne_error_cleanup:
+        freeensemble(e);
+        return NULL;
+}
+
+/**
+ * add_frame: add one frame of coordinates to an ensemble
+ *
+ * @e:  ensemble from new_ensemble()
+ * @cs: coordinates of the frame, laid out like those @e was created from
+ *
+ * Updates the running statistics of every pair of residues with
+ * coordinates in @cs, and records how many of them are in contact.
+ *
+ * Returns 0 on success, -1 if memory can't be allocated.
+ */
+int
+add_frame(struct ensemble *e, const struct coords *cs)
+{
+        struct ens_job job;
+        size_t *tmp;
+        size_t total;
+        int i, cap;
+
+        if(e->nframes == e->frame_cap){
+                cap = e->frame_cap > 0 ? 2 * e->frame_cap : 64;
+                tmp = realloc(e->frame_contacts, cap * sizeof(*tmp));
+                if(tmp == NULL) return -1;
+                e->frame_contacts = tmp;
+                e->frame_cap = cap;
+        }
+        job.cs = cs;
+        job.e = e;
+        job.count = calloc(e->nbands, sizeof(*(job.count)));
+        if(job.count == NULL) return -1;
+        if(run_chunks(e->nthreads, e->nbands, ens_band, &job) != 0){
+                free(job.count);
+                return -1;
+        }
+        for(i = 0, total = 0; i < e->nbands; i++)
+                total += job.count[i];
+        free(job.count);
+        for(i = 0; i < (e->nres + 7) / 8; i++)
+                e->present[i] |= cs->present[i];
+        e->frame_contacts[e->nframes++] = total;
+        return 0;
+}
+
+/**
+ * read_ensemble: gather contact and distance statistics over the models of
+ *                a PDB file
+ *
+ * @filename:  string containing path to Protein Data Bank file, or "-" to
+ *             read from standard input
+ * @chain:     chain identifier
+ * @threshold: distance threshold (Angstroms); pairs with distance strictly
+ *             less than this are counted as contacts
+ * @nthreads:  number of threads to process each model with
+ *
+ * Models are read one at a time into a single set of coordinates (see
+ * next_model()) and added to running totals, so memory use depends on the
+ * length of the chain and not on the number of models.
+ *
+ * Returns NULL if the file can't be read or decompressed, memory can't be
+ * allocated, or the chain has no sequence. Free the result with
+ * freeensemble().
+ */
+struct ensemble *
+read_ensemble(char *filename, char chain, double threshold, int nthreads)
+{
+        struct model_reader *mr;
+        struct ensemble *e;
+        int ret;
+
+        mr = open_models(filename, chain);
+        if(mr == NULL) return NULL;
+        e = new_ensemble(mr->cs, threshold, nthreads);
+        if(e == NULL) goto re_error_cleanup;
+        while((ret = next_model(mr)) == 1){
+                if(add_frame(e, mr->cs) != 0)
+                        goto re_error_cleanup;
+        }
+        if(ret != 0) goto re_error_cleanup;
+        close_models(mr);
+        return e;
+
+        re_error_cleanup:
+        close_models(mr);
+        freeensemble(e);
+        return NULL;
+}
+
+/**
+ * pair_index: packed index of a residue pair given in either order
+ */
+static size_t
+pair_index(const struct ensemble *e, int i, int j)
+{
+        return i < j ? DM_INDEX(e->nres, i, j) : DM_INDEX(e->nres, j, i);
+}
+
+/**
+ * ensemble_freq: fraction of models in which two residues are in contact
+ *
+ * @e:     ensemble statistics
+ * @i, @j: zero-based residue indices, in either order
+ *
+ * A residue is in contact with itself if it has coordinates in any model.
+ * Pairs never observed together have frequency 0.
+ */
+double
+ensemble_freq(const struct ensemble *e, int i, int j)
+{
+        size_t idx;
+
+        if(i == j) return (e->present[i / 8] >> (i % 8)) & 1;
+        idx = pair_index(e, i, j);
+        if(e->nobs[idx] == 0) return 0;
+        return (double) e->ncontact[idx] / e->nobs[idx];
+}
+
+/**
+ * ensemble_mean: mean distance between two residues over the ensemble
+ *
+ * @e:     ensemble statistics
+ * @i, @j: zero-based residue indices, in either order
+ *
+ * Returns DIST_MISSING for pairs never observed together.
+ */
+double
+ensemble_mean(const struct ensemble *e, int i, int j)
+{
+        size_t idx;
+
+        if(i == j) return 0;
+        idx = pair_index(e, i, j);
+        if(e->nobs[idx] == 0) return DIST_MISSING;
+        return e->mean[idx];
+}
+
+/**
+ * ensemble_sd: standard deviation of the distance between two residues
+ *
+ * @e:     ensemble statistics
+ * @i, @j: zero-based residue indices, in either order
+ *
+ * The population standard deviation over the models in which both
+ * residues have coordinates; 0 for pairs never observed together.
+ */
+double
+ensemble_sd(const struct ensemble *e, int i, int j)
+{
+        size_t idx;
+
+        if(i == j) return 0;
+        idx = pair_index(e, i, j);
+        if(e->nobs[idx] == 0) return 0;
+        return sqrt(e->m2[idx] / e->nobs[idx]);
+}
+
+/**
+ * freeensemble: free a struct ensemble allocated by read_ensemble()
+ */
+void
+freeensemble(struct ensemble *e)
+{
+        if(e == NULL) return;
+        free(e->nobs);
+        free(e->ncontact);
+        free(e->mean);
+        free(e->m2);
+        free(e->present);
+        free(e->band);
+        free(e->frame_contacts);
+        free(e->source_filename);
+        free(e->sequence);
+        free(e->chain_name);
+        free(e);
+}
@@ -0,0 +1,70 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#ifndef CMAP_ENSEMBLE_H_
+#define CMAP_ENSEMBLE_H_
+
+#include<stdint.h>
+#include "pdb.h"
+
+/*
+ * Statistics of one chain over all the models of an ensemble, for each
+ * residue pair i < j, packed like a distance matrix (see DM_INDEX): the
+ * number of models with coordinates for both residues, how many of those
+ * had the pair closer than @threshold, and the running mean and sum of
+ * squared deviations (Welford) of their distance. @present marks the
+ * residues with coordinates in at least one model, as in struct coords.
+ *
+ * Frames are numbered @first_frame, @first_frame + @frame_step, ... and
+ * @frame_contacts holds the number of contacts in each.
+ */
+struct ensemble{
+        uint32_t *nobs;
+        uint32_t *ncontact;
+        double *mean;
+        double *m2;
+        unsigned char *present;
+        char *source_filename;
+        char *sequence;
+        char *chain_name;
+        double threshold;
+        int nres;
+        int nframes;
+        size_t *frame_contacts;
+        int frame_cap;
+        int first_frame;
+        int frame_step;
+        int *band;
+        int nbands;
+        int nthreads;
+        char source_chain;
+};
+
+int add_frame(struct ensemble *e, const struct coords *cs);
+double ensemble_freq(const struct ensemble *e, int i, int j);
+double ensemble_mean(const struct ensemble *e, int i, int j);
+double ensemble_sd(const struct ensemble *e, int i, int j);
+void freeensemble(struct ensemble *e);
+struct ensemble * new_ensemble(const struct coords *cs, double threshold,
+                int nthreads);
+struct ensemble * read_ensemble(char *filename, char chain, double threshold,
+                int nthreads);
+
+#endif // CMAP_ENSEMBLE_H_
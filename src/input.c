@@ -0,0 +1,654 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#include<bzlib.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<limits.h>
+#include<pthread.h>
+#include<stdint.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+#include<zlib.h>
+
+#include"input.h"
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+/* Bytes of compressed input read at a time */
+#define STREAM_CHUNK (256 * 1024)
+
+/* How far decompression may run ahead of the reader */
+#define STREAM_AHEAD (8 * 1024 * 1024)
+
+enum input_format{
+        FORMAT_PLAIN,
+        FORMAT_GZIP,
+        FORMAT_BZIP2,
+        FORMAT_ZSTD
+};
+
+/*
+ * A compressed input being decompressed by a thread of its own. The
+ * output goes straight into in->data, which is a reservation of address
+ * space large enough that it never has to move, so the parser can read
+ * the start of the file while the rest is still arriving.
+ *
+ * @avail, @done and @failed are shared with the thread and guarded by
+ * @lock; in->len is only touched by the reading thread, which brings it
+ * up to @avail when it runs out of data, and tells the decompressor so
+ * through @seen. The decompressor stays at most STREAM_AHEAD bytes past
+ * @seen, so that a reader which releases what it has parsed (see
+ * release_input()) keeps little of the file in memory.
+ */
+struct input_stream{
+        pthread_t thread;
+        pthread_mutex_t lock;
+        pthread_cond_t more;
+        pthread_cond_t room;
+        int fd;
+        enum input_format format;
+        unsigned char head[4];
+        size_t nhead;
+        size_t cap;
+        size_t avail;
+        size_t seen;
+        int done;
+        int failed;
+        int cancel;
+};
+
+/**
+ * read_all: read everything from a file descriptor into a growable buffer
+ *
+ * @fd:    file descriptor open for reading
+ * @in:    input buffer to fill
+ * @head:  bytes already read from @fd, which start the buffer
+ * @nhead: number of bytes at @head
+ *
+ * Used for stdin, pipes and anything else that can't be memory-mapped.
+ * The buffer doubles in size whenever it fills up.
+ *
+ * Returns 0 on success, -1 on a read or allocation error.
+ */
+static int
+read_all(int fd, struct inputbuf *in, const unsigned char *head, size_t nhead)
+{
+        size_t cap = 1 << 16;
+        char *tmp;
+        ssize_t got;
+
+        in->data = malloc(cap);
+        if(in->data == NULL) return -1;
+        memcpy(in->data, head, nhead);
+        in->len = nhead;
+        in->mapped = 0;
+        while(1){
+                if(in->len == cap){
+                        cap *= 2;
+                        tmp = realloc(in->data, cap);
+                        if(tmp == NULL) goto ra_error_cleanup;
+                        in->data = tmp;
+                }
+                got = read(fd, in->data + in->len, cap - in->len);
+                if(got == 0) break;
+                if(got < 0) goto ra_error_cleanup;
+                in->len += got;
+        }
+        return 0;
+
+        ra_error_cleanup:
+        free(in->data);
+        in->data = NULL;
+        in->len = 0;
+        return -1;
+}
+
+/**
+ * input_format: recognise a compressed file by its first bytes
+ */
+static enum input_format
+input_format(const unsigned char *head, size_t n)
+{
+        if(n >= 2 && head[0] == 0x1f && head[1] == 0x8b)
+                return FORMAT_GZIP;
+        if(n >= 3 && memcmp(head, "BZh", 3) == 0)
+                return FORMAT_BZIP2;
+        if(n >= 4 && head[0] == 0x28 && head[1] == 0xb5 && head[2] == 0x2f
+                        && head[3] == 0xfd)
+                return FORMAT_ZSTD;
+        return FORMAT_PLAIN;
+}
+
+/**
+ * publish: make decompressed bytes visible to the reading thread
+ *
+ * @s:   stream
+ * @out: total number of bytes decompressed so far
+ *
+ * Waits while the reader is more than STREAM_AHEAD bytes behind.
+ *
+ * Returns non-zero if the reader has asked for decompression to stop.
+ */
+static int
+publish(struct input_stream *s, size_t out)
+{
+        int cancel;
+
+        pthread_mutex_lock(&s->lock);
+        s->avail = out;
+        pthread_cond_broadcast(&s->more);
+        while(out - s->seen > STREAM_AHEAD && !s->cancel)
+                pthread_cond_wait(&s->room, &s->lock);
+        cancel = s->cancel;
+        pthread_mutex_unlock(&s->lock);
+        return cancel;
+}
+
+/**
+ * read_chunk: read the next piece of compressed input
+ *
+ * The bytes sniffed by open_input() come first, then the rest of the file.
+ *
+ * Returns the number of bytes read, 0 at the end of the file, or -1 on
+ * error.
+ */
+static ssize_t
+read_chunk(struct input_stream *s, unsigned char *buf)
+{
+        ssize_t got;
+
+        if(s->nhead > 0){
+                memcpy(buf, s->head, s->nhead);
+                got = s->nhead;
+                s->nhead = 0;
+                return got;
+        }
+        do{
+                got = read(s->fd, buf, STREAM_CHUNK);
+        }while(got < 0 && errno == EINTR);
+        return got;
+}
+
+/**
+ * inflate_gzip: decompress a gzip stream into the input buffer
+ *
+ * Concatenated gzip members, as written by parallel compressors, are
+ * decompressed one after another.
+ *
+ * Returns 0 on success, -1 if the data is corrupt or truncated, doesn't
+ * fit, or decompression was cancelled.
+ */
+static int
+inflate_gzip(struct inputbuf *in, unsigned char *buf)
+{
+        struct input_stream *s = in->stream;
+        z_stream z;
+        size_t out = 0;
+        ssize_t got;
+        int ret, ended = 0;
+
+        memset(&z, 0, sizeof(z));
+        if(inflateInit2(&z, 15 + 32) != Z_OK) return -1;
+        while((got = read_chunk(s, buf)) > 0){
+                z.next_in = buf;
+                z.avail_in = got;
+                while(z.avail_in > 0){
+                        if(ended){
+                                if(inflateReset(&z) != Z_OK) goto ig_error;
+                                ended = 0;
+                        }
+                        if(out == s->cap) goto ig_error;
+                        z.next_out = (unsigned char *) in->data + out;
+                        z.avail_out = s->cap - out > UINT_MAX
+                                ? UINT_MAX : s->cap - out;
+                        ret = inflate(&z, Z_NO_FLUSH);
+                        out = (char *) z.next_out - in->data;
+                        if(ret == Z_STREAM_END) ended = 1;
+                        else if(ret != Z_OK) goto ig_error;
+                }
+                if(publish(s, out)) goto ig_error;
+        }
+        inflateEnd(&z);
+        return got == 0 && ended ? 0 : -1;
+
+        ig_error:
+        inflateEnd(&z);
+        return -1;
+}
+
+/**
+ * inflate_bzip2: decompress a bzip2 stream into the input buffer
+ *
+ * As inflate_gzip(), including concatenated streams.
+ */
+static int
+inflate_bzip2(struct inputbuf *in, unsigned char *buf)
+{
+        struct input_stream *s = in->stream;
+        bz_stream b;
+        size_t out = 0;
+        ssize_t got;
+        unsigned int left;
+        int ret, ended = 0;
+
+        memset(&b, 0, sizeof(b));
+        if(BZ2_bzDecompressInit(&b, 0, 0) != BZ_OK) return -1;
+        while((got = read_chunk(s, buf)) > 0){
+                b.next_in = (char *) buf;
+                b.avail_in = got;
+                while(b.avail_in > 0){
+                        if(ended){
+                                left = b.avail_in;
+                                BZ2_bzDecompressEnd(&b);
+                                memset(&b, 0, sizeof(b));
+                                if(BZ2_bzDecompressInit(&b, 0, 0) != BZ_OK)
+                                        return -1;
+                                b.next_in = (char *) buf + got - left;
+                                b.avail_in = left;
+                                ended = 0;
+                        }
+                        if(out == s->cap) goto ib_error;
+                        b.next_out = in->data + out;
+                        b.avail_out = s->cap - out > UINT_MAX
+                                ? UINT_MAX : s->cap - out;
+                        ret = BZ2_bzDecompress(&b);
+                        out = b.next_out - in->data;
+                        if(ret == BZ_STREAM_END) ended = 1;
+                        else if(ret != BZ_OK) goto ib_error;
+                }
+                if(publish(s, out)) goto ib_error;
+        }
+        BZ2_bzDecompressEnd(&b);
+        return got == 0 && ended ? 0 : -1;
+
+        ib_error:
+        BZ2_bzDecompressEnd(&b);
+        return -1;
+}
+
+/**
+ * stream_worker: thread body decompressing a struct input_stream
+ */
+static void *
+stream_worker(void *p)
+{
+        struct inputbuf *in = p;
+        struct input_stream *s = in->stream;
+        unsigned char *buf;
+        int ret = -1;
+
+        buf = malloc(STREAM_CHUNK);
+        if(buf != NULL){
+                if(s->format == FORMAT_GZIP)
+                        ret = inflate_gzip(in, buf);
+                else
+                        ret = inflate_bzip2(in, buf);
+        }
+        free(buf);
+        pthread_mutex_lock(&s->lock);
+        s->done = 1;
+        s->failed = ret != 0;
+        pthread_cond_broadcast(&s->more);
+        pthread_mutex_unlock(&s->lock);
+        return NULL;
+}
+
+/**
+ * start_stream: start decompressing a file on a thread of its own
+ *
+ * @in:     input buffer to fill
+ * @fd:     file descriptor, positioned just after @head; closed by
+ *          close_input() unless it is standard input
+ * @format: compression format
+ * @head:   bytes already read from @fd
+ * @nhead:  number of bytes at @head, at most 4
+ *
+ * The decompressed size isn't known in advance, so address space is
+ * reserved for the largest file that could be wanted; pages are only
+ * allocated as they are written. If a reservation that big is refused,
+ * smaller ones are tried.
+ *
+ * Returns 0 on success, -1 on error, in which case @fd is closed.
+ */
+static int
+start_stream(struct inputbuf *in, int fd, enum input_format format,
+                const unsigned char *head, size_t nhead)
+{
+        struct input_stream *s;
+        void *map = MAP_FAILED;
+        size_t cap = SIZE_MAX / 4 < ((size_t) 1 << 36)
+                ? (size_t) 1 << 30 : (size_t) 1 << 36;
+
+        s = calloc(1, sizeof(*s));
+        if(s == NULL) goto ss_error_cleanup;
+        while(1){
+                map = mmap(NULL, cap, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                -1, 0);
+                if(map != MAP_FAILED || cap <= (1 << 24)) break;
+                cap /= 2;
+        }
+        if(map == MAP_FAILED) goto ss_error_cleanup;
+        s->cap = cap;
+        s->fd = fd;
+        s->format = format;
+        memcpy(s->head, head, nhead);
+        s->nhead = nhead;
+        if(pthread_mutex_init(&s->lock, NULL) != 0){
+                munmap(map, s->cap);
+                goto ss_error_cleanup;
+        }
+        if(pthread_cond_init(&s->more, NULL) != 0){
+                pthread_mutex_destroy(&s->lock);
+                munmap(map, s->cap);
+                goto ss_error_cleanup;
+        }
+        if(pthread_cond_init(&s->room, NULL) != 0){
+                pthread_cond_destroy(&s->more);
+                pthread_mutex_destroy(&s->lock);
+                munmap(map, s->cap);
+                goto ss_error_cleanup;
+        }
+        in->data = map;
+        in->len = 0;
+        in->mapped = 0;
+        in->stream = s;
+        if(pthread_create(&s->thread, NULL, stream_worker, in) != 0){
+                pthread_cond_destroy(&s->room);
+                pthread_cond_destroy(&s->more);
+                pthread_mutex_destroy(&s->lock);
+                munmap(map, s->cap);
+                in->data = NULL;
+                in->stream = NULL;
+                goto ss_error_cleanup;
+        }
+        return 0;
+
+        ss_error_cleanup:
+        free(s);
+        if(fd != STDIN_FILENO) close(fd);
+        return -1;
+}
+
+/**
+ * open_input_stream: start loading an input file into memory
+ *
+ * @filename: path to the file, or "-" to read from standard input
+ *
+ * Regular files are memory-mapped read-only, so the parser can classify
+ * records in place without copying each line. Standard input, pipes and
+ * other unmappable files are read into a heap buffer instead.
+ *
+ * Files compressed with gzip or bzip2 are recognised by their first bytes
+ * and decompressed by a separate thread, which may still be running when
+ * this returns: in->len is then only what has arrived so far, and more is
+ * waited for with input_line() or input_wait(). Reading zstd files needs
+ * a library this program isn't built with, so they are refused.
+ *
+ * Allocates and returns a struct inputbuf which should be freed with
+ * close_input(), or returns NULL if the file can't be read.
+ */
+struct inputbuf *
+open_input_stream(char *filename)
+{
+        struct inputbuf *in;
+        struct stat st;
+        unsigned char head[4];
+        size_t nhead = 0;
+        enum input_format format;
+        ssize_t got;
+        int fd;
+        void *map;
+
+        if(filename == NULL) return NULL;
+        in = malloc(sizeof(*in));
+        if(in == NULL) return NULL;
+        in->data = NULL;
+        in->len = 0;
+        in->mapped = 0;
+        in->stream = NULL;
+
+        if(strcmp(filename, "-") == 0)
+                fd = STDIN_FILENO;
+        else
+                fd = open(filename, O_RDONLY);
+        if(fd < 0) goto oi_error_cleanup;
+
+        /* Sniff the first bytes for compression, without consuming them
+         * from files that could be mapped */
+        if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+                got = pread(fd, head, sizeof(head), 0);
+                nhead = got > 0 ? got : 0;
+                format = input_format(head, nhead);
+                if(format == FORMAT_PLAIN){
+                        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                                        fd, 0);
+                        if(map != MAP_FAILED){
+#ifdef MADV_SEQUENTIAL
+                                madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+                                in->data = map;
+                                in->len = st.st_size;
+                                in->mapped = 1;
+                                close(fd);
+                                return in;
+                        }
+                }
+                nhead = 0;
+        }
+        else{
+                while(nhead < sizeof(head)){
+                        got = read(fd, head + nhead, sizeof(head) - nhead);
+                        if(got < 0 && errno == EINTR) continue;
+                        if(got <= 0) break;
+                        nhead += got;
+                }
+                format = input_format(head, nhead);
+        }
+
+        if(format == FORMAT_ZSTD){
+                fprintf(stderr, "ERROR: [%s] is compressed with zstd, which this build of cmap can't read.\n", filename);
+                if(fd != STDIN_FILENO) close(fd);
+                goto oi_error_cleanup;
+        }
+        if(format != FORMAT_PLAIN){
+                if(start_stream(in, fd, format, head, nhead) != 0)
+                        goto oi_error_cleanup;
+                return in;
+        }
+
+        /* Not mappable (empty, a FIFO, a device...): fall back to read() */
+        if(read_all(fd, in, head, nhead) != 0){
+                if(fd != STDIN_FILENO) close(fd);
+                goto oi_error_cleanup;
+        }
+        if(fd != STDIN_FILENO) close(fd);
+        return in;
+
+        oi_error_cleanup:
+        free(in);
+        return NULL;
+}
+
+/**
+ * open_input: load an input file into memory
+ *
+ * @filename: path to the file, or "-" to read from standard input
+ *
+ * Like open_input_stream(), but returns only once the whole file is in
+ * memory.
+ *
+ * Returns NULL if the file can't be read, or can't be decompressed.
+ */
+struct inputbuf *
+open_input(char *filename)
+{
+        struct inputbuf *in = open_input_stream(filename);
+
+        if(in != NULL && input_all(in) != 0){
+                close_input(in);
+                return NULL;
+        }
+        return in;
+}
+
+/**
+ * input_wait: wait for part of an input to be available
+ *
+ * @in:   input buffer
+ * @want: number of bytes wanted
+ *
+ * Blocks until in->len is at least @want, or the whole input has arrived.
+ *
+ * Returns in->len.
+ */
+size_t
+input_wait(struct inputbuf *in, size_t want)
+{
+        struct input_stream *s = in->stream;
+
+        if(s == NULL || in->len >= want) return in->len;
+        pthread_mutex_lock(&s->lock);
+        while(1){
+                /* Take whatever has arrived on every round, or a wait for
+                 * more than STREAM_AHEAD bytes would never be satisfied */
+                in->len = s->avail;
+                s->seen = in->len;
+                pthread_cond_signal(&s->room);
+                if(in->len >= want || s->done) break;
+                pthread_cond_wait(&s->more, &s->lock);
+        }
+        pthread_mutex_unlock(&s->lock);
+        return in->len;
+}
+
+/**
+ * input_all: wait for the whole of an input
+ *
+ * Returns 0 on success, or -1 if the input couldn't be decompressed, in
+ * which case in->len may fall short of the file's true length.
+ */
+int
+input_all(struct inputbuf *in)
+{
+        struct input_stream *s = in->stream;
+        int failed;
+
+        if(s == NULL) return 0;
+        input_wait(in, SIZE_MAX);
+        pthread_mutex_lock(&s->lock);
+        failed = s->failed;
+        pthread_mutex_unlock(&s->lock);
+        return failed ? -1 : 0;
+}
+
+/**
+ * input_line: find the end of a line of input
+ *
+ * @in:   input buffer
+ * @line: start of the line
+ * @end:  end of the input as far as the caller knows; moved on if more of
+ *        the input has to be waited for
+ *
+ * Returns a pointer to the newline ending @line, or to *@end if the input
+ * ends without one, or NULL if @line is at the end of the input.
+ */
+const char *
+input_line(struct inputbuf *in, const char *line, const char **end)
+{
+        const char *eol;
+        size_t have;
+
+        while(1){
+                if(line < *end){
+                        eol = memchr(line, '\n', *end - line);
+                        if(eol != NULL) return eol;
+                }
+                have = in->len;
+                if(input_wait(in, have + 1) == have)
+                        return line < *end ? *end : NULL;
+                *end = in->data + in->len;
+        }
+}
+
+/**
+ * release_input: let the system drop the part of an input already parsed
+ *
+ * @in:   input buffer
+ * @upto: everything before this point in in->data has been read and won't
+ *        be looked at again
+ *
+ * For a mapped or decompressed file, the whole pages before @upto are
+ * released, so a file read once from start to end doesn't stay resident.
+ * Heap buffers are left alone.
+ */
+void
+release_input(struct inputbuf *in, const char *upto)
+{
+        long page = sysconf(_SC_PAGESIZE);
+        size_t n;
+
+        if((!in->mapped && in->stream == NULL) || page <= 0) return;
+        n = (size_t) (upto - in->data) / page * page;
+#ifdef MADV_DONTNEED
+        if(n > 0) madvise(in->data, n, MADV_DONTNEED);
+#endif
+}
+
+/**
+ * close_input: free a struct inputbuf allocated by open_input()
+ * @in: pointer to struct inputbuf which is to be freed
+ *
+ * A decompression still in progress is stopped.
+ */
+void
+close_input(struct inputbuf *in)
+{
+        struct input_stream *s;
+
+        if(in == NULL) return;
+        s = in->stream;
+        if(s != NULL){
+                pthread_mutex_lock(&s->lock);
+                s->cancel = 1;
+                pthread_cond_signal(&s->room);
+                pthread_mutex_unlock(&s->lock);
+                pthread_join(s->thread, NULL);
+                pthread_cond_destroy(&s->room);
+                pthread_cond_destroy(&s->more);
+                pthread_mutex_destroy(&s->lock);
+                if(s->fd != STDIN_FILENO) close(s->fd);
+                munmap(in->data, s->cap);
+                free(s);
+        }
+        else if(in->mapped)
+                munmap(in->data, in->len);
+        else
+                free(in->data);
+        in->data = NULL;
+        free(in);
+}
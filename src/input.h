@@ -0,0 +1,51 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#ifndef CMAP_INPUT_H_
+#define CMAP_INPUT_H_
+
+#include<stddef.h>
+
+struct input_stream;
+
+/*
+ * An input file held entirely in memory: either a read-only mapping of the
+ * file, or (for pipes and stdin) a heap buffer that was grown while reading,
+ * or the output of a decompressor. The data is NOT null-terminated; always
+ * use @len. While @stream is still decompressing, @len only covers what has
+ * arrived so far.
+ */
+struct inputbuf{
+        char *data;
+        size_t len;
+        int mapped;
+        struct input_stream *stream;
+};
+
+void close_input(struct inputbuf *in);
+int input_all(struct inputbuf *in);
+const char * input_line(struct inputbuf *in, const char *line,
+                const char **end);
+size_t input_wait(struct inputbuf *in, size_t want);
+struct inputbuf * open_input(char *filename);
+struct inputbuf * open_input_stream(char *filename);
+void release_input(struct inputbuf *in, const char *upto);
+
+#endif // CMAP_INPUT_H_
@@ -18,9 +18,238 @@
  *
  */
 
+#include<math.h>
 #include<pdb.h>
+#include<stdint.h>
 #include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include "atoms.h"
+#include "contacts.h"
+#include "distance.h"
+#include "ensemble.h"
 #include "pdb.h"
+#include "threads.h"
+
+/**
+ * write_contacts_header: write the comment header of a contact list
+ *
+ * @fp: file pointer open for writing
+ * @source_filename: input file name, or NULL
+ * @chain_name: chain identifier, or NULL
+ * @sequence: primary sequence, or NULL
+ * @threshold: distance threshold used to calculate contacts
+ */
+static void
+write_contacts_header(FILE *fp, char *source_filename, const char *chain_name,
+                char *sequence, double threshold)
+{
+        fprintf(fp, "# cmap v%s\n", PACKAGE_VERSION);
+        if(source_filename != NULL)
+                fprintf(fp, "# source file: %s\n", source_filename);
+        if(chain_name != NULL && chain_name[0] != '\0')
+                fprintf(fp, "# source chain: %s\n", chain_name);
+        if(sequence != NULL)
+                fprintf(fp, "# sequence: %s\n", sequence);
+        fprintf(fp, "# threshold: %f\n", threshold);
+}
+
+/*
+ * Contact lists are formatted in chunks of rows, each into its own buffer,
+ * and written out a round of chunks at a time. A chunk covers about
+ * OUT_CHUNK_WORK contacts (sparse lists) or residue pairs (dense matrices).
+ * OUT_LINE_MAX is the longest line: two 10-digit numbers, a tab and a
+ * newline.
+ */
+#define OUT_CHUNK_WORK (1 << 18)
+#define OUT_LINE_MAX 22
+
+static const char digit_pairs[201] =
+        "00010203040506070809101112131415161718192021222324"
+        "25262728293031323334353637383940414243444546474849"
+        "50515253545556575859606162636465666768697071727374"
+        "75767778798081828384858687888990919293949596979899";
+
+/* A growable output buffer for one chunk */
+struct outbuf{
+        char *data;
+        size_t len;
+        size_t cap;
+        int failed;
+};
+
+/* Work shared by the threads formatting one contact list */
+struct write_job{
+        const struct distmat *dm;
+        const struct contacts *ct;
+        const int *bounds;
+        struct outbuf *bufs;
+        size_t first;
+        double threshold;
+        unsigned char qcontact[256];
+};
+
+/**
+ * put_uint: write the decimal digits of an unsigned integer
+ *
+ * @p: where to write; room for 10 characters is needed
+ * @v: value to write
+ *
+ * Digits are produced two at a time from a table, least significant
+ * first, into a scratch buffer which is then copied out.
+ *
+ * Returns a pointer just past the last digit written.
+ */
+static inline char *
+put_uint(char *p, unsigned int v)
+{
+        char tmp[10];
+        char *t = tmp + sizeof(tmp);
+        size_t n;
+
+        while(v >= 100){
+                t -= 2;
+                memcpy(t, digit_pairs + 2 * (v % 100), 2);
+                v /= 100;
+        }
+        if(v >= 10){
+                t -= 2;
+                memcpy(t, digit_pairs + 2 * v, 2);
+        }
+        else *--t = '0' + v;
+        n = tmp + sizeof(tmp) - t;
+        memcpy(p, t, n);
+        return p + n;
+}
+
+/**
+ * put_contact: append one "i<TAB>j<NEWLINE>" line to a buffer
+ *
+ * @ob: output buffer, grown if necessary
+ * @i, @j: one-based residue numbers
+ */
+static inline void
+put_contact(struct outbuf *ob, int i, int j)
+{
+        char *p, *tmp;
+
+        if(ob->cap - ob->len < OUT_LINE_MAX){
+                if(ob->failed) return;
+                tmp = realloc(ob->data, 2 * ob->cap + OUT_LINE_MAX);
+                if(tmp == NULL){
+                        ob->failed = 1;
+                        return;
+                }
+                ob->data = tmp;
+                ob->cap = 2 * ob->cap + OUT_LINE_MAX;
+        }
+        p = put_uint(ob->data + ob->len, i);
+        *p++ = '\t';
+        p = put_uint(p, j);
+        *p++ = '\n';
+        ob->len = p - ob->data;
+}
+
+/**
+ * format_chunk: format the contacts of one chunk of rows into its buffer
+ *
+ * Contacts come from the sparse list if there is one, otherwise from the
+ * packed distance matrix, with the same test as getdist(dm, i, j) <
+ * threshold.
+ */
+static void
+format_chunk(void *arg, size_t chunk)
+{
+        struct write_job *job = arg;
+        struct outbuf *ob = job->bufs + chunk;
+        int i0 = job->bounds[job->first + chunk];
+        int i1 = job->bounds[job->first + chunk + 1];
+        const struct distmat *dm = job->dm;
+        const struct contacts *ct = job->ct;
+        const double *drow;
+        const float *frow;
+        const unsigned char *qrow;
+        size_t k;
+        int i, j;
+
+        ob->len = 0;
+        for(i = i0; i < i1; i++){
+                if(ct != NULL){
+                        for(k = ct->rowptr[i]; k < ct->rowptr[i + 1]; k++)
+                                put_contact(ob, i + 1, ct->col[k] + 1);
+                        continue;
+                }
+                k = DM_INDEX(dm->nres, i, i + 1);
+                if(dm->precision == DM_UINT8){
+                        qrow = (const unsigned char *) dm->mat + k;
+                        for(j = i + 1; j < dm->nres; j++)
+                                if(job->qcontact[qrow[j - i - 1]])
+                                        put_contact(ob, i + 1, j + 1);
+                }
+                else if(dm->precision == DM_FLOAT){
+                        frow = (const float *) dm->mat + k;
+                        for(j = i + 1; j < dm->nres; j++)
+                                if(frow[j - i - 1] < job->threshold)
+                                        put_contact(ob, i + 1, j + 1);
+                }
+                else {
+                        drow = (const double *) dm->mat + k;
+                        for(j = i + 1; j < dm->nres; j++)
+                                if(drow[j - i - 1] < job->threshold)
+                                        put_contact(ob, i + 1, j + 1);
+                }
+        }
+}
+
+/**
+ * write_chunks: format and write a contact list chunk by chunk
+ *
+ * @fp:       file pointer open for writing
+ * @job:      the contact list, with job->bounds holding @nchunks + 1 row
+ *            boundaries
+ * @nchunks:  number of chunks
+ * @nthreads: number of threads to format with
+ *
+ * Chunks are formatted a round of 2 * @nthreads at a time, in parallel,
+ * and each round is written out in order, so memory use is bounded by
+ * the size of a round rather than of the whole list.
+ *
+ * Returns 0 on success, -1 if memory can't be allocated.
+ */
+static int
+write_chunks(FILE *fp, struct write_job *job, size_t nchunks, int nthreads)
+{
+        size_t round, n, c;
+        int ret = -1;
+
+        if(nthreads < 1) nthreads = 1;
+        round = nthreads == 1 ? 1 : 2 * (size_t) nthreads;
+        if(round > nchunks) round = nchunks;
+        job->bufs = calloc(round + 1, sizeof(*job->bufs));
+        if(job->bufs == NULL) return -1;
+        for(c = 0; c < round; c++){
+                job->bufs[c].cap = OUT_CHUNK_WORK * 12;
+                job->bufs[c].data = malloc(job->bufs[c].cap);
+                if(job->bufs[c].data == NULL) goto wc_cleanup;
+        }
+        for(job->first = 0; job->first < nchunks; job->first += n){
+                n = nchunks - job->first < round ? nchunks - job->first : round;
+                if(run_chunks(nthreads, n, format_chunk, job) != 0)
+                        goto wc_cleanup;
+                for(c = 0; c < n; c++){
+                        if(job->bufs[c].failed) goto wc_cleanup;
+                        fwrite(job->bufs[c].data, 1, job->bufs[c].len, fp);
+                }
+        }
+        ret = 0;
+
+        wc_cleanup:
+        for(c = 0; c < round; c++)
+                free(job->bufs[c].data);
+        free(job->bufs);
+        job->bufs = NULL;
+        return ret;
+}
 
 /**
  * write_contacts: write a list of contacts to a text file
@@ -28,30 +257,315 @@
  * @fp: file pointer open for writing
  * @dm: distance matrix
  * @threshold: distance threshold used to calculate contacts
+ * @nthreads: number of threads to format the list with
+ *
+ * Residue pairs closer than @threshold are listed one per line as
+ * "i<TAB>j" with i < j, numbered from 1.
+ *
+ * Returns 0 on success, -1 if memory can't be allocated.
  */
-void
-write_contacts(FILE *fp, struct distmat dm, double threshold)
+int
+write_contacts(FILE *fp, struct distmat dm, double threshold, int nthreads)
 {
-        int i, j;
+        struct write_job job;
+        int *bounds = NULL;
+        size_t nchunks, c, total, done;
+        int i, ret;
+
+        if(fp == NULL){
+                return 0;
+        }
+        write_contacts_header(fp, dm.source_filename, dm.chain_name,
+                        dm.sequence, threshold);
+        if(dm.nres < 2) return 0;
+
+        /* Chunks of rows with about OUT_CHUNK_WORK residue pairs each */
+        total = DM_SIZE(dm.nres);
+        nchunks = total / OUT_CHUNK_WORK + 1;
+        if(nchunks > (size_t) dm.nres - 1) nchunks = dm.nres - 1;
+        bounds = malloc((nchunks + 1) * sizeof(*bounds));
+        if(bounds == NULL) return -1;
+        bounds[0] = 0;
+        for(c = 1, i = 0, done = 0; c < nchunks; c++){
+                while(done < c * total / nchunks){
+                        done += dm.nres - i - 1;
+                        i++;
+                }
+                bounds[c] = i;
+        }
+        bounds[nchunks] = dm.nres - 1;
+
+        job.dm = &dm;
+        job.ct = NULL;
+        job.bounds = bounds;
+        job.threshold = threshold;
+        for(i = 0; i < 256; i++)
+                job.qcontact[i] = dm_unquantize(i) < threshold;
+        ret = write_chunks(fp, &job, nchunks, nthreads);
+        free(bounds);
+        return ret;
+}
+
+/**
+ * write_contact_list: write a sparse list of contacts to a text file
+ *
+ * @fp: file pointer open for writing
+ * @ct: contacts found by find_contacts()
+ * @nthreads: number of threads to format the list with
+ *
+ * Produces the same output as write_contacts() with the full distance
+ * matrix and the same threshold.
+ *
+ * Returns 0 on success, -1 if memory can't be allocated.
+ */
+int
+write_contact_list(FILE *fp, struct contacts ct, int nthreads)
+{
+        struct write_job job;
+        int *bounds = NULL;
+        size_t nchunks, c;
+        int i, ret;
+
+        if(fp == NULL){
+                return 0;
+        }
+        write_contacts_header(fp, ct.source_filename, ct.chain_name,
+                        ct.sequence, ct.threshold);
+        if(ct.nres < 1) return 0;
+
+        /* Chunks of rows with about OUT_CHUNK_WORK contacts each */
+        nchunks = ct.ncontacts / OUT_CHUNK_WORK + 1;
+        if(nchunks > (size_t) ct.nres) nchunks = ct.nres;
+        bounds = malloc((nchunks + 1) * sizeof(*bounds));
+        if(bounds == NULL) return -1;
+        bounds[0] = 0;
+        for(c = 1, i = 0; c < nchunks; c++){
+                while(i < ct.nres && ct.rowptr[i] < c * ct.ncontacts / nchunks)
+                        i++;
+                bounds[c] = i;
+        }
+        bounds[nchunks] = ct.nres;
+
+        job.dm = NULL;
+        job.ct = &ct;
+        job.bounds = bounds;
+        job.threshold = ct.threshold;
+        ret = write_chunks(fp, &job, nchunks, nthreads);
+        free(bounds);
+        return ret;
+}
+
+/**
+ * write_interfaces: write the contacts between every pair of chains
+ *
+ * @fp:        file pointer open for writing
+ * @tab:       chains
+ * @threshold: distance threshold used to calculate contacts
+ *
+ * Pairs of residues from different chains closer than @threshold are
+ * listed one per line as "A<TAB>i<TAB>B<TAB>j", where chain A comes before
+ * chain B in @tab and i and j are residue numbers within the chains,
+ * numbered from 1. Chain identifiers are written in full, as mmCIF ones
+ * may be several characters long. Each pair of chains is searched with
+ * find_interface(), so the whole complex's distance matrix is never built.
+ *
+ * Returns 0 on success, -1 if memory can't be allocated.
+ */
+int
+write_interfaces(FILE *fp, const struct chain_table *tab, double threshold)
+{
+        struct interface *ifc;
+        size_t k;
+        int a, b, i;
 
         if(fp == NULL){
+                return 0;
+        }
+        write_contacts_header(fp, tab->chains[0]->source_filename, NULL,
+                        NULL, threshold);
+        fprintf(fp, "# chains:");
+        for(a = 0; a < tab->nchains; a++)
+                fprintf(fp, " %s", tab->chains[a]->chain_name);
+        fputc('\n', fp);
+        for(a = 0; a < tab->nchains; a++){
+                for(b = a + 1; b < tab->nchains; b++){
+                        ifc = find_interface(*tab->chains[a], *tab->chains[b],
+                                        threshold);
+                        if(ifc == NULL) return -1;
+                        for(i = 0; i < ifc->nres_a; i++)
+                                for(k = ifc->rowptr[i]; k < ifc->rowptr[i + 1]; k++)
+                                        fprintf(fp, "%s\t%d\t%s\t%d\n",
+                                                        tab->chains[a]->chain_name,
+                                                        i + 1,
+                                                        tab->chains[b]->chain_name,
+                                                        ifc->col[k] + 1);
+                        freeinterface(ifc);
+                }
+        }
+        return 0;
+}
+
+/**
+ * put_varint: append an unsigned LEB128 varint
+ *
+ * @p: where to write; room for 10 bytes is needed
+ * @v: value to write
+ *
+ * Returns a pointer just past the last byte written.
+ */
+static inline unsigned char *
+put_varint(unsigned char *p, uint64_t v)
+{
+        while(v >= 0x80){
+                *p++ = (v & 0x7f) | 0x80;
+                v >>= 7;
+        }
+        *p++ = v;
+        return p;
+}
+
+/**
+ * put_bin_string: write an optional string as a varint length + 1 and bytes
+ */
+static void
+put_bin_string(FILE *fp, const char *s)
+{
+        unsigned char buf[10];
+        size_t len = s == NULL ? 0 : strlen(s) + 1;
+
+        fwrite(buf, 1, put_varint(buf, len) - buf, fp);
+        if(len > 1) fwrite(s, 1, len - 1, fp);
+}
+
+/**
+ * write_contacts_binary: write a sparse list of contacts in binary form
+ *
+ * @fp: file pointer open for writing
+ * @ct: contact list
+ *
+ * See contacts.h for the format; read_contacts_binary() reads it back.
+ * Partners are stored as gaps from the previous partner, so the short
+ * range contacts that make up most of a map take one byte each.
+ *
+ * Returns 0 on success, -1 if memory can't be allocated.
+ */
+int
+write_contacts_binary(FILE *fp, struct contacts ct)
+{
+        unsigned char head[32], *buf, *p;
+        uint64_t bits;
+        size_t k;
+        int i, j, b;
+
+        if(fp == NULL){
+                return 0;
+        }
+        buf = malloc(OUT_CHUNK_WORK * 12);
+        if(buf == NULL) return -1;
+
+        p = head;
+        memcpy(p, CONTACTS_BIN_MAGIC, strlen(CONTACTS_BIN_MAGIC));
+        p += strlen(CONTACTS_BIN_MAGIC);
+        *p++ = CONTACTS_BIN_VERSION;
+        memcpy(&bits, &ct.threshold, sizeof(bits));
+        for(b = 0; b < 8; b++)
+                *p++ = bits >> (8 * b);
+        p = put_varint(p, ct.nres);
+        p = put_varint(p, ct.ncontacts);
+        fwrite(head, 1, p - head, fp);
+        put_bin_string(fp, ct.chain_name);
+        put_bin_string(fp, ct.source_filename);
+        put_bin_string(fp, ct.sequence);
+
+        p = buf;
+        for(i = 0; i < ct.nres; i++){
+                if(p - buf > OUT_CHUNK_WORK * 12 - 20){
+                        fwrite(buf, 1, p - buf, fp);
+                        p = buf;
+                }
+                p = put_varint(p, ct.rowptr[i + 1] - ct.rowptr[i]);
+                for(k = ct.rowptr[i], j = i; k < ct.rowptr[i + 1]; k++){
+                        if(p - buf > OUT_CHUNK_WORK * 12 - 10){
+                                fwrite(buf, 1, p - buf, fp);
+                                p = buf;
+                        }
+                        p = put_varint(p, ct.col[k] - j);
+                        j = ct.col[k];
+                }
+        }
+        fwrite(buf, 1, p - buf, fp);
+        free(buf);
+        return 0;
+}
+
+/*
+ * write_eps() draws the map in blocks of EPS_BLOCK x EPS_BLOCK residues,
+ * each either as rectangles (about EPS_RUN_BYTES per run of contacts) or
+ * as an image mask (two hex digits per 8 residues plus EPS_IMAGE_BYTES),
+ * whichever is smaller.
+ */
+#define EPS_BLOCK 64
+#define EPS_RUN_BYTES 14
+#define EPS_IMAGE_BYTES 24
+
+/**
+ * eps_block: write one block of the upper triangle of a contact map
+ *
+ * @fp:     file pointer open for writing
+ * @bm:     contact bitmap
+ * @r0, @c0: first row and column of the block
+ *
+ * Writes nothing for an empty block, otherwise a procedure drawing the
+ * block for the D operator defined by write_eps(), which draws it and its
+ * mirror image. Rectangles are drawn for the runs of contacts on or above
+ * the diagonal; an image mask holds the whole block, which is symmetric
+ * where it crosses the diagonal.
+ */
+static void
+eps_block(FILE *fp, const struct contact_bitmap *bm, int r0, int c0)
+{
+        int r1 = r0 + EPS_BLOCK < bm->nres ? r0 + EPS_BLOCK : bm->nres;
+        int c1 = c0 + EPS_BLOCK < bm->nres ? c0 + EPS_BLOCK : bm->nres;
+        size_t runs = 0, image;
+        unsigned int byte;
+        int i, j, k, first;
+
+        for(i = r0; i < r1; i++){
+                first = i > c0 ? i : c0;
+                for(j = first; j < c1; j++)
+                        if(BITMAP_TEST(*bm, i, j)
+                                        && (j == first || !BITMAP_TEST(*bm, i, j - 1)))
+                                runs++;
+        }
+        if(runs == 0) return;
+
+        image = (size_t) (r1 - r0) * ((c1 - c0 + 7) / 8) * 2 + EPS_IMAGE_BYTES;
+        if(runs * EPS_RUN_BYTES <= image){
+                fprintf(fp, "{\n");
+                for(i = r0; i < r1; i++){
+                        first = i > c0 ? i : c0;
+                        for(j = first; j < c1; j++){
+                                if(!BITMAP_TEST(*bm, i, j)) continue;
+                                for(k = j; k < c1 && BITMAP_TEST(*bm, i, k); k++);
+                                fprintf(fp, "%d %d %d R\n", j, i, k - j);
+                                j = k;
+                        }
+                }
+                fprintf(fp, "} D\n");
                 return;
         }
-        fprintf(fp, "# cmap v%s\n", PACKAGE_VERSION);
-        if(dm.source_filename != NULL)
-                fprintf(fp, "# source file: %s\n", dm.source_filename);
-        if(dm.source_chain != '\0')
-                fprintf(fp, "# source chain: %c\n", dm.source_chain);
-        if(dm.sequence != NULL)
-                fprintf(fp, "# sequence: %s\n", dm.sequence);
-        fprintf(fp, "# threshold: %f\n", threshold);
-        for(i = 0; i < dm.nres - 1; i++){
-                for(j = i + 1; j < dm.nres; j++){
-                        if(getdist(dm, i, j) < threshold)
-                                fprintf(fp, "%d\t%d\n", i+1, j+1);
+        fprintf(fp, "{%d %d %d %d <\n", c0, r0, c1 - c0, r1 - r0);
+        for(i = r0; i < r1; i++){
+                for(j = c0; j < c1; j += 8){
+                        byte = 0;
+                        for(k = 0; k < 8 && j + k < c1; k++)
+                                if(BITMAP_TEST(*bm, i, j + k))
+                                        byte |= 0x80 >> k;
+                        fprintf(fp, "%02x", byte);
                 }
+                fputc('\n', fp);
         }
-        return;
+        fprintf(fp, "> I} D\n");
 }
 
 /**
@@ -60,10 +574,18 @@ write_contacts(FILE *fp, struct distmat dm, double threshold)
  * @fp: file pointer open for writing
  * @dm: distance matrix
  * @threshold: distance threshold used to calculate contacts
+ *
+ * Pairs closer than @threshold are drawn as filled squares. Only the upper
+ * triangle is written: horizontal runs of contacts are merged into single
+ * rectangles, dense blocks become image masks, and each block is drawn a
+ * second time through a transform that mirrors it across the diagonal.
+ *
+ * Returns 0 on success, -1 if memory can't be allocated.
  */
-void
+int
 write_eps(FILE *fp, struct distmat dm, double threshold)
 {
+        struct contact_bitmap *bm;
         int i, j;
         float xmax;
         float ymax;
@@ -71,7 +593,7 @@ write_eps(FILE *fp, struct distmat dm, double threshold)
         float boxw;
         float framewidth = 1;
         if(fp == NULL){
-                return;
+                return 0;
         }
         /* Draw about six sq inches, irrespective of chain length
          * Might be bad for long chains.
@@ -105,30 +627,335 @@ write_eps(FILE *fp, struct distmat dm, double threshold)
 
 
         fprintf(fp, "grestore\n");
-        fprintf(fp, "/square {\n"
-                    "/x exch def\n"
-                    "/y exch def\n"
-                    "gsave\n"
-                    "newpath\n"
-                    "x y moveto\n"
-                    "0 %f rlineto\n"
-                    "%f 0 rlineto\n"
-                    "0 -%f rlineto\n"
-                    "-%f 0 rlineto\n"
-                    "closepath\n"
-                    "fill\n"
-                    "}\n"
-                    "def\n", boxw, boxw, boxw, boxw);
+        /*
+         * The map is drawn in a grid where one unit is one residue, with
+         * residue pairs (i, j) at column j and row i counted down from the
+         * top of the frame.
+         *   col row width R:        fill a run of contacts in one row
+         *   col row w h <hex> I:    fill the set bits of a w x h bitmap
+         *   {...} D:                draw, then draw mirrored across the
+         *                           diagonal
+         */
+        fprintf(fp, "/R {1 rectfill} bind def\n"
+                    "/I {gsave /s exch def /h exch def /w exch def translate\n"
+                    "w h scale w h true [w 0 0 h 0 0] {s} imagemask grestore}"
+                    " bind def\n"
+                    "/D {dup exec gsave [0 1 1 0 0 0] concat exec grestore}"
+                    " bind def\n");
+        fprintf(fp, "gsave\n%f %f translate\n%f %f scale\n",
+                    oma + framewidth, xmax - oma - framewidth, boxw, -boxw);
+
+        /* d < threshold is d <= the next double below threshold */
+        bm = make_bitmap(dm, nextafter(threshold, -INFINITY));
+        if(bm == NULL) return -1;
+        for(i = 0; i < dm.nres; i += EPS_BLOCK)
+                for(j = i / EPS_BLOCK * EPS_BLOCK; j < dm.nres; j += EPS_BLOCK)
+                        eps_block(fp, bm, i, j);
+        freebitmap(bm);
+        fprintf(fp, "grestore\n");
+        return 0;
+}
+
+/*
+ * Raster images are computed a round of output rows at a time, one row per
+ * chunk, straight from the coordinates. PGM_DIST_MAX is the distance shown
+ * as white when pixels encode distance; longer distances, and pairs with a
+ * missing residue, are clamped to it.
+ */
+#define PGM_DIST_MAX 32.
 
-        for(i = 0; i < dm.nres; i++){
-                for(j = 0; j < dm.nres; j++){
-                       if(getdist(dm, i, j) < threshold){
-                               fprintf(fp, "%f %f square\n",
-                                    xmax - oma - framewidth -  (i+1)*boxw,
-                                    oma + framewidth + j * boxw);
-                       }
+/* Work shared by the threads computing one raster image */
+struct pgm_job{
+        const struct coords *cs;
+        double *dist;           /* one row of distances per chunk */
+        double *sum;            /* one row of pixel sums per chunk */
+        unsigned char *pixels;  /* one row of pixels per chunk */
+        int first;
+        int width;
+        int scale;
+        int distances;
+        double threshold;
+};
+
+/**
+ * pgm_row: compute one row of pixels of a raster image
+ *
+ * Each pixel covers a block of job->scale x job->scale residue pairs (less
+ * at the right and bottom edges) and is the mean over the block of either
+ * the distance or whether the pair is a contact, as a grey level.
+ */
+static void
+pgm_row(void *arg, size_t chunk)
+{
+        struct pgm_job *job = arg;
+        int n = job->cs->nres;
+        int k = job->scale;
+        int i0 = (job->first + (int) chunk) * k;
+        int i1 = i0 + k < n ? i0 + k : n;
+        double *d = job->dist + chunk * n;
+        double *sum = job->sum + chunk * job->width;
+        unsigned char *px = job->pixels + chunk * job->width;
+        double s, mean;
+        int i, j, c, j1;
+
+        for(c = 0; c < job->width; c++)
+                sum[c] = 0;
+        for(i = i0; i < i1; i++){
+                dist_row(job->cs, i, 0, n, d, 0);
+                for(c = 0, j = 0; c < job->width; c++){
+                        j1 = j + k < n ? j + k : n;
+                        s = 0;
+                        if(job->distances){
+                                for(; j < j1; j++)
+                                        s += d[j] < PGM_DIST_MAX ? d[j] : PGM_DIST_MAX;
+                        }
+                        else {
+                                for(; j < j1; j++)
+                                        s += d[j] < job->threshold;
+                        }
+                        sum[c] += s;
                 }
         }
-        return;
+        for(c = 0; c < job->width; c++){
+                j1 = (c + 1) * k < n ? (c + 1) * k : n;
+                mean = sum[c] / ((double) (i1 - i0) * (j1 - c * k));
+                if(job->distances)
+                        px[c] = 255 * (mean / PGM_DIST_MAX) + 0.5;
+                else
+                        px[c] = 255 * (1 - mean) + 0.5;
+        }
 }
 
+/**
+ * write_pgm: write a raster image of a contact map as a binary PGM file
+ *
+ * @fp:        file pointer open for writing
+ * @cs:        coordinates
+ * @threshold: distance threshold used to calculate contacts
+ * @scale:     residues per pixel, across and down
+ * @distances: if non-zero, shade pixels by distance instead of contacts
+ * @nthreads:  number of threads to compute the image with
+ *
+ * Contacts (pairs closer than @threshold) are black on white; a pixel
+ * covering several residue pairs is as dark as the fraction of them in
+ * contact. With @distances, pixels go from black at 0 A to white at
+ * PGM_DIST_MAX. Residues without coordinates are left white.
+ *
+ * Distances are computed from the coordinates as the image is written, a
+ * round of 2 * @nthreads rows at a time, so memory use grows with the
+ * length of the chain rather than its square. All-atom distances are
+ * measured exactly as far as the image can tell them apart, whatever the
+ * cutoff of @cs.
+ *
+ * Returns 0 on success, -1 if memory can't be allocated.
+ */
+int
+write_pgm(FILE *fp, struct coords cs, double threshold, int scale,
+                int distances, int nthreads)
+{
+        struct pgm_job job;
+        struct atoms at;
+        int height, n, round, ret = -1;
+
+        if(fp == NULL){
+                return 0;
+        }
+        if(cs.atoms != NULL && cs.atoms->cutoff
+                        < (distances ? PGM_DIST_MAX : threshold)){
+                at = *cs.atoms;
+                at.cutoff = distances ? PGM_DIST_MAX : threshold;
+                cs.atoms = &at;
+        }
+        if(scale < 1) scale = 1;
+        height = (cs.nres + scale - 1) / scale;
+
+        fprintf(fp, "P5\n# cmap v%s\n", PACKAGE_VERSION);
+        if(cs.source_filename != NULL)
+                fprintf(fp, "# source file: %s\n", cs.source_filename);
+        if(cs.chain_name != NULL && cs.chain_name[0] != '\0')
+                fprintf(fp, "# source chain: %s\n", cs.chain_name);
+        if(distances)
+                fprintf(fp, "# distance: 0 to %.1f A\n", PGM_DIST_MAX);
+        else
+                fprintf(fp, "# threshold: %f\n", threshold);
+        fprintf(fp, "%d %d\n255\n", height, height);
+        if(height == 0) return 0;
+
+        if(nthreads < 1) nthreads = 1;
+        round = nthreads == 1 ? 1 : 2 * nthreads;
+        if(round > height) round = height;
+        job.cs = &cs;
+        job.width = height;
+        job.scale = scale;
+        job.distances = distances;
+        job.threshold = threshold;
+        job.dist = malloc((size_t) round * cs.nres * sizeof(*job.dist));
+        job.sum = malloc((size_t) round * height * sizeof(*job.sum));
+        job.pixels = malloc((size_t) round * height);
+        if(job.dist == NULL || job.sum == NULL || job.pixels == NULL)
+                goto pgm_cleanup;
+
+        for(job.first = 0; job.first < height; job.first += n){
+                n = height - job.first < round ? height - job.first : round;
+                if(run_chunks(nthreads, n, pgm_row, &job) != 0)
+                        goto pgm_cleanup;
+                fwrite(job.pixels, 1, (size_t) n * height, fp);
+        }
+        ret = 0;
+
+        pgm_cleanup:
+        free(job.dist);
+        free(job.sum);
+        free(job.pixels);
+        return ret;
+}
+
+/**
+ * write_ensemble: write contact frequencies and distance statistics of an
+ *                 ensemble to a text file
+ *
+ * @fp: file pointer open for writing
+ * @e:  ensemble statistics
+ *
+ * Residue pairs in contact in at least one model are listed one per line
+ * as "i<TAB>j<TAB>frequency<TAB>mean<TAB>sd", with one-based residue
+ * numbers, i < j, the fraction of models in which the pair is in contact,
+ * and the mean and standard deviation of its distance (Angstroms).
+ */
+void
+write_ensemble(FILE *fp, const struct ensemble *e)
+{
+        size_t idx;
+        int i, j;
+
+        if(fp == NULL){
+                return;
+        }
+        write_contacts_header(fp, e->source_filename, e->chain_name,
+                        e->sequence, e->threshold);
+        fprintf(fp, "# models: %d\n", e->nframes);
+        for(i = 0; i < e->nres; i++){
+                idx = DM_INDEX(e->nres, i, i + 1);
+                for(j = i + 1; j < e->nres; j++, idx++){
+                        if(e->ncontact[idx] == 0) continue;
+                        fprintf(fp, "%d\t%d\t%.4f\t%.3f\t%.3f\n", i + 1, j + 1,
+                                        ensemble_freq(e, i, j),
+                                        ensemble_mean(e, i, j),
+                                        ensemble_sd(e, i, j));
+                }
+        }
+}
+
+/**
+ * write_frame_counts: write the number of contacts in each frame of an
+ *                     ensemble to a text file
+ *
+ * @fp: file pointer open for writing
+ * @e:  ensemble statistics
+ *
+ * Frames are listed one per line as "frame<TAB>contacts", numbered as in
+ * the input: by model, or by trajectory frame from 1.
+ */
+void
+write_frame_counts(FILE *fp, const struct ensemble *e)
+{
+        int k;
+
+        if(fp == NULL){
+                return;
+        }
+        write_contacts_header(fp, e->source_filename, e->chain_name,
+                        e->sequence, e->threshold);
+        fprintf(fp, "# models: %d\n", e->nframes);
+        for(k = 0; k < e->nframes; k++)
+                fprintf(fp, "%d\t%zu\n", e->first_frame + k * e->frame_step,
+                                e->frame_contacts[k]);
+}
+
+/**
+ * write_ensemble_pgm: write a raster image of an ensemble as a binary PGM
+ *                     file
+ *
+ * @fp:        file pointer open for writing
+ * @e:         ensemble statistics
+ * @scale:     residues per pixel, across and down
+ * @distances: if non-zero, shade pixels by mean distance instead of
+ *             contact frequency
+ *
+ * As write_pgm(), but each pixel is as dark as the mean contact frequency
+ * of the pairs it covers, so contacts present in every model are black and
+ * transient ones grey. With @distances, pixels are shaded by the mean
+ * distance over the models, from black at 0 A to white at PGM_DIST_MAX.
+ * Pairs never observed together are left white.
+ *
+ * Returns 0 on success, -1 if memory can't be allocated.
+ */
+int
+write_ensemble_pgm(FILE *fp, const struct ensemble *e, int scale,
+                int distances)
+{
+        double *sum;
+        unsigned char *px;
+        double d, mean;
+        int height, n = e->nres;
+        int r, i, i0, i1, j, j1, c;
+
+        if(fp == NULL){
+                return 0;
+        }
+        if(scale < 1) scale = 1;
+        height = (n + scale - 1) / scale;
+
+        fprintf(fp, "P5\n# cmap v%s\n", PACKAGE_VERSION);
+        if(e->source_filename != NULL)
+                fprintf(fp, "# source file: %s\n", e->source_filename);
+        if(e->chain_name != NULL && e->chain_name[0] != '\0')
+                fprintf(fp, "# source chain: %s\n", e->chain_name);
+        fprintf(fp, "# models: %d\n", e->nframes);
+        if(distances)
+                fprintf(fp, "# mean distance: 0 to %.1f A\n", PGM_DIST_MAX);
+        else
+                fprintf(fp, "# contact frequency, threshold: %f\n",
+                                e->threshold);
+        fprintf(fp, "%d %d\n255\n", height, height);
+        if(height == 0) return 0;
+
+        sum = malloc(height * sizeof(*sum));
+        px = malloc(height);
+        if(sum == NULL || px == NULL){
+                free(sum);
+                free(px);
+                return -1;
+        }
+        for(r = 0; r < height; r++){
+                i0 = r * scale;
+                i1 = i0 + scale < n ? i0 + scale : n;
+                for(c = 0; c < height; c++)
+                        sum[c] = 0;
+                for(i = i0; i < i1; i++){
+                        for(c = 0, j = 0; c < height; c++){
+                                j1 = j + scale < n ? j + scale : n;
+                                for(; j < j1; j++){
+                                        if(!distances){
+                                                sum[c] += ensemble_freq(e, i, j);
+                                                continue;
+                                        }
+                                        d = ensemble_mean(e, i, j);
+                                        sum[c] += d < PGM_DIST_MAX ? d : PGM_DIST_MAX;
+                                }
+                        }
+                }
+                for(c = 0; c < height; c++){
+                        j1 = (c + 1) * scale < n ? (c + 1) * scale : n;
+                        mean = sum[c] / ((double) (i1 - i0) * (j1 - c * scale));
+                        if(distances)
+                                px[c] = 255 * (mean / PGM_DIST_MAX) + 0.5;
+                        else
+                                px[c] = 255 * (1 - mean) + 0.5;
+                }
+                fwrite(px, 1, height, fp);
+        }
+        free(sum);
+        free(px);
+        return 0;
+}
@@ -22,9 +22,20 @@
 #define CMAP_OUTPUT_H_
 
 #include<stdio.h>
+#include "contacts.h"
+#include "ensemble.h"
 #include "pdb.h"
 
-void write_contacts(FILE *fp, struct distmat dm, double threshold);
-void write_eps(FILE *fp, struct distmat dm, double threshold);
+int write_contact_list(FILE *fp, struct contacts ct, int nthreads);
+int write_contacts(FILE *fp, struct distmat dm, double threshold, int nthreads);
+int write_contacts_binary(FILE *fp, struct contacts ct);
+int write_eps(FILE *fp, struct distmat dm, double threshold);
+void write_ensemble(FILE *fp, const struct ensemble *e);
+int write_ensemble_pgm(FILE *fp, const struct ensemble *e, int scale,
+                int distances);
+void write_frame_counts(FILE *fp, const struct ensemble *e);
+int write_interfaces(FILE *fp, const struct chain_table *tab, double threshold);
+int write_pgm(FILE *fp, struct coords cs, double threshold, int scale,
+                int distances, int nthreads);
 
 #endif // CMAP_OUTPUT_H_
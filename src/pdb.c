@@ -18,12 +18,19 @@
  *
  */
 
+#include<ctype.h>
 #include<math.h>
 #include<stdio.h>
 #include<stdlib.h>
 #include<string.h>
 
+#include"atoms.h"
+#include"cache.h"
+#include"cif.h"
+#include"distance.h"
+#include"input.h"
 #include"pdb.h"
+#include"threads.h"
 
 /**
  * euclid3d: Find euclidean distance between two atoms located at coordinates
@@ -36,10 +43,134 @@ euclid3d(double x1, double y1, double z1, double x2, double y2, double z2)
 }
 
 
+/**
+ * dm_quantize: encode a distance for a DM_UINT8 distance matrix
+ *
+ * See the description of DM_UINT8 in pdb.h. Dividing by DM_QUANT_STEP
+ * (a power of two) and flooring are exact, so the encoding is too.
+ */
+unsigned char
+dm_quantize(double d)
+{
+        double r = d / DM_QUANT_STEP;
+        double m = floor(r);
+        double q = 2 * m + (r != m);
+        if(!(q < 255)) return 255;
+        if(q < 0) return 0;
+        return (unsigned char) q;
+}
+
+/**
+ * dm_unquantize: representative distance for a DM_UINT8 matrix entry
+ *
+ * Even codes are exact whole steps; odd codes lie strictly between two
+ * steps and map to the midpoint, so comparing the result against a whole
+ * number of steps agrees with the original distance. Saturated entries
+ * return DIST_MISSING.
+ */
+double
+dm_unquantize(unsigned char q)
+{
+        if(q == 255) return DIST_MISSING;
+        return (q / 2 + (q & 1) * 0.5) * DM_QUANT_STEP;
+}
+
+/**
+ * dm_quant_exact: whether a DM_UINT8 matrix gives exact contacts
+ *
+ * True if @threshold is a whole number of DM_QUANT_STEP no greater than
+ * DM_QUANT_MAX, so that contacts found in a DM_UINT8 matrix are the same
+ * as in an unquantised one.
+ */
+int
+dm_quant_exact(double threshold)
+{
+        double r = threshold / DM_QUANT_STEP;
+
+        return threshold >= 0 && threshold <= DM_QUANT_MAX && r == floor(r);
+}
+
+/**
+ * dm_auto_precision: storage to use for a distance matrix
+ *
+ * @precision: storage asked for
+ * @automatic: if non-zero, @precision is only a default and may be changed
+ * @nres:      number of residues in the chain
+ * @threshold: distance threshold the matrix will be used with
+ *
+ * Chains of DM_QUANT_AUTO residues or more are stored as DM_UINT8 when the
+ * choice is automatic, but only if that gives exact contacts at
+ * @threshold (see dm_quant_exact()). Otherwise @precision is kept.
+ */
+enum dm_precision
+dm_auto_precision(enum dm_precision precision, int automatic, int nres,
+                double threshold)
+{
+        if(automatic && nres >= DM_QUANT_AUTO && dm_quant_exact(threshold))
+                return DM_UINT8;
+        return precision;
+}
+
+/* Work shared by the threads building one distance matrix */
+struct dm_job{
+        const struct coords *cs;
+        struct distmat *dm;
+        int *band;
+};
+
+/**
+ * dm_band: compute one band of rows of a distance matrix
+ *
+ * @arg:  pointer to struct dm_job
+ * @k:    band number; band k covers rows band[k] .. band[k+1] - 1
+ *
+ * Each row of the triangle is computed by the vector distance kernel. Rows
+ * are contiguous in the packed buffer, so doubles are written in place;
+ * floats and quantised distances are converted from a small scratch block
+ * on the stack.
+ */
+static void
+dm_band(void *arg, size_t k)
+{
+        struct dm_job *job = arg;
+        const struct coords *cs = job->cs;
+        struct distmat *dm = job->dm;
+        double block[256];
+        float *frow;
+        unsigned char *qrow;
+        size_t idx;
+        int i, j, m, n;
+
+        for(i = job->band[k]; i < job->band[k + 1]; i++){
+                idx = DM_INDEX(cs->nres, i, i + 1);
+                n = cs->nres - i - 1;
+                if(dm->precision == DM_DOUBLE){
+                        dist_row(cs, i, i + 1, n, (double *) dm->mat + idx, 0);
+                        continue;
+                }
+                frow = (float *) dm->mat + idx;
+                qrow = (unsigned char *) dm->mat + idx;
+                for(j = 0; j < n; j += 256){
+                        m = n - j < 256 ? n - j : 256;
+                        dist_row(cs, i, i + 1 + j, m, block, 0);
+                        if(dm->precision == DM_FLOAT)
+                                while(m--)
+                                        frow[j + m] = block[m];
+                        else
+                                while(m--)
+                                        qrow[j + m] = dm_quantize(block[m]);
+                }
+        }
+}
+
 /**
  * calculate_distmat: Create a distance matrix from atomic coordinates
  *
  * @coords: a structure containing 3D coordinates of a group of atoms
+ * @precision: DM_DOUBLE to store distances as doubles, DM_FLOAT to store
+ *             them as floats, halving the memory needed, or DM_UINT8 to
+ *             store them quantised to one byte (see pdb.h)
+ * @nthreads: number of threads to compute the matrix with
  *
  * Returns a pointer to distmat structure storing the pairwise euclidean
  * distances of the atoms. 
@@ -51,25 +182,41 @@ euclid3d(double x1, double y1, double z1, double x2, double y2, double z2)
  *
  * Use getdist() on the distance matrix to query distances between residues
  *
+ * Row i of the triangle holds nres - i - 1 distances, so rows are grouped
+ * into bands holding roughly equal numbers of pairs, several per thread,
+ * and handed out to the threads by run_chunks(). Every distance is computed
+ * the same way whichever thread computes it, so the result doesn't depend
+ * on @nthreads.
  */
 struct distmat *
-calculate_distmat(struct coords cs)
+calculate_distmat(struct coords cs, enum dm_precision precision, int nthreads)
 {
-        double **dist = NULL;
-        int i, j;
+        size_t elsize;
+        size_t pairs, target;
+        struct dm_job job;
+        int *band = NULL;
+        int nbands;
+        int i, k;
         struct distmat * dm = NULL;
 
-        if(cs.coords == NULL) return NULL;
+        if(cs.x == NULL) return NULL;
         if(cs.nres == 0) return NULL;
 
         dm = malloc(sizeof(*dm));
         if(dm == NULL) return NULL;
         dm->mat = NULL;
         dm->nres = cs.nres;
+        dm->precision = precision;
 
         dm->source_chain = cs.source_chain;
 
         dm->source_filename = NULL;
+        dm->sequence = NULL;
+        dm->chain_name = NULL;
+        if(cs.chain_name != NULL){
+                dm->chain_name = strdup(cs.chain_name);
+                if(dm->chain_name == NULL) goto cdm_error_cleanup;
+        }
         if(cs.source_filename != NULL){
                 i = strlen(cs.source_filename) + 1;
                 dm->source_filename = malloc(i * sizeof(*(dm->source_filename)));
@@ -77,7 +224,6 @@ calculate_distmat(struct coords cs)
                 strncpy(dm->source_filename, cs.source_filename, i);
         }
         
-        dm->sequence = NULL;
         if(cs.sequence != NULL){
                 i = strlen(cs.sequence) + 1;
                 dm->sequence = malloc(i * sizeof(*(dm->sequence)));
@@ -85,29 +231,38 @@ calculate_distmat(struct coords cs)
                 strncpy(dm->sequence, cs.sequence, i);
         }
 
-        dist = malloc((cs.nres - 1) * sizeof(*dist));
-        if(dist == NULL) goto cdm_error_cleanup;
-
         /* Allocate "triangular" matrix 
-         * Distance matrix has diagonal symmetry, so only store one half
+         * Distance matrix has diagonal symmetry, so only store one half,
+         * packed row by row into a single buffer (see DM_INDEX)
          */
-        for(i = 0; i < cs.nres - 1; i++){
-                dist[i] = NULL;
-                dist[i] = malloc((cs.nres - 1 - i) * sizeof(*dist[i]));
-                if(dist[i] == NULL) goto cdm_error_cleanup;
-        }
-        for(i = 0; i < cs.nres - 1; i++){
-                for(j = i + 1; j < cs.nres; j++){
-                        if (cs.coords[i] == NULL || cs.coords[j] == NULL){
-                            dist[i][j - i - 1] = 999;
-                            continue;
-                        }
-                        dist[i][j - i - 1] = euclid3d(cs.coords[i][0],
-                            cs.coords[i][1], cs.coords[i][2], cs.coords[j][0],
-                            cs.coords[j][1], cs.coords[j][2]);
-                }
+        if(precision == DM_UINT8) elsize = 1;
+        else if(precision == DM_FLOAT) elsize = sizeof(float);
+        else elsize = sizeof(double);
+        dm->mat = malloc(DM_SIZE(cs.nres) * elsize + 1);
+        if(dm->mat == NULL) goto cdm_error_cleanup;
+
+        /* Split the triangle into bands of roughly equal work */
+        if(nthreads < 1) nthreads = 1;
+        nbands = nthreads == 1 ? 1 : 8 * nthreads;
+        if(nbands > cs.nres - 1) nbands = cs.nres - 1;
+        if(nbands < 1) nbands = 1;
+        band = malloc((nbands + 1) * sizeof(*band));
+        if(band == NULL) goto cdm_error_cleanup;
+        target = DM_SIZE(cs.nres) / nbands + 1;
+        band[0] = 0;
+        pairs = 0;
+        for(i = 0, k = 1; i < cs.nres - 1 && k < nbands; i++){
+                pairs += cs.nres - i - 1;
+                if(pairs >= target * k) band[k++] = i + 1;
         }
-        dm->mat = dist;
+        while(k <= nbands) band[k++] = cs.nres > 0 ? cs.nres - 1 : 0;
+
+        job.cs = &cs;
+        job.dm = dm;
+        job.band = band;
+        if(run_chunks(nthreads, nbands, dm_band, &job) != 0)
+                goto cdm_error_cleanup;
+        free(band);
         return dm;
         /* 
          * In the event of an error occurring inside this function,
@@ -115,23 +270,12 @@ calculate_distmat(struct coords cs)
          * return NULL. Needed if any call to malloc after the first fails.
          */
         cdm_error_cleanup:
-        if(dm != NULL){
-                if(dm->mat != NULL) free(dm->mat);
-                if(dm->source_filename != NULL) free(dm->source_filename);
-                if(dm->sequence != NULL) free(dm->sequence);
-                free(dm);
-                dm = NULL;
-        }
-        if(dist != NULL){
-                for(i = 0; i < cs.nres; i++){
-                        if(dist[i] != NULL){
-                                free(dist[i]);
-                                dist[i] = NULL;
-                        }
-                }
-                free(dist);
-                dist = NULL;
-        }
+        if(band != NULL) free(band);
+        if(dm->mat != NULL) free(dm->mat);
+        if(dm->source_filename != NULL) free(dm->source_filename);
+        if(dm->sequence != NULL) free(dm->sequence);
+        free(dm->chain_name);
+        free(dm);
         return NULL;
 }
 
@@ -143,19 +287,26 @@ calculate_distmat(struct coords cs)
  * @j:  index of a second residue
  *
  * Returns the distance between residues @i and @j as stored in @dm
+ * (for DM_UINT8 matrices, a representative value; see dm_unquantize())
  *
- * dm.mat is stored in a triangular form, which is why we can't just read
+ * dm.mat is stored as a packed triangle, which is why we can't just read
  * off dm.mat[i][j] directly.
  */
 double
 getdist(struct distmat dm, int i, int j)
 {
+        size_t k;
         if(i==j)
                 return 0;
         if(i < j)
-                return fabs(dm.mat[i][j-i-1]);
+                k = DM_INDEX(dm.nres, i, j);
         else
-                return fabs(dm.mat[j][i-j-1]);
+                k = DM_INDEX(dm.nres, j, i);
+        if(dm.precision == DM_UINT8)
+                return dm_unquantize(((unsigned char *) dm.mat)[k]);
+        if(dm.precision == DM_FLOAT)
+                return ((float *) dm.mat)[k];
+        return ((double *) dm.mat)[k];
 }
 
 
@@ -166,197 +317,817 @@ getdist(struct distmat dm, int i, int j)
 void
 freedm(struct distmat *dm)
 {
-        int i;
-        for(i = 0; i < dm->nres - 1 ; i++){
-                if(dm->mat[i] != NULL)
-                        free(dm->mat[i]) ;
-                dm->mat[i] = NULL;
-        }
         free(dm->mat);
+        dm->mat = NULL;
         if(dm->source_filename != NULL) free(dm->source_filename);
         dm->source_filename = NULL;
         if(dm->sequence != NULL) free(dm->sequence);
         dm->sequence = NULL;
+        free(dm->chain_name);
+        dm->chain_name = NULL;
         free(dm);
 }
 
 /**
- * getcoords: read alpha carbon co-ordinates from a PDB file
+ * getfield: copy a fixed-width column out of a (non null-terminated) record
  *
- * @filename: string containing path to Protein Data Bank file
- * @chain: chain identifier
+ * @dst:   buffer of at least @width + 1 characters
+ * @line:  pointer to the start of the record
+ * @len:   length of the record, excluding the newline
+ * @start: zero-based column where the field begins
+ * @width: width of the field
+ *
+ * Columns beyond the end of the record are treated as absent, so short
+ * records yield short (possibly empty) fields.
+ */
+static void
+getfield(char *dst, const char *line, size_t len, size_t start, size_t width)
+{
+        size_t n = 0;
+        if(start < len)
+                n = len - start < width ? len - start : width;
+        memcpy(dst, line + start, n);
+        dst[n] = '\0';
+}
+
+/**
+ * fixed_atoi: decode an integer from a fixed-width column of a PDB record
+ *
+ * @line:  pointer to the start of the record
+ * @len:   length of the record, excluding the newline
+ * @start: zero-based column where the field begins
+ * @width: width of the field
+ *
+ * Returns the same value atoi() would for the field copied out on its own,
+ * without making the copy.
+ */
+int
+fixed_atoi(const char *line, size_t len, size_t start, size_t width)
+{
+        const char *p, *end;
+        int neg = 0;
+        int val = 0;
+
+        if(start >= len) return 0;
+        p = line + start;
+        end = len - start < width ? line + len : p + width;
+        while(p < end && isspace((unsigned char) *p)) p++;
+        if(p < end && (*p == '-' || *p == '+')){
+                neg = *p == '-';
+                p++;
+        }
+        while(p < end && *p >= '0' && *p <= '9'){
+                val = val * 10 + (*p - '0');
+                p++;
+        }
+        return neg ? -val : val;
+}
+
+/**
+ * fixed_atof: decode a real number from a fixed-width column of a PDB record
+ *
+ * @line:  pointer to the start of the record
+ * @len:   length of the record, excluding the newline
+ * @start: zero-based column where the field begins
+ * @width: width of the field
+ *
+ * Handles the plain "[-]ddd.ddd" layout of the coordinate columns directly:
+ * the digits are accumulated as an exact integer and divided once by an
+ * exact power of ten, which rounds identically to atof(). Anything else
+ * (exponents, very long fields, stray characters) is copied out and handed
+ * to atof(), so the result is always the same as atof() on the field.
+ */
+double
+fixed_atof(const char *line, size_t len, size_t start, size_t width)
+{
+        static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6,
+                1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+        char field[32];
+        const char *p, *end;
+        int neg = 0;
+        int ndigits = 0;
+        int nfrac = -1;
+        long long mant = 0;
+        double val;
+
+        if(start >= len) return 0.0;
+        p = line + start;
+        end = len - start < width ? line + len : p + width;
+        while(p < end && *p == ' ') p++;
+        if(p < end && (*p == '-' || *p == '+')){
+                neg = *p == '-';
+                p++;
+        }
+        for(; p < end; p++){
+                if(*p >= '0' && *p <= '9'){
+                        mant = mant * 10 + (*p - '0');
+                        ndigits++;
+                        if(nfrac >= 0) nfrac++;
+                }
+                else if(*p == '.' && nfrac < 0) nfrac = 0;
+                else break;
+        }
+        while(p < end && *p == ' ') p++;
+        if(p < end || ndigits == 0 || ndigits > 15) goto fa_slow_path;
+        val = (double) mant;
+        if(nfrac > 0) val /= pow10[nfrac];
+        return neg ? -val : val;
+
+        fa_slow_path:
+        getfield(field, line, len, start, width < 31 ? width : 31);
+        return atof(field);
+}
+
+/**
+ * alloc_coords: allocate coordinate storage for @nres residues in @cs
+ *
+ * The x, y and z arrays share a single allocation aligned to
+ * COORDS_ALIGN bytes. Each array is padded to a multiple of COORDS_ALIGN
+ * bytes, and all coordinates and padding start out as zero, so vector code
+ * may safely read whole aligned blocks past the last residue. The presence
+ * bitmask starts out clear.
+ *
+ * Returns 0 on success, or -1 if memory couldn't be allocated.
+ */
+static int
+alloc_coords(struct coords *cs, int nres)
+{
+        size_t stride;
+        void *block;
+
+        stride = COORDS_STRIDE(nres);
+        if(posix_memalign(&block, COORDS_ALIGN, 3 * stride * sizeof(double)))
+                return -1;
+        memset(block, 0, 3 * stride * sizeof(double));
+        cs->present = calloc((nres + 7) / 8, 1);
+        if(cs->present == NULL){
+                free(block);
+                return -1;
+        }
+        cs->x = block;
+        cs->y = cs->x + stride;
+        cs->z = cs->y + stride;
+        return 0;
+}
+
+/*
+ * Parsing state for one chain ID: where its coordinates are in the chain
+ * table, how much of its sequence has been read, and whether the sequence
+ * is complete, after which its ATOM records are read.
+ */
+struct chain_state{
+        int slot;
+        int nseq;
+        int complete;
+        struct atom_list atoms;
+};
+
+/**
+ * new_chain: add an empty chain to a chain table
+ *
+ * @tab:      chain table
+ * @filename: input file name, copied into the chain
+ * @name:     chain identifier, copied into the chain; source_chain is set
+ *            to it if it is a single character, or 0 otherwise
+ * @nres:     length of the chain
+ * @bytes:    size of the input file
+ *
+ * Returns the new chain, or NULL if memory can't be allocated.
  */
 struct coords *
-getcoords(char* filename, char target_chain){
-        FILE *fp;
-        char buffer[1028];
-        /* common record elements */
-        char recname[7];
-        char chain;
-        /* in seqres records */
-        char tlc[4];
-        char numres[5];
-        /* in atom records */
-        char name[5];
-        char resname[4];
-        char x[9], y[9], z[9];
-        char resseq[5];
+new_chain(struct chain_table *tab, char *filename, const char *name, int nres,
+                size_t bytes)
+{
+        struct coords *cs, **tmp;
 
-        int i;
-        int n;
-        int nres = 0;
-        double **coords=NULL;
+        tmp = realloc(tab->chains, (tab->nchains + 1) * sizeof(*tmp));
+        if(tmp == NULL) return NULL;
+        tab->chains = tmp;
+        cs = calloc(1, sizeof(*cs));
+        if(cs == NULL) return NULL;
+        tab->chains[tab->nchains++] = cs;
+        if(nres < 0) nres = 0;
+        cs->source_chain = name[0] != '\0' && name[1] == '\0' ? name[0] : '\0';
+        cs->source_bytes = bytes;
+        cs->nres = nres;
+        cs->source_filename = strdup(filename);
+        cs->chain_name = strdup(name);
+        cs->sequence = calloc(nres + 1, sizeof(*(cs->sequence)));
+        if(cs->source_filename == NULL || cs->chain_name == NULL
+                        || cs->sequence == NULL)
+                return NULL;
+        if(nres > 0 && alloc_coords(cs, nres) != 0) return NULL;
+        return cs;
+}
+
+/**
+ * parse_chains: read sequences and alpha carbon coordinates of a PDB file
+ *
+ * @in:       the file contents
+ * @filename: input file name, recorded in each chain
+ * @target:   chain identifier to read, or -1 for every chain
+ * @tab:      empty chain table to fill in
+ *
+ * The file is parsed in a single pass, classifying each record in place.
+ * For each chain, SEQRES records are read until its primary sequence is
+ * complete, after which its ATOM records are scanned for alpha carbons.
+ * Chains whose first SEQRES record gives no length are dropped. A file
+ * that is still being decompressed is parsed as it arrives.
+ *
+ * In all-atom mode the heavy atoms of ATOM records are collected too, all
+ * but the first alternate location of each being skipped. Every MODEL
+ * record starts the collection again, so they come from the same (last)
+ * model as most of the alpha carbons.
+ *
+ * Returns 0 on success, -1 if memory can't be allocated or the file
+ * can't be decompressed.
+ */
+static int
+parse_chains(struct inputbuf *in, char *filename, int target,
+                struct chain_table *tab)
+{
+        struct chain_state st[256];
+        struct chain_state *s;
         struct coords *cs;
-        char *seq_ptr;
-        
-        fp = fopen(filename, "r");
-        if (fp == NULL) return NULL;
+        const char *line, *eol, *end;
+        size_t len, elen;
+        char chain, name[2] = "";
+        int all = all_atoms_in_use();
+        int c, k, n, ca, ret = -1;
 
-        cs = malloc(sizeof (*cs));
-        if (cs == NULL) return NULL;
+        for(c = 0; c < 256; c++){
+                st[c].slot = -1;
+                st[c].nseq = 0;
+                st[c].complete = 0;
+                memset(&st[c].atoms, 0, sizeof(st[c].atoms));
+        }
+        end = in->data + in->len;
+        for(line = in->data; (eol = input_line(in, line, &end)) != NULL;
+                        line = eol + 1){
+                len = eol - line;
+                if(len > 0 && line[len - 1] == '\r') len--;
+                if(len < 12) continue;
 
-        cs->source_chain = target_chain;
+                /* 
+                 * Parse SEQRES records from PDB header to find primary seq
+                 * info. ATOM records for a chain are only considered once
+                 * its sequence is complete.
+                 */
+                if(memcmp("SEQRES", line, 6) == 0){
+                        chain = line[11];
+                        if(target >= 0 && (unsigned char) chain != target)
+                                continue;
+                        s = st + (unsigned char) chain;
+                        if(s->complete) continue;
+                        /* At first SEQRES for a chain -- read # of residues*/
+                        if(s->slot < 0){
+                                s->slot = tab->nchains;
+                                name[0] = chain;
+                                cs = new_chain(tab, filename, name,
+                                                fixed_atoi(line, len, 13, 4),
+                                                in->len);
+                                if(cs == NULL) goto pch_cleanup;
+                        }
+                        /* At all SEQRES for a chain -- read primary sequence*/
+                        cs = tab->chains[s->slot];
+                        s->nseq += read_seqres_line(cs->sequence + s->nseq,
+                                        line, len, cs->nres - s->nseq);
+                        if(s->nseq == cs->nres) s->complete = 1;
+                        continue;
+                }
 
-        /* Allocate memory for/store input filename */
-        n = strlen(filename) + 1;
-        cs->source_filename = NULL;
-        cs->source_filename = malloc(n * sizeof(*(cs->source_filename)));
-        if(cs->source_filename == NULL) goto gc_error_cleanup;
-        strncpy(cs->source_filename, filename, n);
+                if(all && len >= 6 && memcmp("MODEL ", line, 6) == 0){
+                        for(c = 0; c < 256; c++)
+                                st[c].atoms.n = 0;
+                        continue;
+                }
 
-        cs->sequence = NULL;
-        n = 0;
-        /* Parse SEQRES records from PDB header to find primary seq info */
-        while(fgets(buffer, 1028, fp)!= NULL){
-                strncpy(recname, buffer, 6); 
-                recname[6] = '\0';
-                if(strncmp("SEQRES", recname, 6) == 0) {
-                        chain = buffer[11];
-                        /* At first SEQRES for our chain -- read # of residues*/
-                        if(chain == target_chain && cs->sequence == NULL){
-                                strncpy(numres, buffer+13, 4);
-                                numres[4] =  '\0';
-                                nres = atoi(numres);
-                                cs->sequence = malloc((nres + 1) * sizeof(*(cs->sequence)));
-                                if(cs->sequence == NULL) goto gc_error_cleanup;
-                                memset(cs->sequence, 0, nres + 1);
-                                seq_ptr = cs->sequence;
-                        }
-                        /* At all SEQRES for our chain -- read primary sequence*/
-                        if(chain == target_chain){
-                            n += read_seqres_line(cs->sequence + n, buffer, nres - n);
-                            if(n == nres) break;
-                        }
+                /* Record co-ordinates into the x, y and z arrays */ 
+                if(len < 22) continue;
+                if(memcmp("ATOM  ", line, 6) != 0) continue;
+                ca = memcmp(" CA ", line + 12, 4) == 0;
+                if(!ca && !all) continue;
+                chain = line[21];
+                s = st + (unsigned char) chain;
+                if(s->slot < 0 || !s->complete) continue;
+                cs = tab->chains[s->slot];
+                if(cs->nres == 0) continue;
+
+                n = fixed_atoi(line, len, 22, 4);
+                if(all && n > 0 && n <= cs->nres
+                                && (line[16] == ' ' || line[16] == 'A')){
+                        elen = len >= 78 ? 2 : len > 76 ? len - 76 : 0;
+                        if(heavy_atom(elen > 0 ? line + 76 : NULL, elen,
+                                                line + 12, 4)
+                                        && add_atom(&s->atoms, n,
+                                                fixed_atof(line, len, 30, 8),
+                                                fixed_atof(line, len, 38, 8),
+                                                fixed_atof(line, len, 46, 8))
+                                        != 0)
+                                goto pch_cleanup;
+                }
+                if(!ca) continue;
+
+                /* found an atom at a beyond the terminus of
+                 * the chain recorded in the header.
+                 * No memory allocated to store this info
+                 */
+                if (n <= 0 || n > cs->nres){ 
+                        fprintf(stderr, "WARNING: unexpected ATOM records found in chain %c [length %d].\n%.*s\n", chain, cs->nres, (int)len, line);
+                        continue;
                 }
+
+                /* 
+                 * If coordinates were already stored for this atom (i.e. the
+                 * file contains an alternate position for this residue) we
+                 * simply update them to the ones we just found.
+                 */
+                cs->x[n-1] = fixed_atof(line, len, 30, 8);
+                cs->y[n-1] = fixed_atof(line, len, 38, 8);
+                cs->z[n-1] = fixed_atof(line, len, 46, 8);
+                cs->present[(n-1) / 8] |= 1 << ((n-1) % 8);
         }
-        if(cs->sequence != NULL)
-                cs->sequence[nres] = '\0';
-        if(nres == 0) goto gc_error_cleanup;
-        
-        coords = malloc(nres * sizeof(*coords));
-        if(coords == NULL) goto gc_error_cleanup;
-        for(i = 0; i < nres; i++ ){
-                coords[i] = NULL;
+
+        for(c = 0; all && c < 256; c++){
+                if(st[c].slot < 0) continue;
+                cs = tab->chains[st[c].slot];
+                cs->atoms = group_atoms(&st[c].atoms, cs->nres);
+                if(cs->atoms == NULL) goto pch_cleanup;
         }
 
-        /* Second pass to record co-ordinates into matrix coords */ 
-        while(fgets(buffer, 1028, fp)!= NULL){
-                strncpy(recname, buffer, 6); 
-                recname[6] = '\0';
-                if(strcmp("ATOM  ", recname) == 0) {
-                        strncpy(name, buffer+12, 4);
-                        chain = buffer[21];
-                        name[4] = '\0';
-                        if(strcmp(" CA ", name) == 0 && chain == target_chain){
-                                strncpy(resseq, buffer+22, 4);
-                                resseq[4] =  '\0';
-                                strncpy(x, buffer+30, 8);
-                                strncpy(y, buffer+38, 8);
-                                strncpy(z, buffer+46, 8);
-                                x[8] = '\0';
-                                y[8] = '\0';
-                                z[8] = '\0';
-
-                                n = atoi(resseq);
-
-                                /* found an atom at a beyond the terminus of
-                                 * the chain recorded in the header.
-                                 * No memory allocated to store this info
-                                 */
-                                if (n <= 0 || n > nres){ 
-                                        fprintf(stderr, "WARNING: unexpected ATOM records found in chain %c [length %d].\n%s", chain, nres, buffer);
-                                        continue;
-                                        /* goto gc_error_cleanup; */
-                                }
-
-                                if(coords[n-1] != NULL){
-                                        /* 
-                                         * We already stored coordinates for
-                                         * this atom. (i.e. the file contains
-                                         * an alternate position for this 
-                                         * residue. Not handled right now, and
-                                         * we simply update the coordinates to 
-                                         * the ones we just found.
-                                         */
-                                }
-                                else coords[n-1] = malloc(3 * sizeof(*coords[n-1]));
-                                if(coords[n-1] == NULL) goto gc_error_cleanup;
-                                coords[n-1][0] = atof(x);
-                                coords[n-1][1] = atof(y);
-                                coords[n-1][2] = atof(z);
-                        }
-                }
+        /* Drop chains of zero length */
+        for(c = 0, k = 0; c < tab->nchains; c++){
+                tab->chains[c]->source_bytes = in->len;
+                if(tab->chains[c]->nres == 0)
+                        freecoords(tab->chains[c]);
+                else
+                        tab->chains[k++] = tab->chains[c];
+        }
+        tab->nchains = k;
+        ret = input_all(in);
+
+        pch_cleanup:
+        for(c = 0; c < 256; c++)
+                free(st[c].atoms.recs);
+        return ret;
+}
+
+/**
+ * getchains: read alpha carbon co-ordinates of every chain in a PDB file
+ *
+ * @filename: string containing path to Protein Data Bank file, or "-" to
+ *            read from standard input
+ *
+ * The file is read and parsed once; see parse_chains(). Chains are listed
+ * in the order of their first SEQRES records. Files in mmCIF format are
+ * recognised by their content and read by parse_cif() instead, once they
+ * have been decompressed in full if need be. If the cache is in use (see
+ * use_cache()), the chains come from it when it is still valid, and it is
+ * written after parsing when it is not. The cache holds no atoms, so it
+ * is passed over in all-atom mode.
+ *
+ * Returns NULL if the file can't be read, memory can't be allocated, or
+ * the file has no chains with both a sequence and a length.
+ */
+struct chain_table *
+getchains(char *filename)
+{
+        struct inputbuf *in;
+        struct chain_table *tab;
+        int ret;
+
+        if(!all_atoms_in_use()){
+                tab = read_cache(filename);
+                if(tab != NULL) return tab;
         }
+        in = open_input_stream(filename);
+        if(in == NULL) return NULL;
+        tab = calloc(1, sizeof(*tab));
+        if(tab == NULL) goto gch_error_cleanup;
+        if(is_cif(in))
+                ret = input_all(in) == 0
+                        ? parse_cif(in, filename, NULL, tab) : -1;
+        else
+                ret = parse_chains(in, filename, -1, tab);
+        tab->source_bytes = in->len;
+        if(ret != 0 || tab->nchains == 0)
+                goto gch_error_cleanup;
+        close_input(in);
+        if(!all_atoms_in_use())
+                write_cache(filename, tab);
+        return tab;
+
+        gch_error_cleanup:
+        close_input(in);
+        freechains(tab);
+        return NULL;
+}
+
+/**
+ * find_chain: look up a chain in a chain table
+ *
+ * @tab:   chain table
+ * @chain: chain identifier, of one or more characters
+ *
+ * Returns the index of the chain in @tab, or -1 if it isn't there.
+ */
+int
+find_chain(const struct chain_table *tab, const char *chain)
+{
+        int k;
+
+        for(k = 0; k < tab->nchains; k++)
+                if(strcmp(tab->chains[k]->chain_name, chain) == 0)
+                        return k;
+        return -1;
+}
+
+/**
+ * freechains: free a struct chain_table allocated by getchains()
+ */
+void
+freechains(struct chain_table *tab)
+{
+        int k;
+
+        if(tab == NULL) return;
+        for(k = 0; k < tab->nchains; k++)
+                freecoords(tab->chains[k]);
+        free(tab->chains);
+        free(tab);
+}
+
+/**
+ * join_chains: combine every chain of a chain table into one
+ *
+ * @tab: chain table
+ *
+ * The chains are placed one after another in table order, so residue i of
+ * chain k becomes residue i + (the lengths of chains 0 .. k-1). The
+ * result has no chain identifier (source_chain is 0, chain_name NULL).
+ * In all-atom mode their atoms are joined the same way.
+ *
+ * Allocates and returns a struct coords, which should be freed with
+ * freecoords(), or returns NULL on error.
+ */
+struct coords *
+join_chains(const struct chain_table *tab)
+{
+        struct coords *cs, *c;
+        int k, i, n, nres = 0;
+
+        for(k = 0; k < tab->nchains; k++)
+                nres += tab->chains[k]->nres;
+        if(nres == 0) return NULL;
+        cs = calloc(1, sizeof(*cs));
+        if(cs == NULL) return NULL;
         cs->nres = nres;
-        cs->coords = coords;
-        fclose(fp);
+        cs->source_bytes = tab->source_bytes;
+        cs->source_filename = strdup(tab->chains[0]->source_filename);
+        cs->sequence = calloc(nres + 1, sizeof(*(cs->sequence)));
+        if(cs->source_filename == NULL || cs->sequence == NULL
+                        || alloc_coords(cs, nres) != 0){
+                freecoords(cs);
+                return NULL;
+        }
+        for(k = 0, n = 0; k < tab->nchains; k++){
+                c = tab->chains[k];
+                memcpy(cs->x + n, c->x, c->nres * sizeof(*cs->x));
+                memcpy(cs->y + n, c->y, c->nres * sizeof(*cs->y));
+                memcpy(cs->z + n, c->z, c->nres * sizeof(*cs->z));
+                memcpy(cs->sequence + n, c->sequence, c->nres);
+                for(i = 0; i < c->nres; i++)
+                        if(RES_PRESENT(*c, i))
+                                cs->present[(n + i) / 8] |= 1 << ((n + i) % 8);
+                n += c->nres;
+        }
+        if(tab->chains[0]->atoms != NULL){
+                cs->atoms = join_atoms(tab);
+                if(cs->atoms == NULL){
+                        freecoords(cs);
+                        return NULL;
+                }
+        }
         return cs;
+}
 
-        /* In the event of an error in this function: 
-         * Avoid leaking memory by freeing all allocated memory before
-         * returning NULL. Needed if any call to malloc after the first fails.
-         */
-        gc_error_cleanup:
-        if(cs){
-                if(cs->source_filename != NULL) free(cs->source_filename);
-                if(cs->sequence != NULL) free(cs->sequence);
-                free(cs);
+/**
+ * getcoords: read alpha carbon co-ordinates from a PDB file
+ *
+ * @filename: string containing path to Protein Data Bank file, or "-" to
+ *            read from standard input
+ * @chain: chain identifier; PDB files only have single-character ones
+ *
+ * Like getchains(), but only @chain is kept. With the cache in use every
+ * chain is read through getchains() instead, so that the cache covers the
+ * whole file.
+ */
+struct coords *
+getcoords(char* filename, const char *target_chain){
+        struct inputbuf *in;
+        struct chain_table tab = {NULL, 0, 0}, *all;
+        struct coords *cs = NULL;
+        int k, ret = 0;
+
+        if(cache_in_use()){
+                all = getchains(filename);
+                if(all == NULL) return NULL;
+                k = find_chain(all, target_chain);
+                if(k >= 0){
+                        cs = all->chains[k];
+                        all->chains[k] = all->chains[--all->nchains];
+                }
+                freechains(all);
+                return cs;
         }
-        if(coords){
-                for(i=0; i<nres; i++ ){
-                        if(coords[i]){
-                                free(coords[i]);
-                                coords[i] = NULL;
-                        }
+
+        in = open_input_stream(filename);
+        if (in == NULL) return NULL;
+        if(is_cif(in))
+                ret = input_all(in) == 0
+                        ? parse_cif(in, filename, target_chain, &tab) : -1;
+        else if(target_chain[0] != '\0' && target_chain[1] == '\0')
+                ret = parse_chains(in, filename,
+                                (unsigned char) target_chain[0], &tab);
+        if(ret == 0 && tab.nchains == 1){
+                cs = tab.chains[0];
+                tab.nchains = 0;
+        }
+        close_input(in);
+        for(k = 0; k < tab.nchains; k++)
+                freecoords(tab.chains[k]);
+        free(tab.chains);
+        return cs;
+}
+
+/**
+ * ca_atom_index: find where the alpha carbons of a chain come among the
+ *                atoms of a PDB file
+ *
+ * @filename: string containing path to Protein Data Bank file, or "-" to
+ *            read from standard input
+ * @cs:       coordinates of the chain, as read by getcoords()
+ * @natoms:   set to the number of atoms in the file
+ *
+ * Atoms are numbered from 0 in the order of their ATOM and HETATM records
+ * up to the end of the first model, which is the order binary trajectories
+ * store them in. Alpha carbons are picked out as in getcoords(), so the
+ * last record for a residue wins.
+ *
+ * Returns an array of @cs->nres atom numbers, -1 for residues without an
+ * alpha carbon, or NULL if the file can't be read or memory can't be
+ * allocated.
+ */
+int *
+ca_atom_index(char *filename, const struct coords *cs, int *natoms)
+{
+        struct inputbuf *in;
+        const char *line, *eol, *end;
+        size_t len;
+        int *index;
+        int k, n;
+
+        in = open_input_stream(filename);
+        if(in == NULL) return NULL;
+        index = malloc((cs->nres + 1) * sizeof(*index));
+        if(index == NULL){
+                close_input(in);
+                return NULL;
+        }
+        for(k = 0; k < cs->nres; k++)
+                index[k] = -1;
+        end = in->data + in->len;
+        for(line = in->data, k = 0; (eol = input_line(in, line, &end)) != NULL;
+                        line = eol + 1){
+                len = eol - line;
+                if(len > 0 && line[len - 1] == '\r') len--;
+                if(len >= 6 && memcmp("ENDMDL", line, 6) == 0) break;
+                if(len < 6 || (memcmp("ATOM  ", line, 6) != 0
+                                        && memcmp("HETATM", line, 6) != 0))
+                        continue;
+                k++;
+                if(len < 22 || line[0] != 'A') continue;
+                if(memcmp(" CA ", line + 12, 4) != 0) continue;
+                if(line[21] != cs->source_chain) continue;
+                n = fixed_atoi(line, len, 22, 4);
+                if(n > 0 && n <= cs->nres) index[n - 1] = k - 1;
+        }
+        close_input(in);
+        *natoms = k;
+        return index;
+}
+
+/**
+ * open_models: start reading the models of one chain of a PDB file
+ *
+ * @filename: string containing path to Protein Data Bank file, or "-" to
+ *            read from standard input
+ * @chain:    chain identifier
+ *
+ * Reads the SEQRES records of @chain, up to the point where its sequence
+ * is complete; the coordinates are then read one model at a time by
+ * next_model().
+ *
+ * Returns NULL if the file can't be read, memory can't be allocated, or
+ * the chain has no sequence.
+ */
+struct model_reader *
+open_models(char *filename, char chain)
+{
+        struct model_reader *mr;
+        struct chain_table tab = {NULL, 0, 0};
+        const char *line, *eol, *end;
+        size_t len;
+        char name[2] = {chain, '\0'};
+        int n = 0;
+
+        mr = calloc(1, sizeof(*mr));
+        if(mr == NULL) return NULL;
+        mr->in = open_input_stream(filename);
+        if(mr->in == NULL) goto om_error_cleanup;
+
+        end = mr->in->data + mr->in->len;
+        for(line = mr->in->data; (eol = input_line(mr->in, line, &end)) != NULL;
+                        line = eol + 1){
+                len = eol - line;
+                if(len > 0 && line[len - 1] == '\r') len--;
+                if(len < 12 || memcmp("SEQRES", line, 6) != 0) continue;
+                if(line[11] != chain) continue;
+                if(mr->cs == NULL){
+                        mr->cs = new_chain(&tab, filename, name,
+                                        fixed_atoi(line, len, 13, 4),
+                                        mr->in->len);
+                        if(mr->cs == NULL || mr->cs->nres == 0)
+                                goto om_error_cleanup;
                 }
-                free(coords);
+                n += read_seqres_line(mr->cs->sequence + n, line, len,
+                                mr->cs->nres - n);
+                if(n == mr->cs->nres) break;
         }
+        if(mr->cs == NULL) goto om_error_cleanup;
+        mr->pos = eol != NULL ? line : end;
+        free(tab.chains);
+        return mr;
+
+        om_error_cleanup:
+        if(tab.nchains > 0) freecoords(tab.chains[0]);
+        free(tab.chains);
+        mr->cs = NULL;
+        close_models(mr);
         return NULL;
 }
 
+/**
+ * next_model: read the coordinates of the next model
+ *
+ * @mr: model reader from open_models()
+ *
+ * A model runs from a MODEL record to the next ENDMDL record. Alpha carbon
+ * ATOM records of the chain are stored into mr->cs, which is cleared
+ * first, so residues missing from this model are marked missing. A file
+ * without MODEL records holds a single model. Residue numbers outside the
+ * sequence are reported in the first model only.
+ *
+ * The part of a mapped or decompressed file holding earlier models is
+ * released as each model is read, so memory use stays flat however many
+ * models there are.
+ *
+ * Returns 1 if a model was read, 0 if there are no more, or -1 if the
+ * file couldn't be decompressed.
+ */
+int
+next_model(struct model_reader *mr)
+{
+        struct coords *cs = mr->cs;
+        const char *line, *eol, *end;
+        size_t len;
+        int n, found = 0;
+
+        memset(cs->present, 0, (cs->nres + 7) / 8);
+        end = mr->in->data + mr->in->len;
+        for(line = mr->pos; (eol = input_line(mr->in, line, &end)) != NULL;
+                        line = eol + 1){
+                len = eol - line;
+                if(len > 0 && line[len - 1] == '\r') len--;
+                if(len >= 6 && memcmp("ENDMDL", line, 6) == 0){
+                        mr->pos = eol < end ? eol + 1 : end;
+                        mr->nmodels++;
+                        release_input(mr->in, mr->pos);
+                        return 1;
+                }
+                if(len >= 6 && memcmp("MODEL ", line, 6) == 0){
+                        memset(cs->present, 0, (cs->nres + 7) / 8);
+                        found = 1;
+                        continue;
+                }
+                if(len < 22) continue;
+                if(memcmp("ATOM  ", line, 6) != 0) continue;
+                if(memcmp(" CA ", line + 12, 4) != 0) continue;
+                if(line[21] != cs->source_chain) continue;
+                found = 1;
+
+                n = fixed_atoi(line, len, 22, 4);
+                if (n <= 0 || n > cs->nres){ 
+                        if(mr->nmodels == 0)
+                                fprintf(stderr, "WARNING: unexpected ATOM records found in chain %c [length %d].\n%.*s\n", cs->source_chain, cs->nres, (int)len, line);
+                        continue;
+                }
+                cs->x[n-1] = fixed_atof(line, len, 30, 8);
+                cs->y[n-1] = fixed_atof(line, len, 38, 8);
+                cs->z[n-1] = fixed_atof(line, len, 46, 8);
+                cs->present[(n-1) / 8] |= 1 << ((n-1) % 8);
+        }
+        mr->pos = end;
+        if(input_all(mr->in) != 0) return -1;
+        if(!found) return 0;
+        mr->nmodels++;
+        return 1;
+}
+
+/**
+ * close_models: free a struct model_reader allocated by open_models()
+ */
+void
+close_models(struct model_reader *mr)
+{
+        if(mr == NULL) return;
+        if(mr->in != NULL) close_input(mr->in);
+        freecoords(mr->cs);
+        free(mr);
+}
+
 /**
  * freecoords: free a struct coords allocated by getcoords()
  * @cs: pointer to struct coords which is to be freed
  */
 void freecoords(struct coords *cs){
-        int i;
         if(cs == NULL) return;
-        for(i = 0; i < cs->nres; i++){
-                if(cs->coords[i] != NULL){
-                        free(cs->coords[i]);
-                        cs->coords[i] = NULL;
-                }
-        }
-        free(cs->coords);
-        cs->coords = NULL;
+        /* x, y and z share one allocation */
+        free(cs->x);
+        cs->x = cs->y = cs->z = NULL;
+        free(cs->present);
+        cs->present = NULL;
         if(cs->source_filename != NULL) free(cs->source_filename);
         cs->source_filename = NULL;
+        free(cs->chain_name);
+        cs->chain_name = NULL;
+        freeatoms(cs->atoms);
+        cs->atoms = NULL;
         if(cs->sequence != NULL) free(cs->sequence);
         cs->sequence = NULL;
         free(cs);
 }
 
 
+/*
+ * Residue codes are looked up in a table indexed directly by the three
+ * characters of the code. Each character is one of ' ' or 'A'-'Z', so
+ * TLC_INDEX() maps a code to a unique slot in [0, 27^3). Unused slots are
+ * zero.
+ */
+#define TLC_CHAR(c) ((c) == ' ' ? 0 : (c) - 'A' + 1)
+#define TLC_INDEX(a, b, c) \
+        ((TLC_CHAR(a) * 27 + TLC_CHAR(b)) * 27 + TLC_CHAR(c))
+
+static const char tlc_table[27 * 27 * 27] = {
+        /* Amino acids */
+        [TLC_INDEX('A', 'L', 'A')] = 'A',
+        [TLC_INDEX('A', 'S', 'X')] = 'B',
+        [TLC_INDEX('C', 'Y', 'S')] = 'C',
+        [TLC_INDEX('A', 'S', 'P')] = 'D',
+        [TLC_INDEX('G', 'L', 'U')] = 'E',
+        [TLC_INDEX('P', 'H', 'E')] = 'F',
+        [TLC_INDEX('G', 'L', 'Y')] = 'G',
+        [TLC_INDEX('H', 'I', 'S')] = 'H',
+        [TLC_INDEX('I', 'L', 'E')] = 'I',
+        [TLC_INDEX('L', 'Y', 'S')] = 'K',
+        [TLC_INDEX('L', 'E', 'U')] = 'L',
+        [TLC_INDEX('M', 'E', 'T')] = 'M',
+        [TLC_INDEX('A', 'S', 'N')] = 'N',
+        [TLC_INDEX('P', 'R', 'O')] = 'P',
+        [TLC_INDEX('G', 'L', 'N')] = 'Q',
+        [TLC_INDEX('A', 'R', 'G')] = 'R',
+        [TLC_INDEX('S', 'E', 'R')] = 'S',
+        [TLC_INDEX('T', 'H', 'R')] = 'T',
+        [TLC_INDEX('V', 'A', 'L')] = 'V',
+        [TLC_INDEX('T', 'R', 'P')] = 'W',
+        [TLC_INDEX('X', 'A', 'A')] = 'X',
+        [TLC_INDEX('T', 'Y', 'R')] = 'Y',
+        [TLC_INDEX('G', 'L', 'X')] = 'Z',
+        /* Ribonucleotides */ 
+        [TLC_INDEX(' ', ' ', 'A')] = 'A',
+        [TLC_INDEX(' ', ' ', 'C')] = 'C',
+        [TLC_INDEX(' ', ' ', 'G')] = 'G',
+        [TLC_INDEX(' ', ' ', 'U')] = 'U',
+        /* Deoxyribonucleotides */ 
+        [TLC_INDEX(' ', 'D', 'A')] = 'A',
+        [TLC_INDEX(' ', 'D', 'C')] = 'C',
+        [TLC_INDEX(' ', 'D', 'G')] = 'G',
+        [TLC_INDEX(' ', 'D', 'T')] = 'T',
+};
+
+#define TLC_VALID(c) ((c) == ' ' || ((c) >= 'A' && (c) <= 'Z'))
+
 /**
  * one_letter_code
  * convert three letter amino acid codes to one letter codes
@@ -367,47 +1138,21 @@ void freecoords(struct coords *cs){
  * Will also process one and two letter RNA/DNA codes valid in PDB SEQRES 
  * records.
  *
+ * Unknown codes map to 'X'. The lookup is a single table access.
  */
 char
 one_letter_code(char *three_letter_code)
 {
+        char a, b, c, code;
         if(three_letter_code == NULL) return 'X';
-        /* Amino acids */
-        if(0 == strncmp(three_letter_code, "ALA", 3)) return 'A';
-        if(0 == strncmp(three_letter_code, "ASX", 3)) return 'B';
-        if(0 == strncmp(three_letter_code, "CYS", 3)) return 'C';
-        if(0 == strncmp(three_letter_code, "ASP", 3)) return 'D';
-        if(0 == strncmp(three_letter_code, "GLU", 3)) return 'E';
-        if(0 == strncmp(three_letter_code, "PHE", 3)) return 'F';
-        if(0 == strncmp(three_letter_code, "GLY", 3)) return 'G';
-        if(0 == strncmp(three_letter_code, "HIS", 3)) return 'H';
-        if(0 == strncmp(three_letter_code, "ILE", 3)) return 'I';
-        if(0 == strncmp(three_letter_code, "LYS", 3)) return 'K';
-        if(0 == strncmp(three_letter_code, "LEU", 3)) return 'L';
-        if(0 == strncmp(three_letter_code, "MET", 3)) return 'M';
-        if(0 == strncmp(three_letter_code, "ASN", 3)) return 'N';
-        if(0 == strncmp(three_letter_code, "PRO", 3)) return 'P';
-        if(0 == strncmp(three_letter_code, "GLN", 3)) return 'Q';
-        if(0 == strncmp(three_letter_code, "ARG", 3)) return 'R';
-        if(0 == strncmp(three_letter_code, "SER", 3)) return 'S';
-        if(0 == strncmp(three_letter_code, "THR", 3)) return 'T';
-        if(0 == strncmp(three_letter_code, "VAL", 3)) return 'V';
-        if(0 == strncmp(three_letter_code, "TRP", 3)) return 'W';
-        if(0 == strncmp(three_letter_code, "XAA", 3)) return 'X';
-        if(0 == strncmp(three_letter_code, "TYR", 3)) return 'Y';
-        if(0 == strncmp(three_letter_code, "GLX", 3)) return 'Z';
-        /* Ribonucleotides */ 
-        if(0 == strncmp(three_letter_code, "  A", 3)) return 'A';
-        if(0 == strncmp(three_letter_code, "  C", 3)) return 'C';
-        if(0 == strncmp(three_letter_code, "  G", 3)) return 'G';
-        if(0 == strncmp(three_letter_code, "  U", 3)) return 'U';
-        /* Deoxyribonucleotides */ 
-        if(0 == strncmp(three_letter_code, " DA", 3)) return 'A';
-        if(0 == strncmp(three_letter_code, " DC", 3)) return 'C';
-        if(0 == strncmp(three_letter_code, " DG", 3)) return 'G';
-        if(0 == strncmp(three_letter_code, " DT", 3)) return 'T';
-        /* Default */
-        return 'X';
+        a = three_letter_code[0];
+        if(!TLC_VALID(a)) return 'X';
+        b = three_letter_code[1];
+        if(!TLC_VALID(b)) return 'X';
+        c = three_letter_code[2];
+        if(!TLC_VALID(c)) return 'X';
+        code = tlc_table[TLC_INDEX(a, b, c)];
+        return code ? code : 'X';
 }
 
 /**
@@ -415,7 +1160,8 @@ one_letter_code(char *three_letter_code)
  *                   fragment
  *
  * @out_buffer: pointer to allocated character array of length >= n
- * @line:       pointer to string containing a PDB seqres record
+ * @line:       pointer to a PDB seqres record (need not be null-terminated)
+ * @len:        length of the record at @line, excluding any newline
  * @n:          maximum number of characters to write to out_buffer
  *
  * Returns the number of characters written to @out_buffer.
@@ -436,43 +1182,34 @@ one_letter_code(char *three_letter_code)
  *
  */
 int
-read_seqres_line(char* out_buffer, char *line, int n)
+read_seqres_line(char* out_buffer, const char *line, size_t len, int n)
 {
-        char recname[7];
-        char sernum[4];
-        char resname[4];
-        char numres[5];
-
         int i;
         int total_res;
         int serial;
         int recorded_res;
         int offset;
+        size_t col;
 
         if(line == NULL) return 0;
         if(out_buffer == NULL) return 0;
         if(n <= 0) return 0;
         
-        strncpy(recname, line, 6);
-        recname[6] = '\0';
-        if(0 != strncmp("SEQRES", recname, 6)) return 0;
-
-        strncpy(sernum, line + 7, 3);
-        sernum[3] = '\0';
-        serial = atoi(sernum);
-       
-        strncpy(numres, line+13, 4);
-        numres[4] = '\0';
-        total_res = atoi(numres);
+        if(len < 6 || 0 != memcmp("SEQRES", line, 6)) return 0;
+
+        serial = fixed_atoi(line, len, 7, 3);
+        total_res = fixed_atoi(line, len, 13, 4);
 
         offset =  (serial - 1) * 13;        
         recorded_res = total_res - offset > 13 ? 13 : total_res - offset;
 
         i=0;
         while(i < recorded_res && i < n){
-                strncpy(resname, line + 19 + (4 * i), 3);
-                resname[3] = '\0';
-                out_buffer[i] = one_letter_code(resname);
+                col = 19 + (4 * i);
+                if(col + 3 <= len)
+                        out_buffer[i] = one_letter_code((char *)line + col);
+                else
+                        out_buffer[i] = 'X';
                 i++;
         }
         return i;
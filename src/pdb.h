@@ -21,29 +21,139 @@
 #ifndef CMAP_PDB_H_
 #define CMAP_PDB_H_
 
+#include<stddef.h>
+
+/*
+ * Coordinate arrays in struct coords are aligned to COORDS_ALIGN bytes and
+ * padded to COORDS_STRIDE(nres) entries.
+ */
+#define COORDS_ALIGN 64
+#define COORDS_STRIDE(n) \
+        (((size_t)(n) + COORDS_ALIGN / sizeof(double) - 1) \
+         / (COORDS_ALIGN / sizeof(double)) * (COORDS_ALIGN / sizeof(double)))
+
+/*
+ * RES_PRESENT(cs, i):
+ * TRUE if coordinates were read for residue @i (zero-based) of struct coords
+ * @cs. Missing residues have zero coordinates.
+ */
+#define RES_PRESENT(cs, i) (((cs).present[(i) / 8] >> ((i) % 8)) & 1)
+
+/*
+ * Alpha carbon coordinates of one chain. @chain_name is the full chain
+ * identifier, which mmCIF files allow to be several characters long;
+ * @source_chain holds it too if it is a single character. In all-atom mode
+ * (see use_all_atoms()) @atoms holds the heavy atoms of every residue, and
+ * distances are measured between those instead.
+ */
+struct atoms;
 struct coords{
-        double **coords;
+        double *x;
+        double *y;
+        double *z;
+        unsigned char *present;
         char *source_filename;
         char *sequence;
+        char *chain_name;
+        struct atoms *atoms;
+        size_t source_bytes;
         int nres;
         char source_chain;
 };
 
+/* Every chain read from one file, in the order of their SEQRES records */
+struct chain_table{
+        struct coords **chains;
+        int nchains;
+        size_t source_bytes;
+};
+
+/*
+ * Reads the models of one chain of a PDB file one at a time, into a single
+ * struct coords that is overwritten by each model.
+ */
+struct inputbuf;
+struct model_reader{
+        struct inputbuf *in;
+        const char *pos;
+        struct coords *cs;
+        int nmodels;
+};
+
+/* Storage type for the distances held in struct distmat */
+enum dm_precision{
+        DM_DOUBLE,
+        DM_FLOAT,
+        DM_UINT8
+};
+
+/*
+ * DM_UINT8 matrices store each distance d as one byte q, in units of half
+ * of DM_QUANT_STEP:
+ *
+ *   q = 2 * floor(d / DM_QUANT_STEP) + (1 if d isn't a whole number of steps)
+ *
+ * so any comparison d <= t or d < t with t a whole number of steps gives
+ * exactly the same answer as with the unquantised distance, as long as t is
+ * no more than DM_QUANT_MAX. Distances over DM_QUANT_MAX saturate to
+ * q = 255, which dm_unquantize() turns into DIST_MISSING.
+ *
+ * DM_QUANT_AUTO: chains at least this long use DM_UINT8 unless another
+ * precision is asked for, if dm_quant_exact() allows it; see
+ * dm_auto_precision().
+ */
+#define DM_QUANT_STEP 0.5
+#define DM_QUANT_MAX (127 * DM_QUANT_STEP)
+#define DM_QUANT_AUTO 8000
+
+/*
+ * DM_INDEX(n, i, j):
+ * Position of the distance between residues @i and @j (i < j) in the packed
+ * upper triangle of an @n residue distance matrix. Row i holds the n - i - 1
+ * distances to residues i+1 .. n-1.
+ *
+ * DM_SIZE(n):
+ * Number of distances in the packed triangle.
+ */
+#define DM_INDEX(n, i, j) \
+        ((size_t)(i) * (2 * (size_t)(n) - (i) - 1) / 2 + ((j) - (i) - 1))
+#define DM_SIZE(n) ((size_t)(n) * ((n) - 1) / 2)
+
 struct distmat{
-        double **mat;
+        void *mat;
         char *source_filename;
         char *sequence;
+        char *chain_name;
         int nres;
         char source_chain;
+        enum dm_precision precision;
 };
 
-struct distmat * calculate_distmat(struct coords cs);
+int * ca_atom_index(char *filename, const struct coords *cs, int *natoms);
+void close_models(struct model_reader *mr);
+enum dm_precision dm_auto_precision(enum dm_precision precision,
+                int automatic, int nres, double threshold);
+int dm_quant_exact(double threshold);
+unsigned char dm_quantize(double d);
+double dm_unquantize(unsigned char q);
+struct distmat * calculate_distmat(struct coords cs, enum dm_precision precision,
+                int nthreads);
 double euclid3d(double x1, double y1, double z1, double x2, double y2, double z2);
+int find_chain(const struct chain_table *tab, const char *chain);
+double fixed_atof(const char *line, size_t len, size_t start, size_t width);
+int fixed_atoi(const char *line, size_t len, size_t start, size_t width);
+void freechains(struct chain_table *tab);
 void freecoords(struct coords *cs);
 void freedm(struct distmat *dm);
-struct coords * getcoords(char* filename, char chain);
+struct chain_table * getchains(char *filename);
+struct coords * getcoords(char* filename, const char *chain);
 double getdist(struct distmat dm, int i, int j);
+struct coords * join_chains(const struct chain_table *tab);
+struct coords * new_chain(struct chain_table *tab, char *filename,
+                const char *name, int nres, size_t bytes);
+int next_model(struct model_reader *mr);
 char one_letter_code(char *three_letter_code);
-int read_seqres_line(char* out_buffer, char *line, int n);
+struct model_reader * open_models(char *filename, char chain);
+int read_seqres_line(char* out_buffer, const char *line, size_t len, int n);
 
 #endif // CMAP_PDB_H_
@@ -0,0 +1,207 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#include<pthread.h>
+#include<unistd.h>
+
+#include"threads.h"
+
+/*
+ * The worker pool. Workers are started the first time a run_chunks() call
+ * wants them and then live for the rest of the program, asleep on @work
+ * between calls, so a caller that runs many small jobs (one per frame of a
+ * trajectory, say) pays for a wakeup per job rather than for creating and
+ * joining threads. One job runs at a time; everything here is protected
+ * by @lock.
+ */
+static struct{
+        pthread_mutex_t lock;
+        pthread_cond_t work;    /* a job has been posted */
+        pthread_cond_t done;    /* the last helper has left a job */
+        pthread_cond_t idle;    /* the pool is free for the next job */
+        int nworkers;
+        int busy;               /* a job is running */
+        unsigned long job;      /* number of the current or last job */
+        int wanted;             /* helpers still wanted on the current job */
+        int active;             /* helpers working on the current job */
+        size_t next;
+        size_t nchunks;
+        chunk_fn fn;
+        void *arg;
+} g_pool = {
+        PTHREAD_MUTEX_INITIALIZER,
+        PTHREAD_COND_INITIALIZER,
+        PTHREAD_COND_INITIALIZER,
+        PTHREAD_COND_INITIALIZER,
+        0, 0, 0, 0, 0, 0, 0, NULL, NULL
+};
+
+/* Set in pool workers, and in a caller while its job runs */
+static __thread int t_in_pool = 0;
+
+/**
+ * claim_chunks: process chunks of the current job until none are left
+ *
+ * Called with g_pool.lock held, and returns with it held. Chunks are
+ * handed out in order but may finish in any order, so the job's function
+ * must only write to memory owned by its chunk.
+ */
+static void
+claim_chunks(void)
+{
+        size_t chunk;
+        chunk_fn fn = g_pool.fn;
+        void *arg = g_pool.arg;
+
+        while(g_pool.next < g_pool.nchunks){
+                chunk = g_pool.next++;
+                pthread_mutex_unlock(&g_pool.lock);
+                fn(arg, chunk);
+                pthread_mutex_lock(&g_pool.lock);
+        }
+}
+
+/**
+ * pool_worker: thread body of a pool worker
+ *
+ * Sleeps until a job is posted, helps with it if the job still wants
+ * helpers, and goes back to sleep.
+ */
+static void *
+pool_worker(void *p)
+{
+        unsigned long seen;
+
+        (void) p;
+        t_in_pool = 1;
+        pthread_mutex_lock(&g_pool.lock);
+        seen = g_pool.job;
+        while(1){
+                while(g_pool.job == seen)
+                        pthread_cond_wait(&g_pool.work, &g_pool.lock);
+                seen = g_pool.job;
+                if(g_pool.wanted == 0) continue;
+                g_pool.wanted--;
+                g_pool.active++;
+                claim_chunks();
+                if(--g_pool.active == 0)
+                        pthread_cond_signal(&g_pool.done);
+        }
+        return NULL;
+}
+
+/**
+ * grow_pool: start workers until there are @n, or until one can't be
+ *            started
+ *
+ * Called with g_pool.lock held.
+ */
+static void
+grow_pool(int n)
+{
+        pthread_attr_t attr;
+        pthread_t tid;
+
+        if(g_pool.nworkers >= n) return;
+        if(pthread_attr_init(&attr) != 0) return;
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        while(g_pool.nworkers < n){
+                if(pthread_create(&tid, &attr, pool_worker, NULL) != 0)
+                        break;
+                g_pool.nworkers++;
+        }
+        pthread_attr_destroy(&attr);
+}
+
+/**
+ * default_threads: number of worker threads to use if not told otherwise
+ *
+ * Returns the number of online processors, or 1 if that is unknown.
+ */
+int
+default_threads(void)
+{
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n < 1 ? 1 : (int) n;
+}
+
+/**
+ * run_chunks: process chunks of work on the pool of threads
+ *
+ * @nthreads: number of threads to use (the calling thread is one of them)
+ * @nchunks:  number of chunks of work
+ * @fn:       function called as fn(@arg, chunk) for every chunk
+ * @arg:      passed through to @fn
+ *
+ * Chunks are claimed dynamically, so uneven chunks still balance across
+ * threads. Returns once every chunk has been processed.
+ *
+ * The pool is started on first use and grown as needed; its threads are
+ * kept for later calls. If some can't be started, the work is shared by
+ * those that could be. A call made from inside a job (by @fn, on any
+ * thread) runs its chunks on the calling thread alone, and calls from
+ * other threads wait for the pool to be free.
+ *
+ * Returns 0 on success. (Nothing can currently fail; the return value is
+ * kept so callers needn't change if that ever does.)
+ */
+int
+run_chunks(int nthreads, size_t nchunks, chunk_fn fn, void *arg)
+{
+        size_t chunk;
+
+        if(nchunks == 0) return 0;
+        if(nthreads > (int) nchunks) nthreads = nchunks;
+        if(nthreads <= 1 || t_in_pool){
+                for(chunk = 0; chunk < nchunks; chunk++)
+                        fn(arg, chunk);
+                return 0;
+        }
+
+        pthread_mutex_lock(&g_pool.lock);
+        while(g_pool.busy)
+                pthread_cond_wait(&g_pool.idle, &g_pool.lock);
+        grow_pool(nthreads - 1);
+        g_pool.busy = 1;
+        g_pool.job++;
+        g_pool.wanted = nthreads - 1 < g_pool.nworkers ? nthreads - 1
+                : g_pool.nworkers;
+        g_pool.active = 0;
+        g_pool.next = 0;
+        g_pool.nchunks = nchunks;
+        g_pool.fn = fn;
+        g_pool.arg = arg;
+        if(g_pool.wanted > 0) pthread_cond_broadcast(&g_pool.work);
+
+        t_in_pool = 1;
+        claim_chunks();
+        t_in_pool = 0;
+
+        /* Turn away late helpers, then wait for the ones still working */
+        g_pool.wanted = 0;
+        while(g_pool.active > 0)
+                pthread_cond_wait(&g_pool.done, &g_pool.lock);
+        g_pool.busy = 0;
+        g_pool.fn = NULL;
+        g_pool.arg = NULL;
+        pthread_cond_signal(&g_pool.idle);
+        pthread_mutex_unlock(&g_pool.lock);
+        return 0;
+}
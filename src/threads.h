@@ -0,0 +1,35 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#ifndef CMAP_THREADS_H_
+#define CMAP_THREADS_H_
+
+#include<stddef.h>
+
+/*
+ * A unit of parallel work: called once for each chunk index in
+ * [0, nchunks), from whichever worker thread claims it.
+ */
+typedef void (*chunk_fn)(void *arg, size_t chunk);
+
+int default_threads(void);
+int run_chunks(int nthreads, size_t nchunks, chunk_fn fn, void *arg);
+
+#endif // CMAP_THREADS_H_
@@ -0,0 +1,295 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#include<stdlib.h>
+#include<string.h>
+
+#include"pdb.h"
+#include"tiles.h"
+
+/**
+ * make_tile_cache: create an empty tile cache for a distance matrix
+ *
+ * @dist:   distance matrix to draw tiles from; it must outlive the cache
+ * @ntiles: number of tiles to keep
+ *
+ * Allocates and returns a struct tile_cache which should be freed with
+ * freetilecache(), or returns NULL if memory can't be allocated.
+ */
+struct tile_cache *
+make_tile_cache(struct distmat dist, size_t ntiles)
+{
+        struct tile_cache *tc;
+        size_t i;
+
+        tc = malloc(sizeof(*tc));
+        if(tc == NULL) return NULL;
+        for(tc->nbuckets = 1; tc->nbuckets < ntiles; tc->nbuckets *= 2)
+                ;
+        tc->tiles = malloc(ntiles * sizeof(*tc->tiles));
+        tc->bucket = malloc(tc->nbuckets * sizeof(*tc->bucket));
+        if(tc->tiles == NULL || tc->bucket == NULL){
+                free(tc->tiles);
+                free(tc->bucket);
+                free(tc);
+                return NULL;
+        }
+        for(i = 0; i < ntiles; i++){
+                tc->tiles[i].row = -1;
+                tc->tiles[i].last_used = 0;
+                tc->tiles[i].next = -1;
+        }
+        for(i = 0; i < tc->nbuckets; i++)
+                tc->bucket[i] = -1;
+        tc->dist = dist;
+        tc->clock = 0;
+        tc->ntiles = ntiles;
+        tc->rows = dist.nres % 4 == 0 ? dist.nres/4 : dist.nres/4 + 1;
+        tc->cols = dist.nres % 2 == 0 ? dist.nres/2 : dist.nres/2 + 1;
+        return tc;
+}
+
+/**
+ * freetilecache: free a struct tile_cache allocated by make_tile_cache()
+ * @tc: pointer to struct tile_cache which is to be freed
+ */
+void
+freetilecache(struct tile_cache *tc)
+{
+        if(tc == NULL) return;
+        free(tc->tiles);
+        free(tc->bucket);
+        free(tc);
+}
+
+/**
+ * fill_tile: compute a tile from scratch
+ *
+ * @tc: tile cache, for the distance matrix
+ * @t:  tile to fill, with its row, column and threshold already set
+ */
+static void
+fill_tile(const struct tile_cache *tc, struct tile *t)
+{
+        int y0 = 4 * TILE_ROWS * t->row;
+        int x0 = 2 * TILE_COLS * t->col;
+        int y1 = y0 + 4 * TILE_ROWS;
+        int x1 = x0 + 2 * TILE_COLS;
+        int y, x, cell;
+        double d;
+        unsigned char q;
+
+        memset(t->pattern, 0, TILE_CELLS);
+        memset(t->qmin, 255, TILE_CELLS);
+        memset(t->qmax, 0, TILE_CELLS);
+        if(y1 > tc->dist.nres) y1 = tc->dist.nres;
+        if(x1 > tc->dist.nres) x1 = tc->dist.nres;
+        for(y = y0; y < y1; y++){
+                for(x = x0; x < x1; x++){
+                        cell = (y - y0) / 4 * TILE_COLS + (x - x0) / 2;
+                        d = getdist(tc->dist, y, x);
+                        q = dm_quantize(d);
+                        if(q < t->qmin[cell]) t->qmin[cell] = q;
+                        if(q > t->qmax[cell]) t->qmax[cell] = q;
+                        if(d <= t->threshold)
+                                t->pattern[cell] |= 1 << (2 * (y % 4) + x % 2);
+                }
+        }
+}
+
+/**
+ * cell_bits: recompute the braille_lut index for one cell of a tile
+ *
+ * @tc:        tile cache, for the distance matrix
+ * @t:         tile
+ * @cell:      index of the cell within @t
+ * @threshold: threshold for defining a contact (Angstroms)
+ */
+static unsigned char
+cell_bits(const struct tile_cache *tc, const struct tile *t, int cell,
+                double threshold)
+{
+        int y0 = 4 * (TILE_ROWS * t->row + cell / TILE_COLS);
+        int x0 = 2 * (TILE_COLS * t->col + cell % TILE_COLS);
+        int r, c, y, x;
+        unsigned int idx = 0;
+
+        for(r = 0, y = y0; r < 4 && y < tc->dist.nres; r++, y++)
+                for(c = 0, x = x0; c < 2 && x < tc->dist.nres; c++, x++)
+                        if(getdist(tc->dist, y, x) <= threshold)
+                                idx |= 1 << (2 * r + c);
+        return idx;
+}
+
+/**
+ * rethreshold_tile: bring a copy of a tile to a new threshold
+ *
+ * @tc:        tile cache, for the distance matrix
+ * @t:         tile, still holding the patterns for t->threshold
+ * @threshold: new threshold for defining a contact (Angstroms)
+ *
+ * A cell can only change if some distance in it lies between the old and
+ * new thresholds, so only cells whose recorded range overlaps that interval
+ * are recomputed.
+ */
+static void
+rethreshold_tile(const struct tile_cache *tc, struct tile *t, double threshold)
+{
+        unsigned char qlo, qhi;
+        int cell;
+
+        if(threshold < t->threshold){
+                qlo = dm_quantize(threshold);
+                qhi = dm_quantize(t->threshold);
+        }
+        else {
+                qlo = dm_quantize(t->threshold);
+                qhi = dm_quantize(threshold);
+        }
+        for(cell = 0; cell < TILE_CELLS; cell++){
+                if(t->qmin[cell] > qhi || t->qmax[cell] < qlo)
+                        continue;
+                t->pattern[cell] = cell_bits(tc, t, cell, threshold);
+        }
+        t->threshold = threshold;
+}
+
+/**
+ * tile_bucket: hash chain holding the tiles at one position
+ */
+static int *
+tile_bucket(struct tile_cache *tc, int row, int col)
+{
+        unsigned long h = (unsigned long) row * 2654435761UL ^ (unsigned) col;
+
+        return tc->bucket + (h & (tc->nbuckets - 1));
+}
+
+/**
+ * unlink_tile: remove a tile from its hash chain, if it is in one
+ */
+static void
+unlink_tile(struct tile_cache *tc, struct tile *t)
+{
+        int *link, slot = t - tc->tiles;
+
+        if(t->row < 0) return;
+        for(link = tile_bucket(tc, t->row, t->col); *link != slot;
+                        link = &tc->tiles[*link].next)
+                ;
+        *link = t->next;
+        t->next = -1;
+}
+
+/**
+ * get_tile: look up a tile, computing it if it isn't cached
+ *
+ * @tc:        tile cache
+ * @row, @col: position of the tile, in tiles
+ * @threshold: threshold for defining a contact (Angstroms)
+ *
+ * A tile missing at @threshold is derived from the most recently used copy
+ * of the same tile at another threshold if there is one, and otherwise
+ * computed from the distance matrix. It replaces the least recently used
+ * tile in the cache.
+ *
+ * Only the tiles at the same position are looked at to find a hit; the
+ * whole cache is searched for the least recently used tile on a miss.
+ *
+ * Returns a pointer to the tile, which stays valid until the next call.
+ */
+const struct tile *
+get_tile(struct tile_cache *tc, int row, int col, double threshold)
+{
+        struct tile *t, *victim = NULL, *source = NULL;
+        int *head = tile_bucket(tc, row, col);
+        int slot;
+        size_t i;
+
+        tc->clock++;
+        for(slot = *head; slot >= 0; slot = t->next){
+                t = tc->tiles + slot;
+                if(t->row == row && t->col == col){
+                        if(t->threshold == threshold){
+                                t->last_used = tc->clock;
+                                return t;
+                        }
+                        if(source == NULL || t->last_used > source->last_used)
+                                source = t;
+                }
+        }
+        for(i = 0; i < tc->ntiles; i++){
+                t = tc->tiles + i;
+                if(t == source) continue;
+                if(victim == NULL || t->last_used < victim->last_used)
+                        victim = t;
+        }
+
+        unlink_tile(tc, victim);
+        if(source != NULL){
+                memcpy(victim, source, sizeof(*victim));
+                rethreshold_tile(tc, victim, threshold);
+        }
+        else {
+                victim->row = row;
+                victim->col = col;
+                victim->threshold = threshold;
+                fill_tile(tc, victim);
+        }
+        victim->last_used = tc->clock;
+        victim->next = *head;
+        *head = victim - tc->tiles;
+        return victim;
+}
+
+/**
+ * prefetch_tiles: compute the tiles just beyond a view ahead of time
+ *
+ * @tc:              tile cache
+ * @y, @x:           top left cell of the view
+ * @height, @width:  size of the view, in cells
+ * @dy, @dx:         direction the view last moved in (-1, 0 or 1 each)
+ * @threshold:       threshold for defining a contact (Angstroms)
+ *
+ * Loads the band of tiles adjacent to the view on the side it is moving
+ * towards, so that the next step in the same direction is a cache hit.
+ */
+void
+prefetch_tiles(struct tile_cache *tc, int y, int x, int height, int width,
+                int dy, int dx, double threshold)
+{
+        int r0 = y / TILE_ROWS, r1 = (y + height - 1) / TILE_ROWS;
+        int c0 = x / TILE_COLS, c1 = (x + width - 1) / TILE_COLS;
+        int nrows = (tc->rows + TILE_ROWS - 1) / TILE_ROWS;
+        int ncols = (tc->cols + TILE_COLS - 1) / TILE_COLS;
+        int r, c;
+
+        if(dy > 0) r0 = r1 = r1 + 1;
+        if(dy < 0) r0 = r1 = r0 - 1;
+        if(dx > 0) c0 = c1 = c1 + 1;
+        if(dx < 0) c0 = c1 = c0 - 1;
+        if(r0 < 0) r0 = 0;
+        if(c0 < 0) c0 = 0;
+        if(r1 >= nrows) r1 = nrows - 1;
+        if(c1 >= ncols) c1 = ncols - 1;
+        for(r = r0; r <= r1; r++)
+                for(c = c0; c <= c1; c++)
+                        get_tile(tc, r, c, threshold);
+}
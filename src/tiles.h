@@ -0,0 +1,84 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#ifndef CMAP_TILES_H_
+#define CMAP_TILES_H_
+
+#include<stddef.h>
+#include "pdb.h"
+
+/*
+ * The viewer draws the contact map from fixed-size tiles of braille cells,
+ * each cell covering 4 rows and 2 columns of the map. A tile of 20 x 40
+ * cells covers 80 x 80 residues and lines up with the 10 x 5 checkerboard.
+ */
+#define TILE_ROWS 20
+#define TILE_COLS 40
+#define TILE_CELLS (TILE_ROWS * TILE_COLS)
+
+/* Number of tiles kept in a struct tile_cache */
+#define TILE_CACHE_SIZE 1024
+
+/*
+ * One tile of the map at one threshold: the braille_lut index of each cell,
+ * and the smallest and largest distance among the cell's residue pairs,
+ * quantised as for DM_UINT8. Cells are stored row by row; cells past the
+ * edge of the map are blank.
+ */
+struct tile{
+        unsigned char pattern[TILE_CELLS];
+        unsigned char qmin[TILE_CELLS];
+        unsigned char qmax[TILE_CELLS];
+        double threshold;
+        unsigned long last_used;
+        int row;
+        int col;
+        int next;
+};
+
+/*
+ * A least-recently-used cache of tiles, keyed by tile position and
+ * threshold. @rows and @cols are the size of the whole map in cells;
+ * empty slots have a tile row of -1.
+ *
+ * Tiles are found through a hash table on their position: @bucket holds
+ * the first slot of each of @nbuckets chains, and each tile's @next the
+ * slot after it, or -1. Copies of one tile at different thresholds share
+ * a chain.
+ */
+struct tile_cache{
+        struct tile *tiles;
+        int *bucket;
+        struct distmat dist;
+        unsigned long clock;
+        size_t ntiles;
+        size_t nbuckets;
+        int rows;
+        int cols;
+};
+
+void freetilecache(struct tile_cache *tc);
+const struct tile * get_tile(struct tile_cache *tc, int row, int col,
+                double threshold);
+struct tile_cache * make_tile_cache(struct distmat dist, size_t ntiles);
+void prefetch_tiles(struct tile_cache *tc, int y, int x, int height, int width,
+                int dy, int dx, double threshold);
+
+#endif // CMAP_TILES_H_
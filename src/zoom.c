@@ -0,0 +1,244 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#include<stdint.h>
+#include<stdlib.h>
+
+#include"contacts.h"
+#include"pdb.h"
+#include"zoom.h"
+
+/**
+ * popcount64: number of set bits in a 64-bit word
+ */
+static inline int
+popcount64(uint64_t w)
+{
+#if defined(__GNUC__)
+        return __builtin_popcountll(w);
+#else
+        w = w - ((w >> 1) & 0x5555555555555555ULL);
+        w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+        w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+        return (int) ((w * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/**
+ * make_zoom_pyramid: create an empty set of zoom levels for a distance matrix
+ *
+ * @dist: distance matrix; it must outlive the pyramid
+ *
+ * Allocates and returns a struct zoom_pyramid which should be freed with
+ * freezoompyramid(), or returns NULL if memory can't be allocated.
+ */
+struct zoom_pyramid *
+make_zoom_pyramid(struct distmat dist)
+{
+        struct zoom_pyramid *zp;
+        int i;
+
+        zp = malloc(sizeof(*zp));
+        if(zp == NULL) return NULL;
+        for(i = 0; i < ZOOM_LEVELS; i++){
+                zp->levels[i].sat = NULL;
+                zp->levels[i].scale = 1 << i;
+                zp->levels[i].blocks = (dist.nres + (1 << i) - 1) >> i;
+        }
+        zp->bm = NULL;
+        zp->dist = dist;
+        zp->threshold = 0;
+        return zp;
+}
+
+/**
+ * clear_levels: forget every zoom level and the bitmap they were built from
+ */
+static void
+clear_levels(struct zoom_pyramid *zp)
+{
+        int i;
+        for(i = 0; i < ZOOM_LEVELS; i++){
+                free(zp->levels[i].sat);
+                zp->levels[i].sat = NULL;
+        }
+        freebitmap(zp->bm);
+        zp->bm = NULL;
+}
+
+/**
+ * freezoompyramid: free a struct zoom_pyramid allocated by make_zoom_pyramid()
+ * @zp: pointer to struct zoom_pyramid which is to be freed
+ */
+void
+freezoompyramid(struct zoom_pyramid *zp)
+{
+        if(zp == NULL) return;
+        clear_levels(zp);
+        free(zp);
+}
+
+/**
+ * sat_from_bitmap: build a zoom level's table by counting bitmap bits
+ *
+ * Counts the contacts in each block, then turns the counts into running
+ * sums along rows and down columns. Scales are powers of two, so a block
+ * either holds whole 64-bit words or divides one evenly.
+ */
+static void
+sat_from_bitmap(struct zoom_level *zl, const struct contact_bitmap *bm)
+{
+        size_t stride = zl->blocks + 1;
+        uint32_t *row;
+        uint64_t word, mask;
+        size_t w;
+        int y, i, j, s, k = zl->scale;
+
+        mask = k >= 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << k) - 1;
+        for(y = 0; y < bm->nres; y++){
+                row = zl->sat + (size_t) (y / k + 1) * stride + 1;
+                for(w = 0; w < bm->words_per_row; w++){
+                        word = bm->bits[(size_t) y * bm->words_per_row + w];
+                        if(word == 0) continue;
+                        if(k >= 64){
+                                row[w * 64 / k] += popcount64(word);
+                                continue;
+                        }
+                        for(s = 0; s < 64; s += k)
+                                if((word >> s) & mask)
+                                        row[(w * 64 + s) / k] +=
+                                                popcount64((word >> s) & mask);
+                }
+        }
+        for(i = 1; i <= zl->blocks; i++)
+                for(j = 1; j <= zl->blocks; j++)
+                        zl->sat[i * stride + j] += zl->sat[(i - 1) * stride + j]
+                                + zl->sat[i * stride + j - 1]
+                                - zl->sat[(i - 1) * stride + j - 1];
+}
+
+/**
+ * sat_from_finer: build a zoom level's table by sampling a finer level
+ *
+ * A block boundary at this level is also one at every finer level, so the
+ * table is just the finer table read at every (scale / finer scale)th
+ * entry, clipped to the edge of the map.
+ */
+static void
+sat_from_finer(struct zoom_level *zl, const struct zoom_level *finer)
+{
+        size_t stride = zl->blocks + 1, fstride = finer->blocks + 1;
+        int r = zl->scale / finer->scale;
+        int i, j, fi, fj;
+
+        for(i = 0; i <= zl->blocks; i++){
+                fi = i * r < finer->blocks ? i * r : finer->blocks;
+                for(j = 0; j <= zl->blocks; j++){
+                        fj = j * r < finer->blocks ? j * r : finer->blocks;
+                        zl->sat[i * stride + j] = finer->sat[fi * fstride + fj];
+                }
+        }
+}
+
+/**
+ * get_zoom_level: look up a zoom level, building it if necessary
+ *
+ * @zp:        set of zoom levels
+ * @level:     zoom level, 1 .. ZOOM_LEVELS - 1
+ * @threshold: threshold for defining a contact (Angstroms)
+ *
+ * Changing the threshold discards every level and rebuilds the contact
+ * bitmap, which takes one pass over the distance matrix. Levels at the
+ * same threshold are then sampled from the nearest finer level already
+ * built, or counted from the bitmap.
+ *
+ * Returns the zoom level, or NULL if memory can't be allocated.
+ */
+const struct zoom_level *
+get_zoom_level(struct zoom_pyramid *zp, int level, double threshold)
+{
+        struct zoom_level *zl = zp->levels + level;
+        size_t stride = zl->blocks + 1;
+        int i;
+
+        if(zp->bm == NULL || zp->threshold != threshold){
+                clear_levels(zp);
+                zp->bm = make_bitmap(zp->dist, threshold);
+                if(zp->bm == NULL) return NULL;
+                zp->threshold = threshold;
+        }
+        if(zl->sat != NULL) return zl;
+
+        zl->sat = calloc(stride * stride, sizeof(*zl->sat));
+        if(zl->sat == NULL) return NULL;
+        for(i = level - 1; i > 0; i--)
+                if(zp->levels[i].sat != NULL) break;
+        if(i > 0)
+                sat_from_finer(zl, zp->levels + i);
+        else
+                sat_from_bitmap(zl, zp->bm);
+        return zl;
+}
+
+/**
+ * zoom_count: number of contacts in a rectangle of blocks
+ *
+ * @zl:     zoom level
+ * @y0, @x0: first block row and column of the rectangle
+ * @y1, @x1: block row and column just past the rectangle
+ *
+ * The rectangle is clipped to the map.
+ */
+uint32_t
+zoom_count(const struct zoom_level *zl, int y0, int x0, int y1, int x1)
+{
+        size_t stride = zl->blocks + 1;
+        if(y1 > zl->blocks) y1 = zl->blocks;
+        if(x1 > zl->blocks) x1 = zl->blocks;
+        if(y0 >= y1 || x0 >= x1) return 0;
+        return zl->sat[y1 * stride + x1] - zl->sat[y0 * stride + x1]
+                - zl->sat[y1 * stride + x0] + zl->sat[y0 * stride + x0];
+}
+
+/**
+ * zoom_area: number of residue pairs in a rectangle of blocks
+ *
+ * @zl:      zoom level
+ * @nres:    number of residues in the map
+ * @y0, @x0: first block row and column of the rectangle
+ * @y1, @x1: block row and column just past the rectangle
+ *
+ * Blocks at the edge of the map may be partly outside it; only pairs of
+ * real residues are counted.
+ */
+size_t
+zoom_area(const struct zoom_level *zl, int nres, int y0, int x0, int y1,
+                int x1)
+{
+        size_t h, w;
+        y0 *= zl->scale; y1 *= zl->scale;
+        x0 *= zl->scale; x1 *= zl->scale;
+        if(y1 > nres) y1 = nres;
+        if(x1 > nres) x1 = nres;
+        if(y0 >= y1 || x0 >= x1) return 0;
+        h = y1 - y0;
+        w = x1 - x0;
+        return h * w;
+}
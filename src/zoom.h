@@ -0,0 +1,68 @@
+/* 
+ *  Copyright 2018 Gearoid Fox
+ * 
+ *  This file is part of cmap.
+ *
+ *  cmap is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  cmap is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with cmap.  If not, see <http://www.gnu.org/licenses/>. 
+ *
+ */
+
+#ifndef CMAP_ZOOM_H_
+#define CMAP_ZOOM_H_
+
+#include<stddef.h>
+#include<stdint.h>
+#include "contacts.h"
+#include "pdb.h"
+
+/*
+ * Zoom level L shows the map with each dot summarising a block of
+ * 2^L x 2^L residue pairs; level 0 is the full-resolution map.
+ */
+#define ZOOM_LEVELS 16
+
+/*
+ * One zoom level: a summed-area table over the contact bitmap, sampled at
+ * block boundaries. sat[i * (blocks + 1) + j] is the number of contacts
+ * (y, x) with y < i * scale and x < j * scale, so the contacts in any
+ * rectangle of blocks can be counted in constant time.
+ */
+struct zoom_level{
+        uint32_t *sat;
+        int scale;
+        int blocks;
+};
+
+/*
+ * Zoom levels of one distance matrix at one threshold, built on demand
+ * from a contact bitmap that is kept so that no level needs another pass
+ * over the distance matrix.
+ */
+struct zoom_pyramid{
+        struct zoom_level levels[ZOOM_LEVELS];
+        struct contact_bitmap *bm;
+        struct distmat dist;
+        double threshold;
+};
+
+void freezoompyramid(struct zoom_pyramid *zp);
+const struct zoom_level * get_zoom_level(struct zoom_pyramid *zp, int level,
+                double threshold);
+struct zoom_pyramid * make_zoom_pyramid(struct distmat dist);
+size_t zoom_area(const struct zoom_level *zl, int nres, int y0, int x0,
+                int y1, int x1);
+uint32_t zoom_count(const struct zoom_level *zl, int y0, int x0, int y1,
+                int x1);
+
+#endif // CMAP_ZOOM_H_